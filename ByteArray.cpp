@@ -1,24 +1,32 @@
 #include "ByteArray.h"
 #include "endian.h"
+#include "log.h"
 #include <sstream>
 #include <string.h>
 #include <iomanip>
 #include <cmath>
+#include <atomic>
+#include <new>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 namespace WebServer {
 
+	// 负数取反时不能用-v, INT_MIN会溢出
 	static uint32_t EncodeZigzag32(const int32_t& v) {
-		if (v < 0)
-			return ((uint32_t)(-v)) * 2 - 1;
-		else
-			return v * 2;
+		return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
 	}
 
 	static uint64_t EncodeZigzag64(const int64_t& v) {
-		if (v < 0)
-			return ((uint32_t)(-v)) * 2 - 1;
-		else
-			return v * 2;
+		return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
 	}
 
 	static int32_t DecodeZigzag32(const uint32_t& v) {
@@ -28,9 +36,35 @@ namespace WebServer {
 	static int64_t DecodeZigzag64(const uint64_t& v) {
 		return (v >> 1) ^ -(v & 1);
 	}
+
+	// 编码一个varint, p至少要有10字节空间, 返回编码后的字节数
+	static inline size_t EncodeVarint(uint8_t* p, uint64_t value) {
+		size_t i = 0;
+		while (value >= 0x80) {
+			p[i++] = (uint8_t)(value | 0x80);
+			value >>= 7;
+		}
+		p[i++] = (uint8_t)value;
+		return i;
+	}
+
+	// 从p开始解一个varint, 最多读到end, 在end之前没有结束(或者超长)返回nullptr
+	template<typename T>
+	static inline const uint8_t* DecodeVarint(const uint8_t* p, const uint8_t* end, T& value) {
+		T result = 0;
+		for (int shift = 0; shift < (int)sizeof(T) * 8 && p < end; shift += 7) {
+			uint8_t b = *p++;
+			result |= (T)(b & 0x7F) << shift;
+			if (b < 0x80) {
+				value = result;
+				return p;
+			}
+		}
+		return nullptr;
+	}
 	
-	ByteArray::Node::Node(size_t s)
-		:ptr(new char[s]), next(nullptr), size(s)
+	ByteArray::Node::Node(char* p, size_t s)
+		:ptr(p), next(nullptr), size(s)
 	{
 	}
 	
@@ -41,8 +75,95 @@ namespace WebServer {
 	}
 
 	ByteArray::Node::~Node() {
-		if (ptr)
-			delete[] ptr;
+	}
+
+	// 每个线程缓存的内存块总字节数上限
+	static std::atomic<size_t> s_PoolHighWater{ 4 * 1024 * 1024 };
+
+	// 按块大小分开缓存, 一般只会用到一两种块大小
+	struct NodeFreeList {
+		static const int SIZE_CLASSES = 4;
+
+		struct SizeClass {
+			size_t size = 0;
+			ByteArray::Node* head = nullptr;
+		};
+
+		~NodeFreeList() {
+			for (auto& i : classes) {
+				while (i.head) {
+					ByteArray::Node* node = i.head;
+					i.head = node->next;
+					node->~Node();
+					::operator delete(node);
+				}
+			}
+			bytes = 0;
+			destroyed = true;
+		}
+
+		SizeClass classes[SIZE_CLASSES];
+		size_t bytes = 0;
+		static thread_local bool destroyed;
+	};
+
+	thread_local bool NodeFreeList::destroyed = false;
+	static thread_local NodeFreeList t_NodeFreeList;
+
+	void ByteArray::SetPoolHighWater(size_t bytes) {
+		s_PoolHighWater = bytes;
+	}
+
+	size_t ByteArray::GetPoolHighWater() {
+		return s_PoolHighWater;
+	}
+
+	size_t ByteArray::GetPooledBytes() {
+		return NodeFreeList::destroyed ? 0 : t_NodeFreeList.bytes;
+	}
+
+	ByteArray::Node* ByteArray::AllocNode(size_t size) {
+		if (!NodeFreeList::destroyed) {
+			NodeFreeList& list = t_NodeFreeList;
+			for (auto& i : list.classes) {
+				if (i.size == size && i.head) {
+					Node* node = i.head;
+					i.head = node->next;
+					node->next = nullptr;
+					list.bytes -= size;
+					return node;
+				}
+			}
+		}
+		void* mem = ::operator new(sizeof(Node) + size);
+		return new(mem) Node((char*)mem + sizeof(Node), size);
+	}
+
+	void ByteArray::FreeNode(Node* node) {
+		if (!NodeFreeList::destroyed) {
+			NodeFreeList& list = t_NodeFreeList;
+			if (list.bytes + node->size <= s_PoolHighWater.load(std::memory_order_relaxed)) {
+				// 先找同样大小的, 没有就占用一个空的
+				NodeFreeList::SizeClass* target = nullptr;
+				for (auto& i : list.classes) {
+					if (i.size == node->size) {
+						target = &i;
+						break;
+					}
+					if (!target && !i.head)
+						target = &i;
+				}
+				if (target) {
+					target->size = node->size;
+					node->next = target->head;
+					target->head = node;
+					list.bytes += node->size;
+					return;
+				}
+			}
+		}
+		node->~Node();
+		::operator delete(node);
 	}
 
 	ByteArray::ByteArray(size_t baseSize)
@@ -51,17 +172,56 @@ namespace WebServer {
 		,m_Capacity(baseSize)
 		,m_Size(0)
 		,m_Endian(WS_BIG_ENDIAN)
-		,m_Root(new Node(baseSize))
+		,m_Root(AllocNode(baseSize))
 		,m_Cur(m_Root)
 	{
 	}
 
+	ByteArray::ByteArray(char* data, size_t size)
+		:m_BaseSize(size)
+		,m_Position(0)
+		,m_Capacity(size)
+		,m_Size(size)
+		,m_Endian(WS_BIG_ENDIAN)
+		,m_Root(new Node(data, size))
+		,m_Cur(m_Root)
+		,m_MapSize(size)
+	{
+	}
+
+	ByteArray::bytearrayPtr ByteArray::MapFile(const std::string& name) {
+		int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			WS_LOG_ERROR("MapFile open name={} errno={} errstr={}", name, errno, strerror(errno));
+			return nullptr;
+		}
+		struct stat st;
+		if (fstat(fd, &st) || st.st_size == 0) {
+			close(fd);
+			return nullptr;
+		}
+		void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED) {
+			WS_LOG_ERROR("MapFile mmap name={} size={} errno={} errstr={}", name, st.st_size, errno, strerror(errno));
+			return nullptr;
+		}
+		// 解码基本是顺序读, 让内核加大预读
+		madvise(data, st.st_size, MADV_SEQUENTIAL);
+		return bytearrayPtr(new ByteArray((char*)data, st.st_size));
+	}
+
 	ByteArray::~ByteArray() {
+		if (m_MapSize) {
+			munmap(m_Root->ptr, m_MapSize);
+			delete m_Root;
+			return;
+		}
 		Node* tmp = m_Root;
 		while (tmp) {
 			m_Cur = tmp;
 			tmp = tmp->next;
-			delete[] m_Cur;
+			FreeNode(m_Cur);
 		}
 	}
 
@@ -74,7 +234,7 @@ namespace WebServer {
 	}
 
 	void ByteArray::writeFint16(int16_t value) {
-		// ÿַԪ洢һֽ,int8uint8ת
+		// 计算机中每个地址单元存储一个字节,因此int8和uint8不用转
 		if (m_Endian != WS_BYTE_ORDER)
 			value = byteswap(value);
 		write(&value, sizeof(value));
@@ -110,20 +270,20 @@ namespace WebServer {
 		write(&value, sizeof(value));
 	}
 
-	// зŵı޷ŵ,ͳһѹ
+	// 有符号的变成无符号的,方便进行统一压缩
 	void ByteArray::writeInt32(int32_t value) {
 		writeUint32(EncodeZigzag32(value));
 	}
 
+	// 当前内存块剩余的空间够一个最长的varint时直接编码进去, 不够再走通用的write
 	void ByteArray::writeUint32(uint32_t value) {
-		uint8_t tmp[5];
-		uint8_t i = 0;
-		while (value >= 0x80) {
-			tmp[i++] = (value & 0x7F) | 0x80;
-			value >>= 7;
+		size_t npos = m_Position % m_BaseSize;
+		if (m_Cur && !m_MapSize && m_Cur->size - npos >= 5) {
+			forward(EncodeVarint((uint8_t*)m_Cur->ptr + npos, value), npos);
+			return;
 		}
-		tmp[i++] = value;
-		write(tmp, i);
+		uint8_t tmp[5];
+		write(tmp, EncodeVarint(tmp, value));
 	}
 
 	void ByteArray::writeInt64(int64_t value) {
@@ -131,25 +291,47 @@ namespace WebServer {
 	}
 
 	void ByteArray::writeUint64(uint64_t value) {
+		size_t npos = m_Position % m_BaseSize;
+		if (m_Cur && !m_MapSize && m_Cur->size - npos >= 10) {
+			forward(EncodeVarint((uint8_t*)m_Cur->ptr + npos, value), npos);
+			return;
+		}
 		uint8_t tmp[10];
-		uint8_t i = 0;
-
-		while (value >= 0x80) {
-			tmp[i++] = (value & 0x7F) | 0x80;
-			value >>= 7;
+		write(tmp, EncodeVarint(tmp, value));
+	}
+
+	void ByteArray::writeUint32Array(const uint32_t* values, size_t count) {
+		size_t i = 0;
+		while (i < count) {
+			size_t npos = m_Position % m_BaseSize;
+			size_t room = (m_Cur && !m_MapSize) ? m_Cur->size - npos : 0;
+			// 块尾不够一个最长的varint, 单个写, 需要时会分配新的内存块
+			if (room < 5) {
+				writeUint32(values[i++]);
+				continue;
+			}
+			uint8_t* begin = (uint8_t*)m_Cur->ptr + npos;
+			uint8_t* p = begin;
+			uint8_t* limit = begin + room - 5;
+			while (i < count && p <= limit) {
+				uint32_t v = values[i++];
+				if (v < 0x80)
+					*p++ = (uint8_t)v;
+				else
+					p += EncodeVarint(p, v);
+			}
+			forward(p - begin, npos);
 		}
-		tmp[i++] = value;
-		write(tmp, i);
 	}
 
-	// float4ֽ,uint32_tҲ4ֽ
+	// float是4字节,uint32_t也是4字节
 	void ByteArray::writeFloat(float value) {
 		uint32_t v;
 		memcpy(&v, &value, sizeof(value));
 		writeFuint32(v);
 	}
 
-	// double8ֽ
+	// double是8字节
 	void ByteArray::writeDouble(double value) {
 		uint64_t v;
 		memcpy(&v, &value, sizeof(value));
@@ -229,7 +411,20 @@ namespace WebServer {
 		return DecodeZigzag32(readUint32());
 	}
 
+	// 当前内存块里连续可读的字节能解出一个完整的varint时直接解, 否则按字节读(跨内存块)
 	uint32_t ByteArray::readUint32() {
+		if (m_Cur) {
+			size_t npos = m_Position % m_BaseSize;
+			const uint8_t* p = (const uint8_t*)m_Cur->ptr + npos;
+			const uint8_t* end = p + std::min(m_Cur->size - npos, getReadSize());
+			uint32_t value;
+			const uint8_t* next = DecodeVarint(p, end, value);
+			if (next) {
+				forward(next - p, npos);
+				return value;
+			}
+		}
+
 		uint32_t result = 0;
 		for(int i = 0; i < 32; i+=7){
 			uint8_t b = readFuint8();
@@ -244,37 +439,92 @@ namespace WebServer {
 		return result;
 	}
 
+	void ByteArray::readUint32Array(uint32_t* values, size_t count) {
+		size_t i = 0;
+		while (i < count) {
+			size_t npos = m_Position % m_BaseSize;
+			size_t avail = m_Cur ? std::min(m_Cur->size - npos, getReadSize()) : 0;
+			// 块尾剩下的不够一次8字节加载, 单个读
+			if (avail < 16) {
+				values[i++] = readUint32();
+				continue;
+			}
+			const uint8_t* begin = (const uint8_t*)m_Cur->ptr + npos;
+			const uint8_t* end = begin + avail;
+			const uint8_t* p = begin;
+			bool bad = false;
+			while (i < count && p + 8 <= end) {
+				uint64_t word;
+				memcpy(&word, p, sizeof(word));
+				// 最低的几个没有续位的字节各自就是一个值
+				uint64_t mask = word & 0x8080808080808080ull;
+				size_t singles = mask ? __builtin_ctzll(mask) >> 3 : 8;
+				singles = std::min(singles, count - i);
+				for (size_t j = 0; j < singles; j++)
+					values[i + j] = p[j];
+				i += singles;
+				p += singles;
+				if (i == count || singles == 8)
+					continue;
+				const uint8_t* next = DecodeVarint(p, end, values[i]);
+				if (!next) {
+					bad = true;
+					break;
+				}
+				i++;
+				p = next;
+			}
+			forward(p - begin, npos);
+			// 超长的varint交给按字节读的路径, 和readUint32的行为一致
+			if (bad)
+				values[i++] = readUint32();
+		}
+	}
+
 	int64_t ByteArray::readInt64() {
 		return DecodeZigzag64(readUint64());
 	}
 
 	uint64_t ByteArray::readUint64() {
+		if (m_Cur) {
+			size_t npos = m_Position % m_BaseSize;
+			const uint8_t* p = (const uint8_t*)m_Cur->ptr + npos;
+			const uint8_t* end = p + std::min(m_Cur->size - npos, getReadSize());
+			uint64_t value;
+			const uint8_t* next = DecodeVarint(p, end, value);
+			if (next) {
+				forward(next - p, npos);
+				return value;
+			}
+		}
+
 		uint64_t result = 0;
-		for (int i = 0; i < 64; i++) {
+		for (int i = 0; i < 64; i += 7) {
 			uint8_t b = readFuint8();
 			if (b < 0x80) {
 				result |= ((uint64_t)b) << i;
 				return result;
 			}
 			else {
-				result |= ((uint64_t)((b & 0x7F) << i));
+				result |= ((uint64_t)(b & 0x7F)) << i;
 			}
 		}
 		return result;
 	}
 
+	// 和writeFloat/writeDouble对应, 按定长读
 	float ByteArray::readFloat() {
-		uint32_t v = readUint32();
+		uint32_t v = readFuint32();
 		float value;
 		memcpy(&value, &v, sizeof(v));
-		return v;
+		return value;
 	}
 
 	double ByteArray::readDouble() {
-		uint64_t v = readUint64();
+		uint64_t v = readFuint64();
 		double value;
 		memcpy(&value, &v, sizeof(v));
-		return v;
+		return value;
 	}
 
 	std::string ByteArray::readStringF16() {
@@ -313,9 +563,9 @@ namespace WebServer {
 		if (v > m_Capacity)
 			throw std::out_of_range("set_position out if range");
 		m_Position = v;
-		// ൱һ,m_PositionʵʵݴСm_Size,˰m_Size
-		// m_Sizem_Positionһ,Ҳûжȡ
-		// ֮ǰжv<=m_Capacity,m_PositionܹЧλһǷڴ 
+		// 相当于是扩容一下,现在m_Position比实际的数据大小m_Size大,因此把m_Size扩大
+		// 由于扩大后m_Size和m_Position一样大,因此也没有读取的数据
+		// 之前判断了v<=m_Capacity,因此m_Position能够到达的有效位置一定是分配了内存的 
 		if (m_Position > m_Size)
 			m_Size = m_Position;
 		m_Cur = m_Root;
@@ -363,11 +613,28 @@ namespace WebServer {
 		return ss.str();
 	}
 
+	void ByteArray::forward(size_t size) {
+		forward(size, m_Position % m_BaseSize);
+	}
+
+	void ByteArray::forward(size_t size, size_t npos) {
+		npos += size;
+		m_Position += size;
+		while (m_Cur && npos >= m_Cur->size) {
+			npos -= m_Cur->size;
+			m_Cur = m_Cur->next;
+		}
+		if (m_Position > m_Size)
+			m_Size = m_Position;
+	}
+
 	void ByteArray::addCapacity(size_t size) {
 		if (size == 0)
 			return;
-		size_t oldCap = getCapacity();
-		// size_t oldCap = m_Cur->size - m_Position % m_BaseSize;
+		if (m_MapSize)
+			throw std::logic_error("write to read-only ByteArray");
+		// 剩余可写的容量, 不是总容量
+		size_t oldCap = getCapacity() - m_Position;
 		if (oldCap >= size)
 			return;
 		size = size - oldCap;
@@ -378,15 +645,15 @@ namespace WebServer {
 
 		Node* first = nullptr;
 		for (size_t i = 0; i < count; i++) {
-			tmp->next = new Node(m_BaseSize);
+			tmp->next = AllocNode(m_BaseSize);
 			if (first == nullptr)
 				first = tmp->next;
 			tmp = tmp->next;
 			m_Capacity += m_BaseSize;
 		}
 
-		// ʼbaseSize0,ͻ
-		if (getCapacity() == 0)
+		// 原来的内存块正好写满时m_Cur已经是nullptr, 从新加的第一块开始写
+		if (oldCap == 0)
 			m_Cur = first;
 	}
 
@@ -397,7 +664,7 @@ namespace WebServer {
 		while (tmp) {
 			m_Cur = tmp;
 			tmp = tmp->next;
-			delete[] m_Cur;
+			FreeNode(m_Cur);
 		}
 		m_Cur = m_Root;
 		m_Root->next = nullptr;
@@ -408,7 +675,7 @@ namespace WebServer {
 			return;
 		addCapacity(size);
 
-		// ȷǰڴʣڴܷд
+		// 确定当前内存块剩余的内存能否继续写入数据
 		size_t npos = m_Position % m_BaseSize;
 		size_t ncap = m_Cur->size - npos;
 		size_t bpos = 0;
@@ -423,7 +690,7 @@ namespace WebServer {
 				size = 0;
 			}
 			else {
-				memcpy(m_Cur->ptr, (const char*)buf + bpos, ncap);
+				memcpy(m_Cur->ptr + npos, (const char*)buf + bpos, ncap);
 				m_Position += ncap;
 				bpos += ncap;
 				size -= ncap;
@@ -433,7 +700,7 @@ namespace WebServer {
 			}
 		}
 
-		// дm_Sizeûи
+		// 写入完后m_Size还没有更新
 		if (m_Position > m_Size)
 			m_Size = m_Position;
 	}
@@ -477,7 +744,7 @@ namespace WebServer {
 		Node* cur = m_Cur;
 		while (size > 0) {
 			if (ncap >= size) {
-				memcpy((char*)buf + bpos, m_Cur->ptr + npos, size);
+				memcpy((char*)buf + bpos, cur->ptr + npos, size);
 				if (cur->size == (npos + size))
 					cur = cur->next;
 				position += size;
@@ -485,7 +752,7 @@ namespace WebServer {
 				size = 0;
 			}
 			else {
-				memcpy((char*)buf + bpos, m_Cur->ptr + npos, ncap);
+				memcpy((char*)buf + bpos, cur->ptr + npos, ncap);
 				position += ncap;
 				bpos += ncap;
 				size -= ncap;
@@ -497,14 +764,105 @@ namespace WebServer {
 		}
 	}
 
-	// TODO: writeToFile
 	bool ByteArray::writeToFile(const std::string& name) const {
-		return false;
+		int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			WS_LOG_ERROR("writeToFile open name={} errno={} errstr={}", name, errno, strerror(errno));
+			return false;
+		}
+
+		std::vector<iovec> iovs;
+		iovs.reserve(IOV_MAX);
+		size_t position = m_Position;
+		size_t npos = position % m_BaseSize;
+		Node* cur = m_Cur;
+		bool ok = true;
+		while (position < m_Size) {
+			iovs.clear();
+			Node* tmp = cur;
+			size_t tpos = npos;
+			size_t left = m_Size - position;
+			while (left > 0 && iovs.size() < IOV_MAX) {
+				size_t len = std::min(tmp->size - tpos, left);
+				iovs.push_back({ tmp->ptr + tpos, len });
+				left -= len;
+				tpos = 0;
+				tmp = tmp->next;
+			}
+
+			ssize_t rt = writev(fd, &iovs[0], iovs.size());
+			if (rt < 0) {
+				if (errno == EINTR)
+					continue;
+				WS_LOG_ERROR("writeToFile writev name={} errno={} errstr={}", name, errno, strerror(errno));
+				ok = false;
+				break;
+			}
+			// 按实际写入的字节数前移, 只写了一部分时下一轮从断点继续
+			position += rt;
+			npos += rt;
+			while (cur && npos >= cur->size) {
+				npos -= cur->size;
+				cur = cur->next;
+			}
+		}
+		close(fd);
+		return ok;
 	}
 
-	// TODO: readFromFile
 	bool ByteArray::readFromFile(const std::string& name) {
-		return false;
+		// MapFile得到的只读视图不能写入, 在打开文件之前返回, 不用处理fd
+		if (isReadOnly()) {
+			WS_LOG_ERROR("readFromFile into read-only ByteArray name={}", name);
+			return false;
+		}
+		int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			WS_LOG_ERROR("readFromFile open name={} errno={} errstr={}", name, errno, strerror(errno));
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st)) {
+			close(fd);
+			return false;
+		}
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+		size_t left = st.st_size;
+		// 一次分配好, 之后直接readv进内存块
+		addCapacity(left);
+		std::vector<iovec> iovs;
+		iovs.reserve(IOV_MAX);
+		bool ok = true;
+		while (left > 0) {
+			iovs.clear();
+			Node* tmp = m_Cur;
+			size_t tpos = m_Position % m_BaseSize;
+			size_t want = left;
+			while (want > 0 && iovs.size() < IOV_MAX) {
+				size_t len = std::min(tmp->size - tpos, want);
+				iovs.push_back({ tmp->ptr + tpos, len });
+				want -= len;
+				tpos = 0;
+				tmp = tmp->next;
+			}
+
+			ssize_t rt = readv(fd, &iovs[0], iovs.size());
+			if (rt < 0) {
+				if (errno == EINTR)
+					continue;
+				WS_LOG_ERROR("readFromFile readv name={} errno={} errstr={}", name, errno, strerror(errno));
+				ok = false;
+				break;
+			}
+			// 文件在读的过程中被截断了
+			if (rt == 0)
+				break;
+			forward(rt);
+			left -= rt;
+		}
+		close(fd);
+		return ok;
 	}
 
 	uint64_t ByteArray::getReadBuffers(std::vector<iovec>& buffers, uint64_t len) const {
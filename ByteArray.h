@@ -1,5 +1,6 @@
 #pragma once
 #include <memory>
+#include <string>
 #include <vector>
 #include <stdint.h>
 #include <sys/socket.h>
@@ -9,11 +10,16 @@ namespace WebServer {
 	public:
 		typedef std::shared_ptr<ByteArray> bytearrayPtr;
 
+		/*
+		* @brief 内存块, 节点头和数据区一次分配, 数据区紧跟在节点头后面
+		*        由AllocNode/FreeNode管理, 不要直接new/delete
+		*/
 		struct Node {
 			/*
-			* @param[in] s ڴֽ
-			*/			
-			Node(size_t s);
+			* @param[in] p 数据区
+			* @param[in] s 内存块字节数
+			*/
+			Node(char* p, size_t s);
 			Node();
 			~Node();
 
@@ -22,10 +28,28 @@ namespace WebServer {
 			size_t size;
 		};
 
+		/*
+		* @brief 内存块池, 每个线程一个, 所有ByteArray共用
+		*        clear和析构时内存块还给当前线程的池, 新的内存块优先从池里取
+		*        每个线程池里缓存的总字节数超过上限时, 多出来的直接还给系统
+		* @param[in] bytes 每个线程的缓存上限, 0表示不缓存
+		*/
+		static void SetPoolHighWater(size_t bytes);
+		static size_t GetPoolHighWater();
+		// 当前线程池里缓存的字节数
+		static size_t GetPooledBytes();
+
 		ByteArray(size_t baseSize = 4096);
 		~ByteArray();
 
-		// ԭʼֱӴ洢
+		/*
+		* @brief 只读映射文件, 整个文件作为一个内存块, 不拷贝到内存块链表里
+		*        读取时按页缺页加载, 适合启动时加载大快照; 写入会抛std::logic_error
+		* @return 打开/映射失败或文件为空时返回nullptr
+		*/
+		static bytearrayPtr MapFile(const std::string& name);
+
+		// 原始数据直接存储
 		void writeFint8(int8_t value);
 		void writeFuint8(uint8_t value);
 		void writeFint16(int16_t value);
@@ -35,21 +59,26 @@ namespace WebServer {
 		void writeFint64(int64_t value);
 		void writeFuint64(uint64_t value);
 
-		// ѹ洢
+		// 编码压缩后存储
 		void writeInt32(int32_t value);
 		void writeUint32(uint32_t value);
 		void writeInt64(int64_t value);
 		void writeUint64(uint64_t value);
+		/*
+		* @brief 批量写varint, 不写个数, 读的一方自己知道个数
+		*        当前内存块剩余空间够时直接编码进内存块, 不经过write
+		*/
+		void writeUint32Array(const uint32_t* values, size_t count);
 
 		void writeFloat(float value);
 		void writeDouble(double value);
 
-		// Թ̶ʹ洢
+		// 以固定的数据类型存储长度数据
 		void writeStringF16(const std::string& value);
 		void writeStringF32(const std::string& value);
 		void writeStringF64(const std::string& value);
 		
-		// ԳҲбѹ
+		// 对长度数据也进行编码压缩
 		void writeStringVint(const std::string& value);
 		
 		void writeStringWithoutLength(const std::string& value);
@@ -68,6 +97,9 @@ namespace WebServer {
 		int64_t  readInt64();
 		uint64_t readUint64();
 
+		// 批量读count个varint, 每次取8字节, 连续的单字节值一次处理
+		void readUint32Array(uint32_t* values, size_t count);
+
 		float    readFloat();
 		double   readDouble();
 
@@ -80,7 +112,13 @@ namespace WebServer {
 		void write(const void* buf, size_t size);
 		void read(void* buf, size_t size);
 		void read(void* buf, size_t size, size_t position) const;
+		/*
+		* @brief 把当前位置开始的可读数据写入文件(覆盖), 每次writev最多IOV_MAX个内存块, position不变
+		*/
 		bool writeToFile(const std::string& name) const;
+		/*
+		* @brief 把整个文件读到当前位置, 每次readv直接读进内存块, position和size后移
+		*/
 		bool readFromFile(const std::string& name);
 
 		size_t getPosition() const { return m_Position; }
@@ -96,25 +134,36 @@ namespace WebServer {
 		uint64_t getReadBuffers(std::vector<iovec>& buffers, uint64_t len, uint64_t position) const;
 		uint64_t getWriteBuffers(std::vector<iovec>& buffers, uint64_t len);
 		size_t getSize() const { return m_Size; }
+		bool isReadOnly() const { return m_MapSize != 0; }
 
 	private:
+		// 只读映射用
+		ByteArray(char* data, size_t size);
+		static Node* AllocNode(size_t size);
+		static void FreeNode(Node* node);
 		void addCapacity(size_t size);
+		// 数据已经直接写进了内存块(readv等), 只移动position/m_Cur, 更新size
+		void forward(size_t size);
+		// npos: m_Position在当前内存块里的偏移, 调用方已经算过时省掉一次取模
+		void forward(size_t size, size_t npos);
 		size_t getCapacity() const { return m_Capacity; }
 
 	private:
-		// ڴС
+		// 内存块大小
 		size_t m_BaseSize;
-		// ǰλ,ָݵһλ
+		// 当前操作位置,指向数据的下一个位置
 		size_t m_Position;
-		// ǰ
+		// 当前的总容量
 		size_t m_Capacity;
-		// ǰݵĴС
+		// 当前数据的大小
 		size_t m_Size;
-		// ֽ,Ĭϴ
+		// 字节序,默认大端
 		int8_t m_Endian;
-		// һڴָ
+		// 第一个内存块的指针
 		Node* m_Root;
-		// ǰڴָ
+		// 当前操作的内存块指针
 		Node* m_Cur;
+		// 只读映射的长度, 0表示普通的ByteArray
+		size_t m_MapSize = 0;
 	};
 }
\ No newline at end of file
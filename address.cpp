@@ -1,5 +1,6 @@
 #include "address.h"
 #include "endian.h"
+#include "log.h"
 #include <sstream>
 #include <netdb.h>
 #include <ifaddrs.h>
@@ -11,7 +12,7 @@ namespace WebServer {
 		return (1 << (sizeof(T) * 8 - bits)) - 1;
 	}
 
-	// 1ĸ
+	// 计算二进制数中1的个数
 	template<typename T>
 	static uint32_t CountBytes(T value) {
 		uint32_t result = 0;
@@ -21,14 +22,14 @@ namespace WebServer {
 	}
 
 	/*
-		ai_flags           Ƶַҵı־
-		ai_family          ַ壬 AF_INETIPv4 AF_INET6IPv6
-		ai_socktype        ׽ͣ SOCK_STREAMʽ׽֣ SOCK_DGRAMݱ׽֣
-		ai_protocol        Э飬һΪ 0 ʾЭ
-		ai_addrlen         ַ
-		ai_canonname       Ĺ淶֣У
-		sockaddr* ai_addr  ָ socket ַָ
-		ai_next;           ָһ addrinfo ṹָ
+		ai_flags           控制地址查找的标志
+		ai_family          地址族，如 AF_INET（IPv4）或 AF_INET6（IPv6）
+		ai_socktype        套接字类型，如 SOCK_STREAM（流式套接字）或 SOCK_DGRAM（数据报套接字）
+		ai_protocol        协议，一般为 0 表示任意协议
+		ai_addrlen         地址长度
+		ai_canonname       主机的规范名字（如果有）
+		sockaddr* ai_addr  指向 socket 地址的指针
+		ai_next;           指向链表中下一个 addrinfo 结构的指针
 	*/
 	bool Address::Lookup(std::vector<Address::addressPtr>& result, const std::string& host, int family, int type, int protocol) {
 		addrinfo hints, *results, *next;
@@ -71,8 +72,7 @@ namespace WebServer {
 
 		int error = getaddrinfo(node.c_str(), service, &hints, &results);
 		if (error) {
-			std::cout << "Address::Lookup getaddress(" << host << "," << family << "," << type << ") error="
-				<< error << " errstr=" << gai_strerror(error) << std::endl;
+			WS_LOG_ERROR("Address::Lookup getaddress({}, {}, {}) error={} errstr={}", host, family, type, error, gai_strerror(error));
 			return false;
 		}
 
@@ -107,17 +107,17 @@ namespace WebServer {
 	}
 
 	/*
-		ifa_next     ָһԪصָ
-		ifa_name     ӿ
-		ifa_addr     ӿڵַ
-		ifa_netmask  
-		ifa_dstaddr  Ŀַ
-		ifa_data     ָӿ˽ݵָ
+		ifa_next     指向链表中下一个元素的指针
+		ifa_name     接口名
+		ifa_addr     接口地址
+		ifa_netmask  掩码
+		ifa_dstaddr  目标地址
+		ifa_data     指向接口私有数据的指针
 	*/
 	bool Address::GetInterfaceAddress(std::multimap<std::string, std::pair<Address::addressPtr, uint32_t>>& result, int family) {
 		struct ifaddrs* next, *results;
 		if (getifaddrs(&results) != 0) {
-			std::cout << "Address::GetInterfaceAddresses getifaddrs" << " error=" << errno << " errstr=" << strerror(errno);
+			WS_LOG_ERROR("Address::GetInterfaceAddresses getifaddrs error={} errstr={}", errno, strerror(errno));
 			return false;
 		}
 
@@ -153,7 +153,7 @@ namespace WebServer {
 			}
 		}
 		catch(...) {
-			printf("[Error] Address:GetInterfaceAddresses exception");
+			WS_LOG_ERROR("Address::GetInterfaceAddresses exception");
 			freeifaddrs(results);
 			return false;
 		}
@@ -241,9 +241,7 @@ namespace WebServer {
 
 		int error = getaddrinfo(address, nullptr, &hints, &results);
 		if (error) {
-			std::cout << "IPAddress::Create(" << address
-				<< ", " << port << ") error=" << error
-				<< " errno=" << errno << " errstr=" << strerror(errno);
+			WS_LOG_ERROR("IPAddress::Create({}, {}) error={} errno={} errstr={}", address, port, error, errno, strerror(errno));
 			return nullptr;
 		}
 
@@ -266,9 +264,7 @@ namespace WebServer {
 		ipv4Addr->m_Addr.sin_port = byteswapOnLittleEndian(port);
 		int result = inet_pton(AF_INET, address, &ipv4Addr->m_Addr.sin_addr);
 		if (result <= 0) {
-			std::cout << "IPv4Address::Create(" << address << ", "
-				<< port << ") rt=" << result << " errno=" << errno
-				<< " errstr=" << strerror(errno);
+			WS_LOG_ERROR("IPv4Address::Create({}, {}) rt={} errno={} errstr={}", address, port, result, errno, strerror(errno));
 			return nullptr;
 		}
 		return ipv4Addr;
@@ -281,9 +277,9 @@ namespace WebServer {
 	IPv4Address::IPv4Address(uint32_t address, uint16_t port) {
 		memset(&m_Addr, 0, sizeof(m_Addr));
 		m_Addr.sin_family = AF_INET;
-		// Э涨˴˴洢,ʹô
-		// byteswapOnLittleEndian˼ڵڵĻС˴洢
-		// WS_BYTE_ORDERҪǴ,ͻbyteswap,ҪС˾Ͳ
+		// 网络协议规定了大端存储,因此使用大端
+		// 这里byteswapOnLittleEndian的意思是我现在的数据所在的机子是小端存储
+		// 如果WS_BYTE_ORDER要求是大端,就会byteswap,如果要求的是小端就不会
 		m_Addr.sin_port = byteswapOnLittleEndian(port);
 		m_Addr.sin_addr.s_addr = byteswapOnLittleEndian(address);
 	}
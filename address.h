@@ -21,11 +21,11 @@ namespace WebServer {
 		static Address::addressPtr Create(const sockaddr* addr, socklen_t addrlen);
 		
 		/*
-		* @param[out] result    Address
-		* @param[in]  host      ,
-		* @param[in]  family    Э(AF_INET, AF_INET6, AF_UNIX)
-		* @param[in]  type      socket(SOCK_STREAM, SOCK_DGRAM)
-		* @param[in]  protocol  Э(IPPROTP_TCP, IPPROTO_UDP)
+		* @param[out] result    保存符合条件的Address
+		* @param[in]  host      域名,服务器名等
+		* @param[in]  family    协议族(AF_INET, AF_INET6, AF_UNIX)
+		* @param[in]  type      socket类型(SOCK_STREAM, SOCK_DGRAM等)
+		* @param[in]  protocol  协议(IPPROTP_TCP, IPPROTO_UDP等)
 		*/
 		static bool Lookup(std::vector<Address::addressPtr>& result, const std::string& host,
 			int family = AF_INET, int type = 0, int protocol = 0);
@@ -44,8 +44,8 @@ namespace WebServer {
 		
 		int getFamily() const;
 		
-		virtual const sockaddr* getAddr() const = 0;  // ֻ
-		virtual sockaddr* getAddr() = 0;              // д
+		virtual const sockaddr* getAddr() const = 0;  // 只读
+		virtual sockaddr* getAddr() = 0;              // 读写
 		virtual socklen_t getAddrLen() const = 0;
 		virtual std::ostream& insert(std::ostream& os) const = 0;
 
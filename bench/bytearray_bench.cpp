@@ -0,0 +1,72 @@
+/*
+* ByteArray内存块池测试: 编码100万个典型的游戏包, 每个包用一个新的ByteArray
+* 包头定长, 字段是varint/float/名字, 每16个包带一个跨多个内存块的大负载(地图块/背包同步)
+* 分别在开启内存块池和关闭(SetPoolHighWater(0))时跑一遍, 单位 包/秒
+*
+* 编译:
+*   g++ -std=c++17 -O2 bench/bytearray_bench.cpp ByteArray.cpp log.cpp thread.cpp mutex.cpp utils.cpp -o bytearray_bench -lpthread
+* 运行: ./bytearray_bench [包数] [块大小] > /dev/null
+*/
+#include "../ByteArray.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+using namespace WebServer;
+
+static uint64_t NowUS() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void EncodePacket(ByteArray& ba, int i, const std::string& name, const std::string& payload) {
+	// 包头: 魔数 版本 命令字 序号
+	ba.writeFuint16(0x5753);
+	ba.writeFuint8(1);
+	ba.writeFuint16(i % 300);
+	ba.writeFuint32(i);
+	// 玩家状态
+	ba.writeUint64(10000000 + i);
+	ba.writeInt32(i % 1000 - 500);
+	ba.writeFloat(i * 0.5f);
+	ba.writeFloat(i * 0.25f);
+	ba.writeFloat(i * 0.125f);
+	ba.writeUint32(i % 100);
+	ba.writeStringVint(name);
+	if (i % 16 == 0)
+		ba.writeStringVint(payload);
+}
+
+static double Bench(int packets, size_t baseSize) {
+	std::string name = "player_name_";
+	std::string payload(baseSize * 3 + 100, 'x');
+	uint64_t bytes = 0;
+	uint64_t start = NowUS();
+	for (int i = 0; i < packets; i++) {
+		ByteArray ba(baseSize);
+		EncodePacket(ba, i, name, payload);
+		bytes += ba.getSize();
+	}
+	double cost = (NowUS() - start) / 1e6;
+	fprintf(stderr, "  %.1f MB encoded, pooled %zu bytes\n", bytes / 1e6, ByteArray::GetPooledBytes());
+	return packets / cost;
+}
+
+int main(int argc, char** argv) {
+	int packets = argc > 1 ? atoi(argv[1]) : 1000000;
+	size_t baseSize = argc > 2 ? atoi(argv[2]) : 4096;
+	fprintf(stderr, "packets=%d block=%zu\n", packets, baseSize);
+
+	ByteArray::SetPoolHighWater(0);
+	fprintf(stderr, "without pool:\n");
+	double off = Bench(packets, baseSize);
+	fprintf(stderr, "  %.0f packets/s\n", off);
+
+	ByteArray::SetPoolHighWater(4 * 1024 * 1024);
+	fprintf(stderr, "with pool:\n");
+	double on = Bench(packets, baseSize);
+	fprintf(stderr, "  %.0f packets/s\n", on);
+	return 0;
+}
@@ -0,0 +1,135 @@
+/*
+* 协程间传递消息测试: 三级流水线 解码 -> 房间逻辑 -> 广播, 每条消息依次经过三个阶段
+* 对比 每个阶段之间用schedule投递一个std::function(共享状态+回调) / 每个阶段一个协程, 之间用Channel<Message>连接
+* 统计 消息/秒
+*
+* 编译:
+*   g++ -std=c++17 -O2 bench/channel_bench.cpp channel.cpp fibersync.cpp context.cpp fiber.cpp stackallocator.cpp scheduler.cpp iomanager.cpp uring.cpp timer.cpp hook.cpp fdmanager.cpp thread.cpp mutex.cpp utils.cpp log.cpp -o channel_bench -ldl -lpthread
+* 运行: ./channel_bench [消息数] [通道容量] > /dev/null
+*/
+#include "../channel.h"
+#include "../iomanager.h"
+#include "../utils.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace WebServer;
+
+struct Message {
+	uint64_t id = 0;
+	uint32_t room = 0;
+	uint32_t payload = 0;
+};
+
+static size_t s_Count = 1000000;
+static size_t s_Capacity = 1024;
+
+// 三个阶段的处理, 只做一点计算, 测的是阶段之间传递的开销
+static void Decode(Message& msg) {
+	msg.room = msg.id % 64;
+	msg.payload = (uint32_t)(msg.id * 2654435761u);
+}
+
+static void Logic(Message& msg) {
+	msg.payload ^= msg.room;
+}
+
+static std::atomic<uint64_t> s_Checksum{ 0 };
+static std::atomic<size_t> s_Broadcast{ 0 };
+
+static void Broadcast(const Message& msg) {
+	s_Checksum += msg.payload;
+	++s_Broadcast;
+}
+
+// 每条消息每个阶段schedule一次, 闭包带着消息
+static double BenchSchedule() {
+	s_Checksum = 0;
+	s_Broadcast = 0;
+	uint64_t start = GetMonotonicUS();
+	{
+		IOManager iom(2, false, "schedule");
+		iom.schedule([&]() {
+			for (size_t i = 0; i < s_Count; i++) {
+				Message msg;
+				msg.id = i;
+				iom.schedule([&iom, msg]() mutable {
+					Decode(msg);
+					iom.schedule([&iom, msg]() mutable {
+						Logic(msg);
+						iom.schedule([msg]() {
+							Broadcast(msg);
+						});
+					});
+				});
+				// 和通道一样限制在途消息数
+				while (i + 1 > s_Broadcast + s_Capacity)
+					Fiber::YieldToReady();
+			}
+		});
+		while (s_Broadcast < s_Count)
+			usleep(1000);
+	}
+	return s_Count / ((GetMonotonicUS() - start) / 1e6);
+}
+
+// 每个阶段一个协程, 阶段之间用通道连接
+static double BenchChannel() {
+	s_Checksum = 0;
+	s_Broadcast = 0;
+	uint64_t start = GetMonotonicUS();
+	{
+		IOManager iom(2, false, "channel");
+		Channel<Message> decoded(s_Capacity);
+		Channel<Message> handled(s_Capacity);
+		Channel<Message> raw(s_Capacity);
+		iom.schedule([&]() {
+			for (size_t i = 0; i < s_Count; i++) {
+				Message msg;
+				msg.id = i;
+				raw.push(msg);
+			}
+			raw.close();
+		});
+		iom.schedule([&]() {
+			Message msg;
+			while (raw.pop(msg)) {
+				Decode(msg);
+				decoded.push(msg);
+			}
+			decoded.close();
+		});
+		iom.schedule([&]() {
+			Message msg;
+			while (decoded.pop(msg)) {
+				Logic(msg);
+				handled.push(msg);
+			}
+			handled.close();
+		});
+		iom.schedule([&]() {
+			Message msg;
+			while (handled.pop(msg))
+				Broadcast(msg);
+		});
+		while (s_Broadcast < s_Count)
+			usleep(1000);
+	}
+	return s_Count / ((GetMonotonicUS() - start) / 1e6);
+}
+
+int main(int argc, char** argv) {
+	s_Count = argc > 1 ? atoi(argv[1]) : 1000000;
+	s_Capacity = argc > 2 ? atoi(argv[2]) : 1024;
+	fprintf(stderr, "messages=%zu capacity=%zu\n", s_Count, s_Capacity);
+
+	double schedule = BenchSchedule();
+	uint64_t checksum = s_Checksum;
+	double channel = BenchChannel();
+	fprintf(stderr, "schedule(std::function) %10.0f msgs/s\n", schedule);
+	fprintf(stderr, "Channel<Message>        %10.0f msgs/s  checksum %s\n", channel, checksum == s_Checksum ? "ok" : "MISMATCH");
+	return 0;
+}
@@ -0,0 +1,94 @@
+/*
+* 上下文切换耗时测试: 手写汇编后端 vs ucontext, 单位 ns/次切换
+*
+* 编译:
+*   g++ -std=c++17 -O2 bench/context_bench.cpp context.cpp fiber.cpp stackallocator.cpp scheduler.cpp iomanager.cpp uring.cpp timer.cpp hook.cpp fdmanager.cpp thread.cpp mutex.cpp utils.cpp log.cpp -o context_bench -ldl -lpthread
+* 加 -DWS_FIBER_UCONTEXT 时Fiber本身退回ucontext后端
+*
+* 结果输出到stderr, 日志输出到stdout, 运行时可以 ./context_bench > /dev/null
+*/
+#include "../context.h"
+#include "../fiber.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace WebServer;
+
+static const size_t kStackSize = 64 * 1024;
+static size_t s_Count = 0;
+
+static ucontext_t s_UMain;
+static ucontext_t s_UFunc;
+
+static void UcontextFunc() {
+	while (true)
+		swapcontext(&s_UFunc, &s_UMain);
+}
+
+static double BenchUcontext() {
+	void* stack = malloc(kStackSize);
+	getcontext(&s_UFunc);
+	s_UFunc.uc_link = nullptr;
+	s_UFunc.uc_stack.ss_sp = stack;
+	s_UFunc.uc_stack.ss_size = kStackSize;
+	makecontext(&s_UFunc, &UcontextFunc, 0);
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < s_Count; i++)
+		swapcontext(&s_UMain, &s_UFunc);
+	std::chrono::duration<double, std::nano> cost = std::chrono::steady_clock::now() - start;
+	free(stack);
+	// 每轮两次切换
+	return cost.count() / (s_Count * 2);
+}
+
+#if defined(__x86_64__) || defined(__aarch64__)
+static void* s_AMain = nullptr;
+static void* s_AFunc = nullptr;
+
+static void AsmFunc() {
+	while (true)
+		ws_swap_context(&s_AFunc, s_AMain);
+}
+
+static double BenchAsm() {
+	void* stack = malloc(kStackSize);
+	s_AFunc = ws_make_context(stack, kStackSize, &AsmFunc);
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < s_Count; i++)
+		ws_swap_context(&s_AMain, s_AFunc);
+	std::chrono::duration<double, std::nano> cost = std::chrono::steady_clock::now() - start;
+	free(stack);
+	return cost.count() / (s_Count * 2);
+}
+#endif
+
+static double BenchFiber() {
+	Fiber::getThis();
+	Fiber::fiberPtr fiber(new Fiber([]() {
+		for (size_t i = 0; i < s_Count; i++)
+			Fiber::getThis()->back();
+	}, kStackSize, true));
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < s_Count; i++)
+		fiber->call();
+	std::chrono::duration<double, std::nano> cost = std::chrono::steady_clock::now() - start;
+	// 再切一次让协程函数返回, 状态变为TERM
+	fiber->call();
+	return cost.count() / (s_Count * 2);
+}
+
+int main(int argc, char** argv) {
+	s_Count = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	fprintf(stderr, "ucontext:        %.1f ns/switch\n", BenchUcontext());
+#if defined(__x86_64__) || defined(__aarch64__)
+	fprintf(stderr, "asm:             %.1f ns/switch\n", BenchAsm());
+#endif
+	fprintf(stderr, "Fiber (%s): %.1f ns/switch\n", ContextBackendName(), BenchFiber());
+	return 0;
+}
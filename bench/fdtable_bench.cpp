@@ -0,0 +1,129 @@
+/*
+* fd上下文表竞争测试: 16个线程在随机fd上注册/注销事件
+* 1. 只测表本身: 原来的RWMutex + vector(越界时1.5倍扩容) vs 分段无锁的FdTable, fd范围随时间增长, 会不断触发扩容
+* 2. 端到端: 16个线程对各自的一组eventfd反复addEvent/delEvent, 单位 次/秒
+*
+* 编译:
+*   g++ -std=c++17 -O2 bench/fdtable_bench.cpp context.cpp fiber.cpp stackallocator.cpp scheduler.cpp iomanager.cpp uring.cpp timer.cpp hook.cpp fdmanager.cpp thread.cpp mutex.cpp utils.cpp log.cpp -o fdtable_bench -ldl -lpthread
+* 运行: ./fdtable_bench [线程数] > /dev/null
+*/
+#include "../fdtable.h"
+#include "../iomanager.h"
+#include "../mutex.h"
+#include "../utils.h"
+
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace WebServer;
+
+static const int kTableOps = 2000000;
+static const int kMaxFd = 65536;
+static const int kEventFds = 1024;
+static const int kEventOps = 200000;
+
+struct alignas(64) FdRecord {
+	FdRecord(int fd_) : fd(fd_) {}
+	int fd;
+	uint64_t events = 0;
+};
+
+// 原来IOManager的做法
+class LockedTable {
+public:
+	~LockedTable() {
+		for (auto i : m_Contexts)
+			delete i;
+	}
+
+	FdRecord* getOrCreate(int fd) {
+		RWMutex::ReadLock lock(m_Mtx);
+		if ((int)m_Contexts.size() > fd)
+			return m_Contexts[fd];
+		lock.unlock();
+
+		RWMutex::WriteLock lock2(m_Mtx);
+		if ((int)m_Contexts.size() <= fd) {
+			size_t old = m_Contexts.size();
+			m_Contexts.resize(fd * 1.5f + 1);
+			for (size_t i = old; i < m_Contexts.size(); i++)
+				m_Contexts[i] = new FdRecord(i);
+		}
+		return m_Contexts[fd];
+	}
+
+private:
+	RWMutex m_Mtx;
+	std::vector<FdRecord*> m_Contexts;
+};
+
+// 每个线程的fd范围从64线性增长到kMaxFd
+template<typename Table>
+static double BenchTable(int threads) {
+	Table table;
+	std::vector<std::thread> workers;
+	uint64_t start = GetMonotonicUS();
+	for (int t = 0; t < threads; t++) {
+		workers.emplace_back([&table, t]() {
+			std::mt19937 rng(t);
+			for (int i = 0; i < kTableOps; i++) {
+				int limit = 64 + (int)((uint64_t)(kMaxFd - 64) * i / kTableOps);
+				FdRecord* ctx = table.getOrCreate(rng() % limit);
+				__atomic_fetch_add(&ctx->events, 1, __ATOMIC_RELAXED);
+			}
+		});
+	}
+	for (auto& i : workers)
+		i.join();
+	double cost = (GetMonotonicUS() - start) / 1e6;
+	return (double)threads * kTableOps / cost;
+}
+
+static void BenchIOManager(int threads) {
+	std::vector<int> fds;
+	for (int i = 0; i < kEventFds; i++) {
+		int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd < 0) {
+			fprintf(stderr, "eventfd failed\n");
+			exit(1);
+		}
+		fds.push_back(fd);
+	}
+
+	IOManager iom(1, false, "bench");
+	std::vector<std::thread> workers;
+	uint64_t start = GetMonotonicUS();
+	for (int t = 0; t < threads; t++) {
+		// 每个线程只用下标模threads等于t的fd, 同一个fd上不会重复注册
+		workers.emplace_back([&, t]() {
+			std::mt19937 rng(t);
+			int count = kEventFds / threads;
+			for (int i = 0; i < kEventOps; i++) {
+				int fd = fds[(rng() % count) * threads + t];
+				iom.addEvent(fd, IOManager::READ, []() {});
+				iom.delEvent(fd, IOManager::READ);
+			}
+		});
+	}
+	for (auto& i : workers)
+		i.join();
+	double cost = (GetMonotonicUS() - start) / 1e6;
+	fprintf(stderr, "IOManager addEvent+delEvent: %.0f pairs/s\n", (double)threads * kEventOps / cost);
+
+	for (auto i : fds)
+		close(i);
+}
+
+int main(int argc, char** argv) {
+	int threads = argc > 1 ? atoi(argv[1]) : 16;
+	fprintf(stderr, "threads=%d\n", threads);
+	fprintf(stderr, "RWMutex + vector: %.0f lookups/s\n", BenchTable<LockedTable>(threads));
+	fprintf(stderr, "segmented FdTable: %.0f lookups/s\n", BenchTable<FdTable<FdRecord>>(threads));
+	BenchIOManager(threads);
+	return 0;
+}
@@ -0,0 +1,57 @@
+/*
+* 协程栈分配 / 协程创建销毁吞吐量测试
+*
+* 编译(默认使用PooledStackAllocator):
+*   g++ -std=c++17 -O2 bench/fiber_bench.cpp context.cpp fiber.cpp stackallocator.cpp scheduler.cpp iomanager.cpp uring.cpp timer.cpp hook.cpp fdmanager.cpp thread.cpp mutex.cpp utils.cpp log.cpp -o fiber_bench -ldl -lpthread
+* 对比malloc路径时额外加 -DWS_FIBER_MALLOC_STACK 重新编译
+*
+* 结果输出到stderr, 日志输出到stdout, 运行时可以 ./fiber_bench > /dev/null
+*/
+#include "../fiber.h"
+#include "../stackallocator.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+using namespace WebServer;
+
+static const size_t kStackSize = 128 * 1024;
+
+template<typename Allocator>
+static double BenchAllocator(size_t count) {
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < count; i++) {
+		void* stack = Allocator::Alloc(kStackSize);
+		// 模拟协程入口处对栈顶的写入
+		((volatile char*)stack)[kStackSize - 1] = 1;
+		Allocator::Dealloc(stack, kStackSize);
+	}
+	std::chrono::duration<double> cost = std::chrono::steady_clock::now() - start;
+	return count / cost.count();
+}
+
+static double BenchFiber(size_t count) {
+	Fiber::getThis();
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < count; i++) {
+		Fiber::fiberPtr fiber(new Fiber([]() {}, kStackSize, true));
+		fiber->call();
+	}
+	std::chrono::duration<double> cost = std::chrono::steady_clock::now() - start;
+	return count / cost.count();
+}
+
+int main(int argc, char** argv) {
+	size_t count = argc > 1 ? atoi(argv[1]) : 200000;
+
+	fprintf(stderr, "malloc allocator:  %.0f stacks/s\n", BenchAllocator<MallocStackAllocator>(count));
+	fprintf(stderr, "pooled allocator:  %.0f stacks/s\n", BenchAllocator<PooledStackAllocator>(count));
+#ifdef WS_FIBER_MALLOC_STACK
+	const char* name = "malloc";
+#else
+	const char* name = "pooled";
+#endif
+	fprintf(stderr, "fiber create/destroy (%s): %.0f fibers/s\n", name, BenchFiber(count));
+	return 0;
+}
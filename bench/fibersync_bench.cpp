@@ -0,0 +1,176 @@
+/*
+* 协程同步原语测试: FiberMutex/FiberSemaphore 对比 pthread的Mutex/Semaphore
+*   1. 不竞争时一次加锁+解锁的耗时
+*   2. 两个执行体用一对信号量来回交接的耗时(协程挂起/唤醒 对比 线程睡眠/唤醒)
+*   3. 多个执行体抢同一把锁, 持锁期间让出一次(模拟持锁做了一次hook的I/O), 每次交接的耗时
+*
+* 编译:
+*   g++ -std=c++17 -O2 bench/fibersync_bench.cpp fibersync.cpp context.cpp fiber.cpp stackallocator.cpp scheduler.cpp iomanager.cpp uring.cpp timer.cpp hook.cpp fdmanager.cpp thread.cpp mutex.cpp utils.cpp log.cpp -o fibersync_bench -ldl -lpthread
+* 运行: ./fibersync_bench [交接次数] [抢锁的执行体数] > /dev/null
+*/
+#include "../fibersync.h"
+#include "../iomanager.h"
+#include "../utils.h"
+
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace WebServer;
+
+static size_t s_Rounds = 200000;
+static size_t s_Workers = 8;
+
+// 在IOManager的协程里执行func, 等它返回
+template<typename Func>
+static void RunInFiber(size_t threads, Func func) {
+	std::atomic<bool> done{ false };
+	{
+		IOManager iom(threads, false, "sync");
+		iom.schedule([&]() {
+			func(iom);
+			done = true;
+		});
+		while (!done)
+			usleep(1000);
+	}
+}
+
+static void BenchUncontended() {
+	const size_t count = 10000000;
+	double pthreadNs = 0;
+	double fiberNs = 0;
+	// 都在工作线程里测, 主线程在创建线程之前glibc的锁不用原子指令, 不可比
+	RunInFiber(1, [&](IOManager&) {
+		Mutex mutex;
+		uint64_t start = GetMonotonicUS();
+		for (size_t i = 0; i < count; i++) {
+			mutex.lock();
+			mutex.unlock();
+		}
+		pthreadNs = (GetMonotonicUS() - start) * 1000.0 / count;
+
+		FiberMutex fmutex;
+		start = GetMonotonicUS();
+		for (size_t i = 0; i < count; i++) {
+			fmutex.lock();
+			fmutex.unlock();
+		}
+		fiberNs = (GetMonotonicUS() - start) * 1000.0 / count;
+	});
+	fprintf(stderr, "uncontended lock+unlock   Mutex %6.1f ns   FiberMutex %6.1f ns\n", pthreadNs, fiberNs);
+}
+
+static void BenchPingPong() {
+	// 线程: 两个线程用sem_t来回交接
+	Semaphore ping, pong;
+	Semaphore* sems[] = { &ping, &pong };
+	uint64_t start = GetMonotonicUS();
+	pthread_t thread;
+	pthread_create(&thread, nullptr, [](void* arg) -> void* {
+		Semaphore** sems = (Semaphore**)arg;
+		for (size_t i = 0; i < s_Rounds; i++) {
+			sems[0]->wait();
+			sems[1]->notify();
+		}
+		return nullptr;
+	}, sems);
+	for (size_t i = 0; i < s_Rounds; i++) {
+		ping.notify();
+		pong.wait();
+	}
+	pthread_join(thread, nullptr);
+	double pthreadNs = (GetMonotonicUS() - start) * 1000.0 / (s_Rounds * 2);
+
+	// 协程: 同一个IOManager上的两个协程用FiberSemaphore来回交接
+	double fiberNs = 0;
+	RunInFiber(2, [&](IOManager& iom) {
+		FiberSemaphore fping, fpong;
+		std::atomic<bool> done{ false };
+		uint64_t start = GetMonotonicUS();
+		iom.schedule([&]() {
+			for (size_t i = 0; i < s_Rounds; i++) {
+				fping.wait();
+				fpong.notify();
+			}
+			done = true;
+		});
+		for (size_t i = 0; i < s_Rounds; i++) {
+			fping.notify();
+			fpong.wait();
+		}
+		fiberNs = (GetMonotonicUS() - start) * 1000.0 / (s_Rounds * 2);
+		while (!done)
+			Fiber::YieldToReady();
+	});
+	fprintf(stderr, "ping-pong handoff         Semaphore %6.0f ns   FiberSemaphore %6.0f ns\n", pthreadNs, fiberNs);
+}
+
+static void BenchContended() {
+	size_t perWorker = s_Rounds / s_Workers;
+	uint64_t counter = 0;
+
+	// 线程: 持锁期间sched_yield, 其他线程只能睡在锁上
+	Mutex mutex;
+	std::vector<pthread_t> threads(s_Workers);
+	struct Args {
+		Mutex* mutex;
+		uint64_t* counter;
+		size_t count;
+	} args = { &mutex, &counter, perWorker };
+	uint64_t start = GetMonotonicUS();
+	for (auto& i : threads) {
+		pthread_create(&i, nullptr, [](void* arg) -> void* {
+			Args* args = (Args*)arg;
+			for (size_t i = 0; i < args->count; i++) {
+				args->mutex->lock();
+				++*args->counter;
+				sched_yield();
+				args->mutex->unlock();
+			}
+			return nullptr;
+		}, &args);
+	}
+	for (auto& i : threads)
+		pthread_join(i, nullptr);
+	double pthreadNs = (GetMonotonicUS() - start) * 1000.0 / counter;
+
+	// 协程: 持锁期间YieldToReady, 等锁的协程挂起, 线程去执行持锁的协程
+	uint64_t fcounter = 0;
+	double fiberNs = 0;
+	RunInFiber(2, [&](IOManager& iom) {
+		FiberMutex fmutex;
+		std::atomic<size_t> done{ 0 };
+		uint64_t start = GetMonotonicUS();
+		for (size_t w = 0; w < s_Workers; w++) {
+			iom.schedule([&]() {
+				for (size_t i = 0; i < perWorker; i++) {
+					FiberMutex::Lock lock(fmutex);
+					++fcounter;
+					Fiber::YieldToReady();
+				}
+				++done;
+			});
+		}
+		while (done < s_Workers)
+			Fiber::YieldToReady();
+		fiberNs = (GetMonotonicUS() - start) * 1000.0 / fcounter;
+	});
+	fprintf(stderr, "contended x%-2zu (yield held) Mutex %6.0f ns/op   FiberMutex %6.0f ns/op  counters=%llu/%llu\n",
+		s_Workers, pthreadNs, fiberNs, (unsigned long long)counter, (unsigned long long)fcounter);
+}
+
+int main(int argc, char** argv) {
+	s_Rounds = argc > 1 ? atoi(argv[1]) : 200000;
+	s_Workers = argc > 2 ? atoi(argv[2]) : 8;
+	fprintf(stderr, "rounds=%zu workers=%zu\n", s_Rounds, s_Workers);
+
+	BenchUncontended();
+	BenchPingPong();
+	BenchContended();
+	return 0;
+}
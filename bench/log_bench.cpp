@@ -0,0 +1,71 @@
+/*
+* 日志开销测试: 多个线程同时写日志, 每个线程每轮连续写一批, 批之间睡1ms让后台线程写出去
+* 对比 printf(stdout加锁, 调用线程里格式化) / WS_LOG_INFO(写本线程的环形缓冲区) / WS_LOG_DEBUG(编译期去掉)
+* 统计 每次调用的耗时, 以及环形缓冲区满丢弃的条数
+*
+* 编译:
+*   g++ -std=c++17 -O2 bench/log_bench.cpp log.cpp thread.cpp mutex.cpp utils.cpp -o log_bench -lpthread
+* 运行: ./log_bench [线程数] [轮数] [每轮条数] > /dev/null
+*/
+#include "../log.h"
+#include "../thread.h"
+#include "../utils.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace WebServer;
+
+static size_t s_Threads = 4;
+static size_t s_Rounds = 1000;
+static size_t s_Burst = 256;
+
+// 每个线程执行s_Rounds轮, 每轮调用s_Burst次func, 只统计调用本身的时间
+template<typename Func>
+static double Run(Func func) {
+	std::atomic<uint64_t> totalUs{ 0 };
+	std::vector<Thread::threadPtr> threads;
+	for (size_t t = 0; t < s_Threads; t++) {
+		threads.emplace_back(new Thread([&, t]() {
+			uint64_t us = 0;
+			for (size_t r = 0; r < s_Rounds; r++) {
+				uint64_t start = GetMonotonicUS();
+				for (size_t i = 0; i < s_Burst; i++)
+					func(t, r * s_Burst + i);
+				us += GetMonotonicUS() - start;
+				usleep(1000);
+			}
+			totalUs += us;
+		}, "bench_" + std::to_string(t)));
+	}
+	for (auto& i : threads)
+		i->join();
+	return totalUs * 1000.0 / (s_Threads * s_Rounds * s_Burst);
+}
+
+int main(int argc, char** argv) {
+	s_Threads = argc > 1 ? atoi(argv[1]) : 4;
+	s_Rounds = argc > 2 ? atoi(argv[2]) : 1000;
+	s_Burst = argc > 3 ? atoi(argv[3]) : 256;
+	fprintf(stderr, "threads=%zu rounds=%zu burst=%zu\n", s_Threads, s_Rounds, s_Burst);
+
+	double printfNs = Run([](size_t t, size_t i) {
+		printf("Fiber::Fiber id=%zu thread=%zu state=%s\n", i, t, "INIT");
+	});
+	fflush(stdout);
+	double infoNs = Run([](size_t t, size_t i) {
+		WS_LOG_INFO("Fiber::Fiber id={} thread={} state={}", i, t, "INIT");
+	});
+	double debugNs = Run([](size_t t, size_t i) {
+		WS_LOG_DEBUG("Fiber::Fiber id={} thread={} state={}", i, t, "INIT");
+	});
+	Logger::Flush();
+
+	fprintf(stderr, "printf                 %7.1f ns/call\n", printfNs);
+	fprintf(stderr, "WS_LOG_INFO            %7.1f ns/call  dropped %llu\n", infoNs, (unsigned long long)Logger::GetDroppedCount());
+	fprintf(stderr, "WS_LOG_DEBUG (off)     %7.1f ns/call\n", debugNs);
+	return 0;
+}
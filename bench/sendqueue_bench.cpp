@@ -0,0 +1,150 @@
+/*
+* 发送队列合并测试: 服务端每个连接每一轮(tick)推送若干条小消息, 然后让出协程进入下一轮
+* 对比 每条消息直接Socket::send / 经过SendQueue合并, 统计 消息/秒 和 每条消息的系统调用次数
+*
+* 编译:
+*   g++ -std=c++17 -O2 bench/sendqueue_bench.cpp sendqueue.cpp tcpserver.cpp socket.cpp address.cpp ByteArray.cpp context.cpp fiber.cpp stackallocator.cpp scheduler.cpp iomanager.cpp uring.cpp timer.cpp hook.cpp fdmanager.cpp thread.cpp mutex.cpp utils.cpp log.cpp -o sendqueue_bench -ldl -lpthread
+* 运行: ./sendqueue_bench [连接数] [轮数] [每轮消息数] [消息字节数] > /dev/null
+*/
+#include "../sendqueue.h"
+#include "../tcpserver.h"
+#include "../utils.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace WebServer;
+
+static int s_Ticks = 1000;
+static int s_PerTick = 32;
+static size_t s_MsgSize = 64;
+static bool s_UseQueue = false;
+
+static std::atomic<uint64_t> s_Messages{ 0 };
+static std::atomic<uint64_t> s_Syscalls{ 0 };
+static std::atomic<int> s_Done{ 0 };
+static std::atomic<int> s_Failed{ 0 };
+
+class PushServer : public TcpServer {
+public:
+	PushServer(IOManager* worker)
+		: TcpServer(worker)
+	{
+	}
+
+protected:
+	void handleClient(Socket::socketPtr client) override {
+		std::string msg(s_MsgSize, 'm');
+		if (!s_UseQueue) {
+			for (int i = 0; i < s_Ticks; i++) {
+				for (int j = 0; j < s_PerTick; j++) {
+					// 大消息可能只发出去一部分
+					size_t sent = 0;
+					while (sent < msg.size()) {
+						int rt = client->send(msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+						++s_Syscalls;
+						if (rt <= 0) {
+							++s_Failed;
+							return;
+						}
+						sent += rt;
+					}
+				}
+				s_Messages += s_PerTick;
+				Fiber::YieldToReady();
+			}
+			return;
+		}
+
+		SendQueue::sendQueuePtr queue(new SendQueue(client));
+		for (int i = 0; i < s_Ticks; i++) {
+			for (int j = 0; j < s_PerTick; j++) {
+				if (!queue->send(msg))
+					++s_Failed;
+			}
+			Fiber::YieldToReady();
+		}
+		while (queue->getPendingBytes() && !queue->isError())
+			Fiber::YieldToReady();
+		s_Messages += queue->getMessageCount();
+		s_Syscalls += queue->getSyscallCount();
+	}
+};
+
+static void Client(Address::addressPtr addr) {
+	Socket::socketPtr sock = Socket::CreateTCP(addr);
+	if (!sock->connect(addr)) {
+		++s_Failed;
+		++s_Done;
+		return;
+	}
+	size_t expect = (size_t)s_Ticks * s_PerTick * s_MsgSize;
+	std::vector<char> buf(64 * 1024);
+	size_t got = 0;
+	while (got < expect) {
+		int rt = sock->receive(&buf[0], buf.size());
+		if (rt <= 0) {
+			++s_Failed;
+			break;
+		}
+		got += rt;
+	}
+	sock->close();
+	++s_Done;
+}
+
+static void Bench(int conns, bool useQueue) {
+	s_UseQueue = useQueue;
+	s_Messages = 0;
+	s_Syscalls = 0;
+	s_Done = 0;
+	s_Failed = 0;
+
+	IOManager server(2, false, "server");
+	IOManager client(1, false, "client");
+	std::shared_ptr<PushServer> tcp(new PushServer(&server));
+	// 监听socket要在IOManager的协程里创建, hook才会把它登记为非阻塞
+	std::atomic<int> ready{ 0 };
+	server.schedule([&]() {
+		Address::addressPtr addr = IPv4Address::Create("127.0.0.1", 0);
+		ready = tcp->bind(addr) && tcp->start() ? 1 : -1;
+	});
+	while (!ready)
+		usleep(1000);
+	if (ready < 0) {
+		fprintf(stderr, "bind failed\n");
+		exit(1);
+	}
+
+	Address::addressPtr target = tcp->getSocks()[0]->getLocalAddress();
+	uint64_t start = GetMonotonicUS();
+	for (int i = 0; i < conns; i++)
+		client.schedule(std::bind(&Client, target));
+	while (s_Done < conns)
+		usleep(1000);
+	// 客户端收完时服务端的统计可能还没累加
+	while (s_Messages < (uint64_t)conns * s_Ticks * s_PerTick && !s_Failed)
+		usleep(1000);
+	double cost = (GetMonotonicUS() - start) / 1e6;
+	tcp->stop();
+
+	uint64_t messages = s_Messages;
+	fprintf(stderr, "%-12s %10.0f msgs/s  %.3f syscalls/msg  failed=%d\n", useQueue ? "SendQueue" : "Socket::send",
+		messages / cost, (double)s_Syscalls / (messages ? messages : 1), s_Failed.load());
+}
+
+int main(int argc, char** argv) {
+	int conns = argc > 1 ? atoi(argv[1]) : 16;
+	s_Ticks = argc > 2 ? atoi(argv[2]) : 1000;
+	s_PerTick = argc > 3 ? atoi(argv[3]) : 32;
+	s_MsgSize = argc > 4 ? atoi(argv[4]) : 64;
+	fprintf(stderr, "conns=%d ticks=%d msgs/tick=%d msg=%zuB\n", conns, s_Ticks, s_PerTick, s_MsgSize);
+
+	Bench(conns, false);
+	Bench(conns, true);
+	return 0;
+}
@@ -0,0 +1,134 @@
+/*
+* 协程睡眠精度测试: 大量协程按固定周期睡眠, 同时有协程在做计算, 统计实际唤醒比预期晚多少, 单位us
+* 对比 Fiber::sleepFor / hook后的usleep / hook后的nanosleep, 以及普通线程里的usleep作为参照
+*
+* 编译:
+*   g++ -std=c++17 -O2 bench/sleep_bench.cpp context.cpp fiber.cpp stackallocator.cpp scheduler.cpp iomanager.cpp uring.cpp timer.cpp hook.cpp fdmanager.cpp thread.cpp mutex.cpp utils.cpp log.cpp -o sleep_bench -ldl -lpthread
+* 运行: ./sleep_bench [线程数] [睡眠协程数] [周期us] > /dev/null
+*/
+#include "../iomanager.h"
+#include "../hook.h"
+#include "../utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+using namespace WebServer;
+
+static const int kRounds = 30;
+// 每个计算协程每次占用CPU的时间
+static const uint64_t kBusyUS = 200;
+
+enum Mode {
+	SLEEP_FOR,
+	USLEEP,
+	NANOSLEEP
+};
+
+static const char* ModeName(Mode mode) {
+	switch (mode) {
+	case SLEEP_FOR:
+		return "Fiber::sleepFor";
+	case USLEEP:
+		return "hooked usleep";
+	default:
+		return "hooked nanosleep";
+	}
+}
+
+static void DoSleep(Mode mode, uint64_t us) {
+	switch (mode) {
+	case SLEEP_FOR:
+		Fiber::sleepFor(us);
+		break;
+	case USLEEP:
+		usleep(us);
+		break;
+	default: {
+		struct timespec ts;
+		ts.tv_sec = us / 1000000;
+		ts.tv_nsec = (us % 1000000) * 1000;
+		nanosleep(&ts, nullptr);
+		break;
+	}
+	}
+}
+
+static void Report(const char* name, std::vector<uint64_t>& late) {
+	std::sort(late.begin(), late.end());
+	uint64_t sum = 0;
+	for (auto i : late)
+		sum += i;
+	size_t n = late.size();
+	fprintf(stderr, "%-18s samples=%zu mean=%lluus p50=%lluus p99=%lluus max=%lluus\n", name, n,
+		(unsigned long long)(sum / n), (unsigned long long)late[n / 2],
+		(unsigned long long)late[n * 99 / 100], (unsigned long long)late[n - 1]);
+}
+
+static void BenchFiber(Mode mode, int threads, int sleepers, uint64_t period) {
+	std::vector<uint64_t> late((size_t)sleepers * kRounds);
+	std::atomic<int> running{ sleepers };
+	{
+		IOManager iom(threads, false, "sleep");
+		for (int i = 0; i < sleepers; i++) {
+			iom.schedule([&, i]() {
+				for (int r = 0; r < kRounds; r++) {
+					uint64_t start = GetMonotonicUS();
+					DoSleep(mode, period);
+					uint64_t cost = GetMonotonicUS() - start;
+					// 提前醒来记为0, 正常情况下不会出现
+					late[(size_t)i * kRounds + r] = cost > period ? cost - period : 0;
+				}
+				--running;
+			});
+		}
+		// 每个线程一个计算协程, 模拟忙碌的工作线程
+		for (int i = 0; i < threads; i++) {
+			iom.schedule([&]() {
+				while (running > 0) {
+					uint64_t end = GetMonotonicUS() + kBusyUS;
+					while (GetMonotonicUS() < end);
+					Fiber::YieldToReady();
+				}
+			});
+		}
+	}
+	Report(ModeName(mode), late);
+}
+
+static void BenchThread(int sleepers, uint64_t period) {
+	// 每个线程一个睡眠者, 线程太多没有意义
+	int count = std::min(sleepers, 64);
+	std::vector<uint64_t> late((size_t)count * kRounds);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < count; i++) {
+		threads.emplace_back([&, i]() {
+			for (int r = 0; r < kRounds; r++) {
+				uint64_t start = GetMonotonicUS();
+				usleep(period);
+				uint64_t cost = GetMonotonicUS() - start;
+				late[(size_t)i * kRounds + r] = cost > period ? cost - period : 0;
+			}
+		});
+	}
+	for (auto& i : threads)
+		i.join();
+	Report("thread usleep", late);
+}
+
+int main(int argc, char** argv) {
+	int threads = argc > 1 ? atoi(argv[1]) : 4;
+	int sleepers = argc > 2 ? atoi(argv[2]) : 200;
+	uint64_t period = argc > 3 ? strtoull(argv[3], nullptr, 10) : 16000;
+	fprintf(stderr, "threads=%d sleepers=%d period=%lluus rounds=%d\n", threads, sleepers, (unsigned long long)period, kRounds);
+
+	BenchFiber(SLEEP_FOR, threads, sleepers, period);
+	BenchFiber(USLEEP, threads, sleepers, period);
+	BenchFiber(NANOSLEEP, threads, sleepers, period);
+	BenchThread(sleepers, period);
+	return 0;
+}
@@ -0,0 +1,168 @@
+/*
+* 调度路径内存分配测试: 替换全局operator new统计次数, 投递N个任务, 输出 每个任务的分配次数 / 每个任务的耗时
+*   1. schedule一个只捕获一个指针的lambda
+*   2. schedule一个捕获40字节的lambda(和hook里超时回调的大小相当)
+*   3. 同样的lambda先包成std::function再schedule
+*   4. addTimer(0, 40字节的lambda)
+*   5. addConditionTimer(0, 40字节的lambda, 条件)
+*   6. schedule一个执行中让出一次的lambda(模拟hook的I/O挂起), 执行它的协程结束后放回空闲链表
+* 剩下的一次分配是任务节点FiberAndThread本身, 定时器节点来自TimerPool, 协程来自空闲链表, 稳定后都不分配
+*
+* 编译:
+*   g++ -std=c++17 -O2 bench/task_bench.cpp context.cpp fiber.cpp stackallocator.cpp scheduler.cpp iomanager.cpp uring.cpp timer.cpp hook.cpp fdmanager.cpp thread.cpp mutex.cpp utils.cpp log.cpp -o task_bench -ldl -lpthread
+* 运行: ./task_bench [任务数] > /dev/null
+*/
+#include "../iomanager.h"
+#include "../utils.h"
+
+#include <atomic>
+#include <functional>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static std::atomic<uint64_t> s_Allocs{ 0 };
+
+// 数组和nothrow版本也一起替换, 所有new/delete都走同一对malloc/free
+// GCC内联delete后看到free释放operator new的返回值会报-Wmismatched-new-delete, 替换全局new时这正是预期的配对
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void* operator new(size_t size) {
+	++s_Allocs;
+	void* ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	++s_Allocs;
+	return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void* ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+	free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+	free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+	free(ptr);
+}
+#pragma GCC diagnostic pop
+
+using namespace WebServer;
+
+static size_t s_Count = 1000000;
+static std::atomic<size_t> s_Done{ 0 };
+
+// 和hook里超时回调差不多大: 一个weak_ptr, 一个指针, 两个int
+struct Payload {
+	uint64_t a = 1;
+	uint64_t b = 2;
+	uint64_t c = 3;
+	uint64_t d = 4;
+	uint64_t e = 5;
+};
+
+// 在单线程IOManager的协程里执行submit(iom, i)投递s_Count个任务, 等它们全部执行完
+template<typename Submit>
+static void Run(const char* name, Submit submit) {
+	s_Done = 0;
+	uint64_t allocs = 0;
+	uint64_t us = 0;
+	{
+		IOManager iom(1, false, "task");
+		std::atomic<bool> finished{ false };
+		iom.schedule([&]() {
+			// 先跑一轮, 让栈池、定时器池和队列的内存都分配好
+			for (size_t i = 0; i < 1000; i++)
+				submit(iom);
+			while (s_Done < 1000)
+				Fiber::YieldToReady();
+			s_Done = 0;
+
+			uint64_t before = s_Allocs;
+			uint64_t start = GetMonotonicUS();
+			for (size_t i = 0; i < s_Count; i++) {
+				submit(iom);
+				// 在途任务不超过1024个, 队列不用扩容
+				while (i + 1 > s_Done + 1024)
+					Fiber::YieldToReady();
+			}
+			while (s_Done < s_Count)
+				Fiber::YieldToReady();
+			us = GetMonotonicUS() - start;
+			allocs = s_Allocs - before;
+			finished = true;
+		});
+		while (!finished)
+			usleep(1000);
+	}
+	fprintf(stderr, "%-34s %6.2f allocs/task %8.1f ns/task\n", name, (double)allocs / s_Count, us * 1000.0 / s_Count);
+}
+
+int main(int argc, char** argv) {
+	s_Count = argc > 1 ? atoi(argv[1]) : 1000000;
+	fprintf(stderr, "tasks=%zu\n", s_Count);
+
+	Run("schedule(lambda 8B)", [](IOManager& iom) {
+		std::atomic<size_t>* done = &s_Done;
+		iom.schedule([done]() { ++*done; });
+	});
+
+	Run("schedule(lambda 40B)", [](IOManager& iom) {
+		Payload payload;
+		iom.schedule([payload]() { s_Done += payload.a; });
+	});
+
+	Run("schedule(std::function 40B)", [](IOManager& iom) {
+		Payload payload;
+		std::function<void()> func([payload]() { s_Done += payload.a; });
+		iom.schedule(func);
+	});
+
+	Run("addTimer(0, lambda 40B)", [](IOManager& iom) {
+		Payload payload;
+		iom.addTimer(0, [payload]() { s_Done += payload.a; });
+	});
+
+	static std::shared_ptr<int> s_Cond = std::make_shared<int>(0);
+	Run("addConditionTimer(0, lambda 40B)", [](IOManager& iom) {
+		Payload payload;
+		iom.addConditionTimer(0, [payload]() { s_Done += payload.a; }, s_Cond);
+	});
+
+	// 让出后协程重新入队一次, 所以每个任务有两个任务节点
+	Run("schedule(lambda 8B, yield once)", [](IOManager& iom) {
+		std::atomic<size_t>* done = &s_Done;
+		iom.schedule([done]() {
+			Fiber::YieldToReady();
+			++*done;
+		});
+	});
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+* TcpServer建连吞吐量测试: 单个监听socket vs 每个工作线程一个SO_REUSEPORT分片, 单位 连接/秒
+* 客户端协程不停地connect, 等服务端关闭后再close, TIME_WAIT留在服务端, 不会耗尽客户端的临时端口
+* 同时检查每个分片的accept都在它固定的工作线程上完成, 有跑到其他线程的就以退出码1结束
+*
+* 编译:
+*   g++ -std=c++17 -O2 bench/tcpserver_bench.cpp tcpserver.cpp socket.cpp address.cpp ByteArray.cpp context.cpp fiber.cpp stackallocator.cpp scheduler.cpp iomanager.cpp uring.cpp timer.cpp hook.cpp fdmanager.cpp thread.cpp mutex.cpp utils.cpp log.cpp -o tcpserver_bench -ldl -lpthread
+* 运行: ./tcpserver_bench [服务端线程数] [客户端协程数] [每轮秒数] > /dev/null
+*/
+#include "../tcpserver.h"
+#include "../hook.h"
+#include "../utils.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace WebServer;
+
+static std::atomic<bool> s_Running{ false };
+static std::atomic<uint64_t> s_Failed{ 0 };
+
+class CloseServer : public TcpServer {
+public:
+	CloseServer(IOManager* worker, size_t shards)
+		: TcpServer(worker, shards)
+	{
+	}
+
+protected:
+	// 直接关闭, 只测建连
+	void handleClient(Socket::socketPtr client) override {
+		client->close();
+	}
+};
+
+static void Client(Address::addressPtr addr) {
+	char buf[16];
+	while (s_Running) {
+		Socket::socketPtr sock = Socket::CreateTCP(addr);
+		if (!sock->connect(addr)) {
+			++s_Failed;
+			continue;
+		}
+		// 等服务端先关闭
+		sock->receive(buf, sizeof(buf));
+		sock->close();
+	}
+}
+
+static double Bench(int threads, int clients, int seconds, size_t shards) {
+	s_Running = true;
+	IOManager server(threads, false, "server");
+	IOManager client(threads, false, "client");
+
+	std::shared_ptr<CloseServer> tcp(new CloseServer(&server, shards));
+	// 监听socket要在IOManager的协程里创建, hook才会把它登记为非阻塞
+	std::atomic<int> ready{ 0 };
+	server.schedule([&]() {
+		Address::addressPtr addr = IPv4Address::Create("127.0.0.1", 0);
+		ready = tcp->bind(addr) && tcp->start() ? 1 : -1;
+	});
+	while (!ready)
+		usleep(1000);
+	if (ready < 0) {
+		fprintf(stderr, "bind failed\n");
+		exit(1);
+	}
+	Address::addressPtr target = tcp->getSocks()[0]->getLocalAddress();
+	for (int i = 0; i < clients; i++)
+		client.schedule(std::bind(&Client, target));
+
+	// 预热一秒再开始计数
+	sleep(1);
+	uint64_t start = tcp->getAcceptCount();
+	uint64_t startUS = GetMonotonicUS();
+	sleep(seconds);
+	uint64_t count = tcp->getAcceptCount() - start;
+	double cost = (GetMonotonicUS() - startUS) / 1e6;
+
+	// stop调度的协程会在其他线程清空监听socket, 分片数要在stop之前取
+	size_t shardCount = tcp->getShardCount();
+	s_Running = false;
+	tcp->stop();
+	uint64_t migrated = tcp->getMigratedAcceptCount();
+	fprintf(stderr, "shards=%zu accepted=%llu failed=%llu migrated=%llu\n", shardCount, (unsigned long long)count,
+		(unsigned long long)s_Failed.load(), (unsigned long long)migrated);
+	// 每个分片的accept都应该在它固定的线程上完成
+	if (migrated) {
+		fprintf(stderr, "accept fiber left its pinned thread\n");
+		exit(1);
+	}
+	return count / cost;
+}
+
+int main(int argc, char** argv) {
+	int threads = argc > 1 ? atoi(argv[1]) : 4;
+	int clients = argc > 2 ? atoi(argv[2]) : 64;
+	int seconds = argc > 3 ? atoi(argv[3]) : 3;
+	fprintf(stderr, "server threads=%d client fibers=%d seconds=%d\n", threads, clients, seconds);
+
+	double single = Bench(threads, clients, seconds, 1);
+	fprintf(stderr, "1 listener:        %.0f conns/s\n", single);
+	double sharded = Bench(threads, clients, seconds, threads);
+	fprintf(stderr, "%d reuseport shards: %.0f conns/s\n", threads, sharded);
+	return 0;
+}
@@ -0,0 +1,143 @@
+/*
+* UDP回环收发包率测试: 一个协程往回环地址发小数据报, 另一个协程收
+* 对比 每个数据报一次sendTo/receiveFrom / 每批一次sendBatch/receiveBatch(sendmmsg/recvmmsg)
+* 统计收到的 包/秒 和每个数据报的系统调用次数
+* 发送方最多领先接收方kWindow个数据报, 回环上接收缓冲区很小(rmem_max), 不限速的话大部分包会被丢掉
+*
+* 编译:
+*   g++ -std=c++17 -O2 bench/udp_bench.cpp socket.cpp address.cpp ByteArray.cpp context.cpp fiber.cpp stackallocator.cpp scheduler.cpp iomanager.cpp uring.cpp timer.cpp hook.cpp fdmanager.cpp thread.cpp mutex.cpp utils.cpp log.cpp -o udp_bench -ldl -lpthread
+* 运行: ./udp_bench [数据报个数] [每批个数] [数据报字节数] > /dev/null
+*/
+#include "../iomanager.h"
+#include "../socket.h"
+#include "../utils.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace WebServer;
+
+static size_t s_Count = 2000000;
+static size_t s_Batch = 32;
+static size_t s_Size = 64;
+static const size_t kWindow = 1024;
+
+struct Result {
+	std::atomic<uint64_t> received{ 0 };
+	uint64_t recvCalls = 0;
+	uint64_t sendCalls = 0;
+	uint64_t start = 0;
+	uint64_t last = 0;
+	std::atomic<bool> receiverDone{ false };
+};
+
+static void Receiver(Socket::socketPtr sock, bool batch, Result* result) {
+	std::vector<char> buf(s_Batch * 2048);
+	std::vector<Socket::Datagram> msgs(s_Batch);
+	for (size_t i = 0; i < s_Batch; i++) {
+		msgs[i].addr.reset(new IPv4Address());
+	}
+	Address::addressPtr from(new IPv4Address());
+	while (true) {
+		int rt;
+		if (batch) {
+			for (size_t i = 0; i < s_Batch; i++) {
+				msgs[i].buffer = &buf[i * 2048];
+				msgs[i].length = 2048;
+			}
+			rt = sock->receiveBatch(&msgs[0], s_Batch);
+		}
+		else {
+			rt = sock->receiveFrom(&buf[0], 2048, from) > 0 ? 1 : -1;
+		}
+		// 发送方发完后接收超时退出
+		if (rt <= 0)
+			break;
+		++result->recvCalls;
+		result->received += rt;
+		result->last = GetMonotonicUS();
+	}
+}
+
+static void Sender(Socket::socketPtr sock, Address::addressPtr to, bool batch, Result* result) {
+	std::vector<char> payload(s_Size, 'u');
+	std::vector<Socket::Datagram> msgs(s_Batch);
+	for (auto& i : msgs) {
+		i.buffer = &payload[0];
+		i.length = payload.size();
+		i.addr = to;
+	}
+	size_t sent = 0;
+	while (sent < s_Count) {
+		int rt;
+		if (batch)
+			rt = sock->sendBatch(&msgs[0], std::min(s_Batch, s_Count - sent));
+		else
+			rt = sock->sendTo(&payload[0], payload.size(), to) > 0 ? 1 : -1;
+		if (rt <= 0) {
+			fprintf(stderr, "send failed errno=%d\n", errno);
+			break;
+		}
+		++result->sendCalls;
+		sent += rt;
+		// 接收方超时退出说明有包丢了, 不再等
+		while (sent > result->received + kWindow && !result->receiverDone)
+			Fiber::YieldToReady();
+	}
+}
+
+static void Bench(bool batch) {
+	Result result;
+	std::atomic<int> done{ 0 };
+	{
+		IOManager iom(2, false, "udp");
+		iom.schedule([&]() {
+			// socket要在IOManager的协程里创建, hook才会把它登记为非阻塞
+			Address::addressPtr addr = IPv4Address::Create("127.0.0.1", 0);
+			Socket::socketPtr recvSock = Socket::CreateUDP(addr);
+			int rcvbuf = 8 * 1024 * 1024;
+			recvSock->setOption(SOL_SOCKET, SO_RCVBUF, rcvbuf);
+			if (!recvSock->bind(addr)) {
+				fprintf(stderr, "bind failed\n");
+				exit(1);
+			}
+			recvSock->setReceiveTimeout(200);
+			Address::addressPtr target = recvSock->getLocalAddress();
+			Socket::socketPtr sendSock = Socket::CreateUDP(addr);
+
+			result.start = GetMonotonicUS();
+			iom.schedule([&, recvSock]() {
+				Receiver(recvSock, batch, &result);
+				result.receiverDone = true;
+				++done;
+			});
+			iom.schedule([&, sendSock, target]() {
+				Sender(sendSock, target, batch, &result);
+				++done;
+			});
+		});
+		while (done < 2)
+			usleep(1000);
+	}
+
+	double cost = (result.last - result.start) / 1e6;
+	uint64_t received = result.received;
+	fprintf(stderr, "%-24s %10.0f pps  received=%llu/%zu  recv %.3f calls/pkt  send %.3f calls/pkt\n",
+		batch ? "sendBatch/receiveBatch" : "sendTo/receiveFrom",
+		received / cost, (unsigned long long)received, s_Count,
+		(double)result.recvCalls / (received ? received : 1), (double)result.sendCalls / s_Count);
+}
+
+int main(int argc, char** argv) {
+	s_Count = argc > 1 ? atoi(argv[1]) : 2000000;
+	s_Batch = argc > 2 ? atoi(argv[2]) : 32;
+	s_Size = argc > 3 ? atoi(argv[3]) : 64;
+	fprintf(stderr, "datagrams=%zu batch=%zu size=%zuB\n", s_Count, s_Batch, s_Size);
+
+	Bench(false);
+	Bench(true);
+	return 0;
+}
@@ -0,0 +1,204 @@
+/*
+* UDP分段卸载测试: 一个协程往回环地址发大块数据, 按固定大小切成数据报, 另一个协程收
+* 对比 每个数据报一次sendTo/receiveFrom / sendBatch/receiveBatch(sendmmsg/recvmmsg) / sendSegments+GRO(UDP_SEGMENT/UDP_GRO)
+* 发送的数据来自ByteArray::getReadBuffers, 统计 Gbit/s 和每Gbit消耗的CPU秒数(用户态+内核态, 收发两边合计)
+* 发送方最多领先接收方kWindow字节, 回环上接收缓冲区很小(rmem_max), 不限速的话大部分包会被丢掉
+* 内核不支持GSO/GRO时sendSegments退回sendmmsg, receiveSegments按单个数据报接收, 输出里会标出来
+*
+* 编译:
+*   g++ -std=c++17 -O2 bench/udp_gso_bench.cpp socket.cpp address.cpp ByteArray.cpp context.cpp fiber.cpp stackallocator.cpp scheduler.cpp iomanager.cpp uring.cpp timer.cpp hook.cpp fdmanager.cpp thread.cpp mutex.cpp utils.cpp log.cpp -o udp_gso_bench -ldl -lpthread
+* 运行: ./udp_gso_bench [总MB数] [数据报字节数] > /dev/null
+*/
+#include "../ByteArray.h"
+#include "../iomanager.h"
+#include "../socket.h"
+#include "../utils.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace WebServer;
+
+enum Mode {
+	MODE_SINGLE,
+	MODE_BATCH,
+	MODE_GSO,
+};
+
+static size_t s_Total = 1024ull * 1024 * 1024;
+static size_t s_SegSize = 1200;
+static const size_t kBatch = 64;
+static const size_t kWindow = 1024 * 1024;
+
+struct Result {
+	std::atomic<uint64_t> received{ 0 };
+	uint64_t datagrams = 0;
+	uint64_t recvCalls = 0;
+	uint64_t sendCalls = 0;
+	uint64_t start = 0;
+	uint64_t last = 0;
+	bool gro = false;
+	std::atomic<bool> receiverDone{ false };
+};
+
+static double CpuSeconds() {
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static void Receiver(Socket::socketPtr sock, Mode mode, Result* result) {
+	std::vector<char> buf(kBatch * 65536);
+	std::vector<Socket::Datagram> msgs(kBatch);
+	for (auto& i : msgs)
+		i.addr.reset(new IPv4Address());
+	std::vector<iovec> segments;
+	Address::addressPtr from(new IPv4Address());
+	if (mode == MODE_GSO)
+		result->gro = sock->setGro(true);
+	while (true) {
+		int rt;
+		size_t bytes = 0;
+		if (mode == MODE_BATCH) {
+			for (size_t i = 0; i < kBatch; i++) {
+				msgs[i].buffer = &buf[i * 2048];
+				msgs[i].length = 2048;
+			}
+			rt = sock->receiveBatch(&msgs[0], kBatch);
+			for (int i = 0; i < rt; i++)
+				bytes += msgs[i].length;
+		}
+		else if (mode == MODE_GSO) {
+			rt = sock->receiveSegments(&buf[0], 65536, segments, from);
+			for (int i = 0; i < rt; i++)
+				bytes += segments[i].iov_len;
+		}
+		else {
+			rt = sock->receiveFrom(&buf[0], 2048, from);
+			bytes = rt > 0 ? rt : 0;
+			rt = rt > 0 ? 1 : -1;
+		}
+		// 发送方发完后接收超时退出
+		if (rt <= 0)
+			break;
+		++result->recvCalls;
+		result->datagrams += rt;
+		result->received += bytes;
+		result->last = GetMonotonicUS();
+	}
+}
+
+static void Sender(Socket::socketPtr sock, Address::addressPtr to, Mode mode, Result* result) {
+	// 一块kBatch个数据报的数据, 反复发送
+	ByteArray ba;
+	std::vector<char> payload(kBatch * s_SegSize, 'g');
+	ba.write(&payload[0], payload.size());
+	ba.setPosition(0);
+	std::vector<iovec> iovs;
+	ba.getReadBuffers(iovs);
+
+	std::vector<Socket::Datagram> msgs(kBatch);
+	for (size_t i = 0; i < kBatch; i++) {
+		msgs[i].buffer = &payload[i * s_SegSize];
+		msgs[i].length = s_SegSize;
+		msgs[i].addr = to;
+	}
+	size_t sent = 0;
+	while (sent < s_Total) {
+		int rt;
+		size_t chunk = std::min(payload.size(), s_Total - sent);
+		if (mode == MODE_GSO) {
+			// 最后一块可能不满, 截短iovec
+			std::vector<iovec> part;
+			size_t left = chunk;
+			for (auto& i : iovs) {
+				if (!left)
+					break;
+				part.push_back({ i.iov_base, std::min(i.iov_len, left) });
+				left -= part.back().iov_len;
+			}
+			rt = sock->sendSegments(&part[0], part.size(), s_SegSize, to);
+		}
+		else if (mode == MODE_BATCH) {
+			rt = sock->sendBatch(&msgs[0], (chunk + s_SegSize - 1) / s_SegSize);
+			rt = rt > 0 ? std::min(chunk, rt * s_SegSize) : -1;
+		}
+		else {
+			rt = sock->sendTo(&payload[0], std::min(s_SegSize, chunk), to);
+		}
+		if (rt <= 0) {
+			fprintf(stderr, "send failed errno=%d\n", errno);
+			break;
+		}
+		++result->sendCalls;
+		sent += rt;
+		// 接收方超时退出说明有包丢了, 不再等
+		while (sent > result->received + kWindow && !result->receiverDone)
+			Fiber::YieldToReady();
+	}
+}
+
+static void Bench(Mode mode) {
+	Result result;
+	std::atomic<int> done{ 0 };
+	double cpuStart = CpuSeconds();
+	{
+		IOManager iom(2, false, "udp");
+		iom.schedule([&]() {
+			// socket要在IOManager的协程里创建, hook才会把它登记为非阻塞
+			Address::addressPtr addr = IPv4Address::Create("127.0.0.1", 0);
+			Socket::socketPtr recvSock = Socket::CreateUDP(addr);
+			int rcvbuf = 8 * 1024 * 1024;
+			recvSock->setOption(SOL_SOCKET, SO_RCVBUF, rcvbuf);
+			if (!recvSock->bind(addr)) {
+				fprintf(stderr, "bind failed\n");
+				exit(1);
+			}
+			recvSock->setReceiveTimeout(200);
+			Address::addressPtr target = recvSock->getLocalAddress();
+			Socket::socketPtr sendSock = Socket::CreateUDP(addr);
+
+			result.start = GetMonotonicUS();
+			iom.schedule([&, recvSock]() {
+				Receiver(recvSock, mode, &result);
+				result.receiverDone = true;
+				++done;
+			});
+			iom.schedule([&, sendSock, target]() {
+				Sender(sendSock, target, mode, &result);
+				++done;
+			});
+		});
+		while (done < 2)
+			usleep(1000);
+	}
+	double cpu = CpuSeconds() - cpuStart;
+	// 接收超时的200ms空等不算
+	double cost = (result.last - result.start) / 1e6;
+	double gbit = result.received * 8 / 1e9;
+
+	const char* name = "sendTo/receiveFrom";
+	if (mode == MODE_BATCH)
+		name = "sendBatch/receiveBatch";
+	else if (mode == MODE_GSO)
+		name = Socket::IsGsoSupported() ? (result.gro ? "GSO/GRO" : "GSO/no GRO") : (result.gro ? "no GSO/GRO" : "no GSO/no GRO");
+	fprintf(stderr, "%-24s %6.2f Gbit/s  %6.3f cpu-s/Gbit  received=%.1f%%  %.3f send calls/dgram  %.3f recv calls/dgram\n",
+		name, gbit / cost, cpu / (gbit ? gbit : 1), 100.0 * result.received / s_Total,
+		(double)result.sendCalls / (result.datagrams ? result.datagrams : 1),
+		(double)result.recvCalls / (result.datagrams ? result.datagrams : 1));
+}
+
+int main(int argc, char** argv) {
+	s_Total = (argc > 1 ? atoll(argv[1]) : 1024) * 1024 * 1024;
+	s_SegSize = argc > 2 ? atoi(argv[2]) : 1200;
+	fprintf(stderr, "total=%zuMB datagram=%zuB\n", s_Total / 1024 / 1024, s_SegSize);
+
+	Bench(MODE_SINGLE);
+	Bench(MODE_BATCH);
+	Bench(MODE_GSO);
+	return 0;
+}
@@ -0,0 +1,115 @@
+/*
+* ByteArray varint编解码测试, 数值分布按实体同步包: 大部分是小的id/增量, 少数是大数
+* 对比:
+*   原来的做法: 编码到临时数组再write / 按readFuint8逐字节解码
+*   现在的单个接口: writeUint32 / readUint32 (当前内存块里直接编解码)
+*   批量接口: writeUint32Array / readUint32Array
+* 单位 百万个值/秒
+*
+* 编译:
+*   g++ -std=c++17 -O2 bench/varint_bench.cpp ByteArray.cpp log.cpp thread.cpp mutex.cpp utils.cpp -o varint_bench -lpthread
+* 运行: ./varint_bench [个数] [块大小] > /dev/null
+*/
+#include "../ByteArray.h"
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace WebServer;
+
+static uint64_t NowUS() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void OldWrite(ByteArray& ba, uint32_t value) {
+	uint8_t tmp[5];
+	uint8_t i = 0;
+	while (value >= 0x80) {
+		tmp[i++] = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	tmp[i++] = value;
+	ba.write(tmp, i);
+}
+
+static uint32_t OldRead(ByteArray& ba) {
+	uint32_t result = 0;
+	for (int i = 0; i < 32; i += 7) {
+		uint8_t b = ba.readFuint8();
+		result |= ((uint32_t)(b & 0x7F)) << i;
+		if (b < 0x80)
+			break;
+	}
+	return result;
+}
+
+static void Report(const char* name, size_t count, uint64_t cost, bool ok) {
+	fprintf(stderr, "%-24s %8.1f M/s %s\n", name, count / (double)cost, ok ? "" : "MISMATCH");
+}
+
+int main(int argc, char** argv) {
+	size_t count = argc > 1 ? atoi(argv[1]) : 10000000;
+	size_t baseSize = argc > 2 ? atoi(argv[2]) : 4096;
+	fprintf(stderr, "count=%zu block=%zu\n", count, baseSize);
+
+	// 70% 1字节, 20% 2字节, 8% 3~4字节, 2% 5字节
+	std::mt19937 rng(1);
+	std::vector<uint32_t> values(count);
+	for (auto& i : values) {
+		uint32_t r = rng() % 100;
+		if (r < 70)
+			i = rng() % 128;
+		else if (r < 90)
+			i = 128 + rng() % (16384 - 128);
+		else if (r < 98)
+			i = 16384 + rng() % ((1u << 28) - 16384);
+		else
+			i = (1u << 28) + rng() % (0xFFFFFFFFu - (1u << 28));
+	}
+	std::vector<uint32_t> out(count);
+
+	{
+		ByteArray ba(baseSize);
+		uint64_t start = NowUS();
+		for (auto i : values)
+			OldWrite(ba, i);
+		Report("old write", count, NowUS() - start, true);
+
+		ba.setPosition(0);
+		start = NowUS();
+		for (auto& i : out)
+			i = OldRead(ba);
+		Report("old read", count, NowUS() - start, out == values);
+	}
+
+	{
+		ByteArray ba(baseSize);
+		uint64_t start = NowUS();
+		for (auto i : values)
+			ba.writeUint32(i);
+		Report("writeUint32", count, NowUS() - start, true);
+
+		ba.setPosition(0);
+		start = NowUS();
+		for (auto& i : out)
+			i = ba.readUint32();
+		Report("readUint32", count, NowUS() - start, out == values);
+	}
+
+	{
+		ByteArray ba(baseSize);
+		uint64_t start = NowUS();
+		ba.writeUint32Array(&values[0], count);
+		Report("writeUint32Array", count, NowUS() - start, true);
+
+		ba.setPosition(0);
+		start = NowUS();
+		ba.readUint32Array(&out[0], count);
+		Report("readUint32Array", count, NowUS() - start, out == values);
+	}
+	return 0;
+}
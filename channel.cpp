@@ -0,0 +1,159 @@
+#include "channel.h"
+
+namespace WebServer {
+
+	void ChannelBase::close() {
+		FiberWaitQueue wake;
+		{
+			Mutex::Lock lock(m_Mtx);
+			if (m_Closed)
+				return;
+			m_Closed = true;
+			for (FiberWaitQueue* queue : { &m_Senders, &m_Receivers }) {
+				while (FiberWaiter* i = queue->pop()) {
+					ChannelWaiter* waiter = static_cast<ChannelWaiter*>(i);
+					waiter->result = WAKE_CLOSED;
+					if (!waiter->fired) {
+						wake.push(waiter);
+						continue;
+					}
+					// select节点在注销之前还在select协程的栈上, 要在锁内唤醒, 见frontWaiter
+					bool expected = false;
+					if (waiter->fired->compare_exchange_strong(expected, true))
+						FiberWaitQueue::Wake(waiter);
+				}
+			}
+			m_SendWaiters = 0;
+			m_RecvWaiters = 0;
+		}
+		WakeAll(wake);
+	}
+
+	void ChannelBase::WakeAll(FiberWaitQueue& queue) {
+		// 先取下一个再唤醒, 唤醒之后节点可能已经不在了
+		FiberWaiter* waiter = queue.pop();
+		while (waiter) {
+			FiberWaiter* next = queue.pop();
+			FiberWaitQueue::Wake(waiter);
+			waiter = next;
+		}
+	}
+
+	ChannelWaiter* ChannelBase::frontWaiter(FiberWaitQueue& queue, std::atomic<size_t>& count) {
+		while (!queue.empty()) {
+			ChannelWaiter* waiter = static_cast<ChannelWaiter*>(queue.front());
+			if (!waiter->fired)
+				return waiter;
+			// select节点: 出队并通知一次, 抢到触发标志的才唤醒
+			// 节点在select协程的栈上, select注销节点前要拿m_Mtx, 所以持锁期间访问是安全的
+			queue.pop();
+			--count;
+			bool expected = false;
+			if (waiter->fired->compare_exchange_strong(expected, true))
+				FiberWaitQueue::Wake(waiter);
+		}
+		return nullptr;
+	}
+
+	ChannelWaiter* ChannelBase::popWaiter(FiberWaitQueue& queue, std::atomic<size_t>& count, int result) {
+		ChannelWaiter* waiter = static_cast<ChannelWaiter*>(queue.pop());
+		--count;
+		waiter->result = result;
+		return waiter;
+	}
+
+	int ChannelBase::park(FiberWaitQueue& queue, void* value, Mutex::Lock& lock) {
+		ChannelWaiter waiter;
+		waiter.value = value;
+		queue.park(waiter, lock);
+		return waiter.result;
+	}
+
+	void ChannelBase::addSelectWaiter(ChannelWaiter* waiter, bool send) {
+		Mutex::Lock lock(m_Mtx);
+		if (send) {
+			m_Senders.push(waiter);
+			++m_SendWaiters;
+		}
+		else {
+			m_Receivers.push(waiter);
+			++m_RecvWaiters;
+		}
+	}
+
+	void ChannelBase::removeSelectWaiter(ChannelWaiter* waiter, bool send) {
+		Mutex::Lock lock(m_Mtx);
+		if (send) {
+			if (m_Senders.remove(waiter))
+				--m_SendWaiters;
+		}
+		else if (m_Receivers.remove(waiter))
+			--m_RecvWaiters;
+	}
+
+	int ChannelSelect::tryAll() {
+		size_t count = m_Cases.size();
+		size_t start = m_Next++;
+		for (size_t n = 0; n < count; n++) {
+			size_t index = (start + n) % count;
+			Case& c = m_Cases[index];
+			bool closed = c.channel->isClosed();
+			if (c.tryOp(c.channel, c.value)) {
+				if (c.ok)
+					*c.ok = true;
+				return index;
+			}
+			// 关闭前读到的closed, 接收方这时已经取空了; 发送方关闭后直接失败
+			if (closed) {
+				if (c.ok)
+					*c.ok = false;
+				return index;
+			}
+		}
+		return -1;
+	}
+
+	int ChannelSelect::select(bool block) {
+		if (m_Cases.empty())
+			return -1;
+		while (true) {
+			int index = tryAll();
+			if (index >= 0 || !block)
+				return index;
+			if (!Scheduler::getThis()) {
+				sched_yield();
+				continue;
+			}
+
+			std::atomic<bool> fired{ false };
+			std::vector<ChannelWaiter> waiters(m_Cases.size());
+			Scheduler* scheduler = Scheduler::getThis();
+			Fiber::fiberPtr self = Fiber::getThis();
+			for (size_t i = 0; i < m_Cases.size(); i++) {
+				waiters[i].scheduler = scheduler;
+				waiters[i].fiber = self;
+				waiters[i].fired = &fired;
+				m_Cases[i].channel->addSelectWaiter(&waiters[i], m_Cases[i].send);
+			}
+			self.reset();
+			// 登记之后再试一次, 和通道快路径上先操作缓冲区再读等待数配对
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			index = tryAll();
+
+			bool consume = false;
+			if (index < 0)
+				Fiber::YieldToHold();
+			else {
+				// 自己先置位, 没抢到说明已经有通道调度了这个协程, 注销后要把这次调度消耗掉
+				bool expected = false;
+				consume = !fired.compare_exchange_strong(expected, true);
+			}
+			for (size_t i = 0; i < m_Cases.size(); i++)
+				m_Cases[i].channel->removeSelectWaiter(&waiters[i], m_Cases[i].send);
+			if (consume)
+				Fiber::YieldToHold();
+			if (index >= 0)
+				return index;
+		}
+	}
+}
@@ -0,0 +1,408 @@
+#pragma once
+#include "core.h"
+#include "fibersync.h"
+#include "mutex.h"
+#include "scheduler.h"
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <sched.h>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace WebServer {
+
+	// 挂在通道上的协程, 直接交接时value指向发送的值或者接收的位置
+	struct ChannelWaiter : public FiberWaiter {
+		void* value = nullptr;
+		// 被唤醒的原因, ChannelBase::Result
+		int result = 0;
+		// select的节点只通知不交接, 同一次select的所有节点共用一个触发标志, 只有第一个触发的会唤醒协程
+		std::atomic<bool>* fired = nullptr;
+	};
+
+	/*
+	* @brief 通道里和元素类型无关的部分: 挂起的发送方/接收方队列、关闭标志, 以及给select用的登记接口
+	*        队列和计数由m_Mtx保护, 计数是原子的, 快路径不加锁只读计数判断有没有协程在等
+	*/
+	class ChannelBase {
+	friend class ChannelSelect;
+	public:
+		ChannelBase(const ChannelBase&) = delete;
+		ChannelBase& operator=(const ChannelBase&) = delete;
+
+		bool isClosed() const { return m_Closed; }
+
+		/*
+		* @brief 关闭通道, 唤醒所有挂起的协程
+		*        关闭后push失败, pop继续取完缓冲区里剩下的数据后失败
+		*/
+		void close();
+
+	protected:
+		enum Result {
+			WAKE_NONE = 0,
+			WAKE_OK,
+			WAKE_CLOSED
+		};
+
+		ChannelBase() = default;
+		~ChannelBase() = default;
+
+		/*
+		* @brief 取队首第一个直接交接的等待者, 不出队, 调用时持有m_Mtx
+		*        排在它前面的select节点出队并通知, 让select自己重试
+		*/
+		ChannelWaiter* frontWaiter(FiberWaitQueue& queue, std::atomic<size_t>& count);
+		// 出队并以result唤醒, 调用时持有m_Mtx, 唤醒放到锁外由调用方做
+		ChannelWaiter* popWaiter(FiberWaitQueue& queue, std::atomic<size_t>& count, int result);
+		/*
+		* @brief 当前协程放进队列, 解锁后挂起, 返回被唤醒的原因
+		*        调用方要先给count加一, 再重试一次缓冲区, 和快路径上先操作缓冲区再读count配对
+		*/
+		int park(FiberWaitQueue& queue, void* value, Mutex::Lock& lock);
+
+		// 唤醒出队后攒在一起的等待者, 在锁外调用
+		static void WakeAll(FiberWaitQueue& queue);
+
+		// select用: 登记/注销只通知的节点
+		void addSelectWaiter(ChannelWaiter* waiter, bool send);
+		void removeSelectWaiter(ChannelWaiter* waiter, bool send);
+
+	protected:
+		Mutex m_Mtx;
+		FiberWaitQueue m_Senders;
+		FiberWaitQueue m_Receivers;
+		// 两个队列里的节点数, 快路径靠它判断要不要走慢路径
+		std::atomic<size_t> m_SendWaiters{ 0 };
+		std::atomic<size_t> m_RecvWaiters{ 0 };
+		std::atomic<bool> m_Closed{ false };
+	};
+
+	/*
+	* @brief 有界多生产者多消费者通道, 协程之间传递数据不用共享状态加schedule
+	*        缓冲区是无锁环形队列(每个槽位带序号), 不竞争时push/pop只有几次原子操作, 不加锁不分配内存
+	*        缓冲区满时push挂起协程, 空时pop挂起协程; 有接收方挂起时push把数据直接交给它, 不经过缓冲区
+	*        不在调度器线程里调用时没法挂起, 退化为让出CPU的自旋
+	*        容量向上取整到2的幂, 至少为2
+	*/
+	template<typename T>
+	class Channel : public ChannelBase {
+	public:
+		typedef std::shared_ptr<Channel> channelPtr;
+
+		explicit Channel(size_t capacity = 1)
+		{
+			// 槽位序号区分空和满至少要两个槽位
+			size_t size = 2;
+			while (size < capacity)
+				size <<= 1;
+			m_Mask = size - 1;
+			m_Cells = new Cell[size];
+			for (size_t i = 0; i < size; i++)
+				m_Cells[i].seq.store(i, std::memory_order_relaxed);
+		}
+
+		~Channel() {
+			size_t tail = m_Tail.load();
+			for (size_t pos = m_Head.load(); pos != tail; ++pos)
+				reinterpret_cast<T*>(&m_Cells[pos & m_Mask].storage)->~T();
+			delete[] m_Cells;
+		}
+
+		size_t getCapacity() const { return m_Mask + 1; }
+		// 缓冲区里的元素数, 并发时只是近似值
+		size_t getSize() const {
+			size_t tail = m_Tail.load(std::memory_order_relaxed);
+			size_t head = m_Head.load(std::memory_order_relaxed);
+			return tail > head ? tail - head : 0;
+		}
+
+		// 阻塞发送, 通道已关闭时返回false, 这时value没有被移走
+		bool push(T&& value) {
+			if (WS_UNLIKELY(m_Closed))
+				return false;
+			if (WS_LIKELY(m_RecvWaiters.load() == 0 && ringPush(value))) {
+				wakeReceivers();
+				return true;
+			}
+			return pushSlow(value, true);
+		}
+
+		bool push(const T& value) {
+			T tmp(value);
+			return push(std::move(tmp));
+		}
+
+		// 不阻塞, 缓冲区满或者通道已关闭时返回false
+		bool tryPush(T&& value) {
+			if (WS_UNLIKELY(m_Closed))
+				return false;
+			if (WS_LIKELY(m_RecvWaiters.load() == 0 && ringPush(value))) {
+				wakeReceivers();
+				return true;
+			}
+			return pushSlow(value, false);
+		}
+
+		bool tryPush(const T& value) {
+			T tmp(value);
+			return tryPush(std::move(tmp));
+		}
+
+		// 阻塞接收, 通道已关闭并且缓冲区取空时返回false
+		bool pop(T& value) {
+			if (WS_LIKELY(ringPop(value))) {
+				wakeSenders();
+				return true;
+			}
+			return popSlow(value, true);
+		}
+
+		// 不阻塞, 没有数据时返回false
+		bool tryPop(T& value) {
+			if (WS_LIKELY(ringPop(value))) {
+				wakeSenders();
+				return true;
+			}
+			return popSlow(value, false);
+		}
+
+	private:
+		struct Cell {
+			std::atomic<size_t> seq;
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		};
+
+		// 缓冲区满时返回false, 成功时value被移走
+		bool ringPush(T& value) {
+			size_t pos = m_Tail.load(std::memory_order_relaxed);
+			while (true) {
+				Cell& cell = m_Cells[pos & m_Mask];
+				size_t seq = cell.seq.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+				if (diff == 0) {
+					if (m_Tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						new (&cell.storage) T(std::move(value));
+						cell.seq.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0)
+					return false;
+				else
+					pos = m_Tail.load(std::memory_order_relaxed);
+			}
+		}
+
+		// 缓冲区空时返回false
+		bool ringPop(T& value) {
+			size_t pos = m_Head.load(std::memory_order_relaxed);
+			while (true) {
+				Cell& cell = m_Cells[pos & m_Mask];
+				size_t seq = cell.seq.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+				if (diff == 0) {
+					if (m_Head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						T* item = reinterpret_cast<T*>(&cell.storage);
+						value = std::move(*item);
+						item->~T();
+						cell.seq.store(pos + m_Mask + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0)
+					return false;
+				else
+					pos = m_Head.load(std::memory_order_relaxed);
+			}
+		}
+
+		// 放入缓冲区之后检查有没有接收方挂起, 和接收方登记之后的重试配对, 两边至少有一方能看到对方
+		void wakeReceivers() {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (WS_LIKELY(m_RecvWaiters.load() == 0))
+				return;
+			FiberWaitQueue wake;
+			{
+				Mutex::Lock lock(m_Mtx);
+				while (ChannelWaiter* waiter = frontWaiter(m_Receivers, m_RecvWaiters)) {
+					// 数据可能已经被别的接收方取走
+					if (!ringPop(*(T*)waiter->value))
+						break;
+					wake.push(popWaiter(m_Receivers, m_RecvWaiters, WAKE_OK));
+				}
+			}
+			WakeAll(wake);
+		}
+
+		// 从缓冲区取走之后检查有没有发送方挂起, 把它们的数据补进空出来的槽位
+		void wakeSenders() {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (WS_LIKELY(m_SendWaiters.load() == 0))
+				return;
+			FiberWaitQueue wake;
+			{
+				Mutex::Lock lock(m_Mtx);
+				while (ChannelWaiter* waiter = frontWaiter(m_Senders, m_SendWaiters)) {
+					if (!ringPush(*(T*)waiter->value))
+						break;
+					wake.push(popWaiter(m_Senders, m_SendWaiters, WAKE_OK));
+				}
+			}
+			WakeAll(wake);
+		}
+
+		bool pushSlow(T& value, bool block) {
+			Mutex::Lock lock(m_Mtx);
+			while (true) {
+				if (m_Closed)
+					return false;
+				// 有接收方挂起, 直接交给它
+				if (ChannelWaiter* waiter = frontWaiter(m_Receivers, m_RecvWaiters)) {
+					*(T*)waiter->value = std::move(value);
+					popWaiter(m_Receivers, m_RecvWaiters, WAKE_OK);
+					lock.unlock();
+					FiberWaitQueue::Wake(waiter);
+					return true;
+				}
+				if (ringPush(value)) {
+					lock.unlock();
+					// select的接收方只被通知过, 还要照常检查
+					wakeReceivers();
+					return true;
+				}
+				if (!block)
+					return false;
+				if (!Scheduler::getThis()) {
+					lock.unlock();
+					sched_yield();
+					lock.lock();
+					continue;
+				}
+
+				++m_SendWaiters;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (ringPush(value)) {
+					--m_SendWaiters;
+					lock.unlock();
+					wakeReceivers();
+					return true;
+				}
+				int result = park(m_Senders, &value, lock);
+				if (result == WAKE_OK)
+					return true;
+				lock.lock();
+			}
+		}
+
+		bool popSlow(T& value, bool block) {
+			Mutex::Lock lock(m_Mtx);
+			while (true) {
+				if (ringPop(value)) {
+					lock.unlock();
+					wakeSenders();
+					return true;
+				}
+				// 缓冲区空了但还有发送方挂着, 直接从它手里拿
+				if (ChannelWaiter* waiter = frontWaiter(m_Senders, m_SendWaiters)) {
+					value = std::move(*(T*)waiter->value);
+					popWaiter(m_Senders, m_SendWaiters, WAKE_OK);
+					lock.unlock();
+					FiberWaitQueue::Wake(waiter);
+					return true;
+				}
+				if (m_Closed || !block)
+					return false;
+				if (!Scheduler::getThis()) {
+					lock.unlock();
+					sched_yield();
+					lock.lock();
+					continue;
+				}
+
+				++m_RecvWaiters;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (ringPop(value)) {
+					--m_RecvWaiters;
+					lock.unlock();
+					wakeSenders();
+					return true;
+				}
+				int result = park(m_Receivers, &value, lock);
+				if (result == WAKE_OK)
+					return true;
+				// 被close唤醒, 回去把缓冲区取完
+				lock.lock();
+			}
+		}
+
+	private:
+		Cell* m_Cells = nullptr;
+		size_t m_Mask = 0;
+		alignas(64) std::atomic<size_t> m_Head{ 0 };
+		alignas(64) std::atomic<size_t> m_Tail{ 0 };
+	};
+
+	/*
+	* @brief 同时等多个通道, 哪个先能收/发就执行哪个, 类似Go的select
+	*        每个case是一次tryPop/tryPush, 全都不行时在所有通道上登记只通知的节点后挂起
+	*        被任意一个通道通知后注销全部节点再重试, 所以select不会拿走别人的数据
+	*        用法:
+	*            ChannelSelect select;
+	*            select.recv(*decoded, msg).recv(*timer, tick, &ok);
+	*            int index = select.wait();
+	*/
+	class ChannelSelect {
+	public:
+		// ok不为空时返回通道是否还开着, 为false表示通道已关闭并且取空了, 这个case也算就绪
+		template<typename T>
+		ChannelSelect& recv(Channel<T>& channel, T& value, bool* ok = nullptr) {
+			m_Cases.push_back({ &channel, false, &value, ok, &TryRecv<T> });
+			return *this;
+		}
+
+		// ok不为空时返回是否发送成功, 为false表示通道已关闭, 这个case也算就绪
+		template<typename T>
+		ChannelSelect& send(Channel<T>& channel, T& value, bool* ok = nullptr) {
+			m_Cases.push_back({ &channel, true, &value, ok, &TrySend<T> });
+			return *this;
+		}
+
+		// 阻塞直到某个case就绪, 返回它的下标(按添加顺序), 没有case时返回-1
+		int wait() { return select(true); }
+		// 不阻塞, 都没就绪时返回-1
+		int tryWait() { return select(false); }
+
+	private:
+		struct Case {
+			ChannelBase* channel;
+			bool send;
+			void* value;
+			bool* ok;
+			// 成功返回true, 不会阻塞
+			bool (*tryOp)(ChannelBase* channel, void* value);
+		};
+
+		template<typename T>
+		static bool TryRecv(ChannelBase* channel, void* value) {
+			return static_cast<Channel<T>*>(channel)->tryPop(*(T*)value);
+		}
+
+		template<typename T>
+		static bool TrySend(ChannelBase* channel, void* value) {
+			return static_cast<Channel<T>*>(channel)->tryPush(std::move(*(T*)value));
+		}
+
+		int select(bool block);
+		// 按轮转的起点把所有case试一遍, 避免总是偏向前面的通道
+		int tryAll();
+
+	private:
+		std::vector<Case> m_Cases;
+		size_t m_Next = 0;
+	};
+}
@@ -0,0 +1,163 @@
+#include "context.h"
+#include "core.h"
+
+#include <stdint.h>
+
+#if defined(__x86_64__)
+// 栈帧(低地址 -> 高地址): mxcsr/x87控制字, r15, r14, r13, r12, rbx, rbp, 返回地址
+asm(R"(
+	.text
+	.globl ws_swap_context
+	.type ws_swap_context, @function
+	.align 16
+ws_swap_context:
+	pushq %rbp
+	pushq %rbx
+	pushq %r12
+	pushq %r13
+	pushq %r14
+	pushq %r15
+	subq $8, %rsp
+	stmxcsr (%rsp)
+	fnstcw 4(%rsp)
+	movq %rsp, (%rdi)
+	movq %rsi, %rsp
+	ldmxcsr (%rsp)
+	fldcw 4(%rsp)
+	addq $8, %rsp
+	popq %r15
+	popq %r14
+	popq %r13
+	popq %r12
+	popq %rbx
+	popq %rbp
+	ret
+	.size ws_swap_context, .-ws_swap_context
+
+	.globl ws_context_entry
+	.type ws_context_entry, @function
+	.align 16
+ws_context_entry:
+	callq *%rbx
+	ud2
+	.size ws_context_entry, .-ws_context_entry
+)");
+#elif defined(__aarch64__)
+// 栈帧(低地址 -> 高地址): x19-x28, x29, x30, d8-d15
+asm(R"(
+	.text
+	.globl ws_swap_context
+	.type ws_swap_context, %function
+	.align 4
+ws_swap_context:
+	sub sp, sp, #160
+	stp x19, x20, [sp, #0]
+	stp x21, x22, [sp, #16]
+	stp x23, x24, [sp, #32]
+	stp x25, x26, [sp, #48]
+	stp x27, x28, [sp, #64]
+	stp x29, x30, [sp, #80]
+	stp d8, d9, [sp, #96]
+	stp d10, d11, [sp, #112]
+	stp d12, d13, [sp, #128]
+	stp d14, d15, [sp, #144]
+	mov x9, sp
+	str x9, [x0]
+	mov sp, x1
+	ldp x19, x20, [sp, #0]
+	ldp x21, x22, [sp, #16]
+	ldp x23, x24, [sp, #32]
+	ldp x25, x26, [sp, #48]
+	ldp x27, x28, [sp, #64]
+	ldp x29, x30, [sp, #80]
+	ldp d8, d9, [sp, #96]
+	ldp d10, d11, [sp, #112]
+	ldp d12, d13, [sp, #128]
+	ldp d14, d15, [sp, #144]
+	add sp, sp, #160
+	ret
+	.size ws_swap_context, .-ws_swap_context
+
+	.globl ws_context_entry
+	.type ws_context_entry, %function
+	.align 4
+ws_context_entry:
+	blr x19
+	brk #0
+	.size ws_context_entry, .-ws_context_entry
+)");
+#endif
+
+#if defined(__x86_64__) || defined(__aarch64__)
+extern "C" void ws_context_entry();
+
+extern "C" void* ws_make_context(void* stack, size_t size, void (*func)()) {
+	uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+	// ret进入ws_context_entry后rsp需16字节对齐, call func时才符合ABI
+	uint64_t* sp = (uint64_t*)(top - 80);
+	uint32_t* ctrl = (uint32_t*)sp;
+	ctrl[0] = 0x1F80;              // mxcsr默认值
+	ctrl[1] = 0x037F;              // x87控制字默认值
+	sp[1] = 0;                     // r15
+	sp[2] = 0;                     // r14
+	sp[3] = 0;                     // r13
+	sp[4] = 0;                     // r12
+	sp[5] = (uint64_t)func;        // rbx
+	sp[6] = 0;                     // rbp
+	sp[7] = (uint64_t)&ws_context_entry;
+#else
+	uint64_t* sp = (uint64_t*)(top - 160);
+	for (int i = 0; i < 20; i++)
+		sp[i] = 0;
+	sp[0] = (uint64_t)func;        // x19
+	sp[11] = (uint64_t)&ws_context_entry; // x30
+#endif
+	return sp;
+}
+#endif
+
+namespace WebServer {
+
+#ifdef WS_FIBER_ASM_CONTEXT
+	void InitContext(Context* ctx) {
+		ctx->sp = nullptr;
+	}
+
+	void MakeContext(Context* ctx, void* stack, size_t size, void (*func)()) {
+		ctx->sp = ws_make_context(stack, size, func);
+	}
+
+	void SwapContext(Context* from, Context* to) {
+		ws_swap_context(&from->sp, to->sp);
+	}
+
+	const char* ContextBackendName() {
+		return "asm";
+	}
+#else
+	void InitContext(Context* ctx) {
+		if (getcontext(ctx))
+			WS_ASSERT_WITHPARAM(false, "getcontext");
+	}
+
+	void MakeContext(Context* ctx, void* stack, size_t size, void (*func)()) {
+		if (getcontext(ctx))
+			WS_ASSERT_WITHPARAM(false, "getcontext");
+
+		ctx->uc_link = nullptr;
+		ctx->uc_stack.ss_sp = stack;
+		ctx->uc_stack.ss_size = size;
+		makecontext(ctx, func, 0);
+	}
+
+	void SwapContext(Context* from, Context* to) {
+		if (swapcontext(from, to))
+			WS_ASSERT_WITHPARAM(false, "swapcontext");
+	}
+
+	const char* ContextBackendName() {
+		return "ucontext";
+	}
+#endif
+}
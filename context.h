@@ -0,0 +1,38 @@
+#pragma once
+#include <stddef.h>
+#include <ucontext.h>
+
+// 协程上下文切换后端, 编译期选择:
+// x86-64/aarch64 默认使用手写汇编, 只保存callee-saved寄存器, 不经过rt_sigprocmask系统调用
+// 其他平台或定义了WS_FIBER_UCONTEXT时退回ucontext
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(WS_FIBER_UCONTEXT)
+	#define WS_FIBER_ASM_CONTEXT 1
+#endif
+
+#if defined(__x86_64__) || defined(__aarch64__)
+extern "C" {
+	// 保存当前callee-saved寄存器到当前栈上, 把栈顶写入*from, 然后切换到to指向的栈
+	void ws_swap_context(void** from, void* to);
+	// 在[stack, stack + size)上构造初始栈帧, 第一次切换进去时调用func, func不能返回
+	void* ws_make_context(void* stack, size_t size, void (*func)());
+}
+#endif
+
+namespace WebServer {
+
+#ifdef WS_FIBER_ASM_CONTEXT
+	struct Context {
+		void* sp = nullptr;
+	};
+#else
+	typedef ucontext_t Context;
+#endif
+
+	// 主协程使用, 不需要栈
+	void InitContext(Context* ctx);
+	void MakeContext(Context* ctx, void* stack, size_t size, void (*func)());
+	void SwapContext(Context* from, Context* to);
+
+	// 当前编译使用的后端名字, "asm" 或 "ucontext"
+	const char* ContextBackendName();
+}
@@ -1,35 +1,34 @@
 #include "fdmanager.h"
+#include "fiber.h"
 #include "hook.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 namespace WebServer {
-	
+
 	FdManager::FdManager() {
-		m_Datas.resize(64);
 	}
 
-	FdContext::FdContext(int fd)
-		:m_IsInit(false), m_IsSocket(false), m_SysNonblock(false), m_UserNonblock(false),
-		 m_IsClose(false), m_Fd(fd), m_ReceiveTimeout(-1), m_SendTimeout(-1)
+	FdManager::~FdManager() {
+	}
+
+	FdContext::FdContext(int fd_)
+		: fd(fd_)
 	{
-		init();
 	}
 
 	FdContext::~FdContext() {
 
 	}
 
+	// 每次登记都重新检查, 同一个fd号上一次可能是别的类型
 	bool FdContext::init() {
-		if (m_IsInit)
-			return true;
-
 		m_ReceiveTimeout = -1;
 		m_SendTimeout = -1;
-		
+
 		struct stat fdState;
-		if (fstat(m_Fd, &fdState)) {
+		if (fstat(fd, &fdState)) {
 			m_IsInit = false;
 			m_IsSocket = false;
 		}
@@ -39,9 +38,9 @@ namespace WebServer {
 		}
 
 		if (m_IsSocket) {
-			int flags = fcntl_f(m_Fd, F_GETFL, 0);
+			int flags = fcntl_f(fd, F_GETFL, 0);
 			if (!(flags & O_NONBLOCK))
-				fcntl_f(m_Fd, F_SETFL, flags | O_NONBLOCK);
+				fcntl_f(fd, F_SETFL, flags | O_NONBLOCK);
 			m_SysNonblock = true;
 		}
 		else {
@@ -68,33 +67,30 @@ namespace WebServer {
 	}
 
 	FdContext::fdContextptr FdManager::get(int fd, bool autoCreate) {
-		if (fd == -1)
+		FdContext* context = autoCreate ? m_Contexts.getOrCreate(fd) : m_Contexts.get(fd);
+		if (!context)
+			return nullptr;
+		if (context->m_IsRegistered.load(std::memory_order_acquire))
+			return context;
+		if (!autoCreate)
 			return nullptr;
-		RWMutexType::ReadLock lock(m_Mtx);
-		if ((int)m_Datas.size() <= fd) {
-			if (!autoCreate)
-				return nullptr;
-		}
-		else {
-			if (m_Datas[fd] || !autoCreate)
-				return m_Datas[fd];
-		}
-
-		lock.unlock();
 
-		RWMutexType::WriteLock lock2(m_Mtx);
-		FdContext::fdContextptr context(new FdContext(fd));
-		if (fd >= (int)m_Datas.size())
-			m_Datas.resize(fd * 1.5);
-		m_Datas[fd] = context;
+		FdContext::MutexType::Lock lock(context->mtx);
+		if (!context->m_IsRegistered.load(std::memory_order_relaxed)) {
+			context->init();
+			context->m_IsRegistered.store(true, std::memory_order_release);
+		}
 		return context;
 	}
 
 	void FdManager::del(int fd) {
-		RWMutexType::WriteLock lock(m_Mtx);
-		if ((int)m_Datas.size() <= fd)
+		FdContext* context = m_Contexts.get(fd);
+		if (!context)
 			return;
-		m_Datas[fd].reset();
+		FdContext::MutexType::Lock lock(context->mtx);
+		context->m_IsRegistered.store(false, std::memory_order_release);
+		context->m_IsInit = false;
+		context->m_IsSocket = false;
 	}
 
-}
\ No newline at end of file
+}
@@ -1,56 +1,115 @@
 #pragma once
+#include <atomic>
 #include <memory>
-#include <vector>
+#include <stdint.h>
+#include "fdtable.h"
 #include "mutex.h"
 #include "singleton.h"
+#include "task.h"
 
 namespace WebServer {
 
-	class FdContext : public std::enable_shared_from_this<FdContext> {
+	class Scheduler;
+	class Fiber;
+	struct IORequest;
+
+	/*
+	* @brief 每个fd一条记录, hook用的socket标志、超时和IOManager的事件上下文放在一起
+	*        记录放在FdManager的分段表里, 地址在进程生命周期内不变, 查找不加锁也不用引用计数
+	*        close之后记录只是被重置, fd号被复用时接着用
+	*        同一时刻一个fd只能在一个IOManager上等待事件
+	*/
+	class alignas(64) FdContext {
+	friend class FdManager;
 	public:
-		typedef std::shared_ptr<FdContext> fdContextptr;
-		FdContext(int fd);
+		typedef FdContext* fdContextptr;
+		typedef Mutex MutexType;
+
+		struct EventContext {
+			Scheduler* scheduler = nullptr;
+			// 挂起的协程指定在哪个线程执行, 事件触发时投回这个线程
+			int thread = -1;
+			std::shared_ptr<Fiber> fiber;
+			Task func;
+			// io_uring后端: poll请求的序号, 过期的CQE靠它识别
+			uint16_t seq = 0;
+			// io_uring后端: 正在进行中的完成式请求
+			IORequest* request = nullptr;
+		};
+
+		FdContext(int fd_);
 		~FdContext();
 
 		bool isInit() const { return m_IsInit; }
 		bool isSocked() const { return m_IsSocket; }
 		bool isClose() const { return m_IsClose; }
-		
+
 		void setUserNonblock(bool isBlock) { m_UserNonblock = isBlock; }
 		bool getUserNonblock() const { return m_UserNonblock; }
 
 		void setSysNonblock(bool isBlock) { m_SysNonblock = isBlock; }
 		bool getSysNonblock() { return m_SysNonblock; }
-		
-		// type: ʱ/дʱ
+
+		// type: 读超时/写超时
 		void setTimeout(int type, uint64_t time);
 		uint64_t getTimeout(int type);
+
+		// 以下由IOManager使用, 调用时要持有mtx, 实现在iomanager.cpp
+		EventContext& getContext(int event);
+		void resetContext(EventContext& context);
+		void triggerEvent(int event);
+
 	private:
 		bool init();
 	private:
-		bool m_IsInit;
-		bool m_IsSocket;
-		bool m_IsClose;
-		bool m_UserNonblock;
-		bool m_SysNonblock;
+		bool m_IsInit = false;
+		bool m_IsSocket = false;
+		bool m_IsClose = false;
+		bool m_UserNonblock = false;
+		bool m_SysNonblock = false;
+		// 是否被hook登记过(socket/accept创建), 没登记的fd hook直接透传
+		std::atomic<bool> m_IsRegistered{ false };
 
-		int m_Fd;
+		uint64_t m_ReceiveTimeout = -1;
+		uint64_t m_SendTimeout = -1;
 
-		uint64_t m_ReceiveTimeout;
-		uint64_t m_SendTimeout;
+	public:
+		/// 读事件上下文
+		EventContext read;
+		/// 写事件上下文
+		EventContext write;
+		/// 错误队列事件上下文
+		EventContext error;
+		/// 事件关联的句柄
+		int fd = 0;
+		/// 当前的事件, IOManager::Event的组合
+		int events = 0;
+		/// 事件的Mutex
+		MutexType mtx;
 	};
 
 	class FdManager {
 	public:
-		typedef RWMutex RWMutexType;
 		FdManager();
+		~FdManager();
+
+		/*
+		* @brief hook用: 取登记过的fd记录
+		* @param[in] autoCreate 没有登记时是否登记(检查是不是socket, 是socket就设为非阻塞)
+		* @return 没有登记且autoCreate为false, 或者fd超出范围时返回nullptr
+		*/
 		FdContext::fdContextptr get(int fd, bool autoCreate = false);
 
+		// IOManager用: 不管有没有登记, 取fd的记录, autoCreate为false且记录所在的段还没分配时返回nullptr
+		FdContext* getRecord(int fd, bool autoCreate) {
+			return autoCreate ? m_Contexts.getOrCreate(fd) : m_Contexts.get(fd);
+		}
+
+		// close时注销, 记录本身保留
 		void del(int fd);
 	private:
-		RWMutexType m_Mtx;
-		std::vector<FdContext::fdContextptr> m_Datas;
+		FdTable<FdContext> m_Contexts;
 	};
 
 	typedef Singleton<FdManager> FdMgr;
-}
\ No newline at end of file
+}
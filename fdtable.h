@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace WebServer {
+
+	/*
+	* @brief 按fd下标的分段表, 查找不加锁, 扩容不搬迁
+	*        一级是固定大小的段指针数组, 每段连续存放SEGMENT_SIZE个T, 第一次用到某段时才分配
+	*        元素地址在表的生命周期内不变, 扩容时不会阻塞正在查找的线程
+	*        T需要有T(int fd)构造函数, 需要避免相邻fd伪共享时把T声明为alignas(64)
+	*/
+	template<typename T, int SEGMENT_BITS = 8, int MAX_FD_BITS = 20>
+	class FdTable {
+	public:
+		static const int SEGMENT_SIZE = 1 << SEGMENT_BITS;
+		static const int SEGMENT_COUNT = 1 << (MAX_FD_BITS - SEGMENT_BITS);
+		static const int MAX_FD = 1 << MAX_FD_BITS;
+
+		FdTable() {
+			for (auto& i : m_Segments)
+				i.store(nullptr, std::memory_order_relaxed);
+		}
+
+		~FdTable() {
+			for (auto& i : m_Segments) {
+				T* segment = i.load(std::memory_order_relaxed);
+				if (segment)
+					FreeSegment(segment);
+			}
+		}
+
+		FdTable(const FdTable&) = delete;
+		FdTable& operator=(const FdTable&) = delete;
+
+		// fd所在的段还没分配时返回nullptr
+		T* get(int fd) const {
+			if ((unsigned)fd >= (unsigned)MAX_FD)
+				return nullptr;
+			T* segment = m_Segments[fd >> SEGMENT_BITS].load(std::memory_order_acquire);
+			return segment ? &segment[fd & (SEGMENT_SIZE - 1)] : nullptr;
+		}
+
+		// 段不存在时分配一整段, 多个线程同时分配时只有一个成功, 其余的释放掉自己的
+		T* getOrCreate(int fd) {
+			if ((unsigned)fd >= (unsigned)MAX_FD)
+				return nullptr;
+			std::atomic<T*>& slot = m_Segments[fd >> SEGMENT_BITS];
+			T* segment = slot.load(std::memory_order_acquire);
+			if (!segment) {
+				T* created = AllocSegment(fd & ~(SEGMENT_SIZE - 1));
+				if (slot.compare_exchange_strong(segment, created, std::memory_order_acq_rel, std::memory_order_acquire))
+					segment = created;
+				else
+					FreeSegment(created);
+			}
+			return &segment[fd & (SEGMENT_SIZE - 1)];
+		}
+
+		// 遍历所有已经分配的元素
+		template<typename Func>
+		void foreach(Func func) {
+			for (auto& i : m_Segments) {
+				T* segment = i.load(std::memory_order_acquire);
+				if (!segment)
+					continue;
+				for (int j = 0; j < SEGMENT_SIZE; j++)
+					func(segment[j]);
+			}
+		}
+
+	private:
+		static T* AllocSegment(int base) {
+			T* segment = (T*)::operator new(sizeof(T) * SEGMENT_SIZE, std::align_val_t(alignof(T)));
+			for (int i = 0; i < SEGMENT_SIZE; i++)
+				new (&segment[i]) T(base + i);
+			return segment;
+		}
+
+		static void FreeSegment(T* segment) {
+			for (int i = 0; i < SEGMENT_SIZE; i++)
+				segment[i].~T();
+			::operator delete(segment, std::align_val_t(alignof(T)));
+		}
+
+	private:
+		std::atomic<T*> m_Segments[SEGMENT_COUNT];
+	};
+}
@@ -1,66 +1,69 @@
 #include "core.h"
 #include "fiber.h"
+#include "log.h"
 #include "scheduler.h"
+#include "stackallocator.h"
 #include "utils.h"
 
 #include <atomic>
+#include <vector>
 
 namespace WebServer {
 
-	static size_t s_StackSize = 10000;
+	static size_t s_StackSize = 128 * 1024;
 	static std::atomic<uint64_t> s_FiberId{0};
 	static std::atomic<uint64_t> s_FiberCount{0};
 
 	static thread_local Fiber* s_Fiber = nullptr;
 	static thread_local Fiber::fiberPtr s_ThreadFiber = nullptr;
 
-	class MallocStackAllocator {
-	public:
-		static void* Alloc(size_t size) {
-			return malloc(size);
-		}
+	// 每个线程最多缓存的空闲协程数, 每个都带着一个默认大小的栈, 常驻内存只有栈上用过的页
+	static std::atomic<size_t> s_MaxCachedFibers{ 1024 };
 
-		static void Dealloc(void* ptr, size_t size) {
-			return free(ptr);
+	struct FiberFreeList {
+		~FiberFreeList() {
+			destroyed = true;
+			fibers.clear();
 		}
+
+		std::vector<Fiber::fiberPtr> fibers;
+		static thread_local bool destroyed;
 	};
 
-	using StackAllocator = MallocStackAllocator;
+	thread_local bool FiberFreeList::destroyed = false;
+	static thread_local FiberFreeList t_FiberFreeList;
+
+	// 日志里记录当前协程id
+	static struct FiberLogInit {
+		FiberLogInit() { Logger::SetFiberIdGetter(&Fiber::GetFiberId); }
+	} s_FiberLogInit;
 
 	Fiber::Fiber() {
 		m_State = EXEC;
 		setThis(this);
 
-		// ̵߳,㵽ʱл߳,ûöջ,ظʱӦǻص̵߳Fiberĵط
-		// ʹcallerǻᵥһջ,ΪЭ̷صĵط
-		if (getcontext(&m_Context))
-			WS_ASSERT_WITHPARAM(false, "m_Context");
+		// 获得线程的上下文,方便到时候切换到该线程上,这里没有设置堆栈,返回该上下文时应该是回到了线程调用Fiber的地方
+		// 而如果使用caller则是会单独开一个堆栈,作为各个协程返回的地方
+		InitContext(&m_Context);
 
 		++s_FiberCount;
-		printf("Thread %d: Fiber::Fiber main\n", GetThreadId());
+		WS_LOG_DEBUG("Fiber::Fiber main");
 	}
 
-	Fiber::Fiber(std::function<void()> func, size_t stackSize, bool useCaller) 
-		: m_Func(func), m_Id(++s_FiberId)
+	Fiber::Fiber(Task func, size_t stackSize, bool useCaller) 
+		: m_Func(std::move(func)), m_Id(++s_FiberId)
 	{
 		++s_FiberCount;
 		// TODO: set value by config
 		m_StackSize = stackSize ? stackSize : s_StackSize;
 
 		m_Stack = StackAllocator::Alloc(m_StackSize);
-		if(getcontext(&m_Context))
-			WS_ASSERT_WITHPARAM(false, "m_Context");
-
-		m_Context.uc_link = nullptr;
-		m_Context.uc_stack.ss_sp = m_Stack;
-		m_Context.uc_stack.ss_size = m_StackSize;
-
 		if (!useCaller)
-			makecontext(&m_Context, &Fiber::MainFunc, 0);
+			MakeContext(&m_Context, m_Stack, m_StackSize, &Fiber::MainFunc);
 		else
-			makecontext(&m_Context, &Fiber::CallerMainFunc, 0);
+			MakeContext(&m_Context, m_Stack, m_StackSize, &Fiber::CallerMainFunc);
 
-		printf("Fiber::Fiber id=%d \n", m_Id);
+		WS_LOG_DEBUG("Fiber::Fiber id={}", m_Id);
 	}
 
 	Fiber::~Fiber() {
@@ -76,63 +79,89 @@ namespace WebServer {
 			if (cur == this)
 				setThis(nullptr);
 		}
-		printf("Fiber::~Fiber id=%d, total=%d \n", m_Id, s_FiberCount.load());
+		WS_LOG_DEBUG("Fiber::~Fiber id={} total={}", m_Id, s_FiberCount.load());
 	}
 
-	void Fiber::reset(std::function<void()> func) {
+	void Fiber::reset(Task func) {
 		WS_ASSERT(m_Stack);
 		WS_ASSERT(m_State == TERM || m_State == EXCEPT || m_State == INIT);
-		m_Func = func;
-		if (getcontext(&m_Context))
-			WS_ASSERT_WITHPARAM(false, "getcontext");
+		m_Func = std::move(func);
+		MakeContext(&m_Context, m_Stack, m_StackSize, &Fiber::MainFunc);
+		m_State = INIT;
+	}
 
-		m_Context.uc_link = nullptr;
-		m_Context.uc_stack.ss_sp = m_Stack;
-		m_Context.uc_stack.ss_size = m_StackSize;
+	Fiber::fiberPtr Fiber::Create(Task func) {
+		if (!FiberFreeList::destroyed) {
+			auto& fibers = t_FiberFreeList.fibers;
+			if (!fibers.empty()) {
+				Fiber::fiberPtr fiber = std::move(fibers.back());
+				fibers.pop_back();
+				fiber->reset(std::move(func));
+				return fiber;
+			}
+		}
+		Fiber::fiberPtr fiber = std::make_shared<Fiber>(std::move(func));
+		fiber->m_Recyclable = true;
+		return fiber;
+	}
 
-		makecontext(&m_Context, &Fiber::MainFunc, 0);
-		m_State = INIT;
+	bool Fiber::Recycle(Fiber::fiberPtr& fiber) {
+		// 协程可能在别的线程上结束, 放进当前线程的链表, 之后由当前线程复用
+		if (!fiber->m_Recyclable || fiber->m_State != TERM || fiber.use_count() != 1)
+			return false;
+		if (FiberFreeList::destroyed || t_FiberFreeList.fibers.size() >= s_MaxCachedFibers)
+			return false;
+		t_FiberFreeList.fibers.push_back(std::move(fiber));
+		return true;
+	}
+
+	void Fiber::SetMaxCachedFibers(size_t count) {
+		s_MaxCachedFibers = count;
+	}
+
+	size_t Fiber::GetMaxCachedFibers() {
+		return s_MaxCachedFibers;
+	}
+
+	size_t Fiber::GetCachedFibers() {
+		return FiberFreeList::destroyed ? 0 : t_FiberFreeList.fibers.size();
 	}
 
 	void Fiber::swapIn() {
 		setThis(this);
 		WS_ASSERT(m_State != EXEC);
 		m_State = EXEC;
-		if (swapcontext(&(Scheduler::GetMainFiber()->m_Context), &m_Context)) {
-			WS_ASSERT_WITHPARAM(false, "swapcontext");
-		}
+		SwapContext(&(Scheduler::GetMainFiber()->m_Context), &m_Context);
 	}
 	
 	void Fiber::swapOut() {
 		setThis(Scheduler::GetMainFiber());
-		if (swapcontext(&m_Context, &(Scheduler::GetMainFiber()->m_Context)))
-			WS_ASSERT_WITHPARAM(false, "swapcontext");
+		SwapContext(&m_Context, &(Scheduler::GetMainFiber()->m_Context));
 	}
 
 	void Fiber::call() {
 		setThis(this);
 		m_State = EXEC;
-		if (swapcontext(&s_ThreadFiber->m_Context, &m_Context))
-			WS_ASSERT_WITHPARAM(false, "swapcontext");
+		SwapContext(&s_ThreadFiber->m_Context, &m_Context);
 	}
 
 	void Fiber::back() {
 		setThis(s_ThreadFiber.get());
-		if (swapcontext(&m_Context, &s_ThreadFiber->m_Context)) {
-			WS_ASSERT_WITHPARAM(false, "swapcontext");
-		}
+		SwapContext(&m_Context, &s_ThreadFiber->m_Context);
 	}
 		
+	// 切出后由调度器重新放回队列
 	void Fiber::YieldToReady() {
 		Fiber::fiberPtr cur = getThis();
 		WS_ASSERT(cur->getState() == EXEC);
+		cur->m_State = READY;
 		cur->swapOut();
 	}
 
+	// 切出后置为HOLD, 需要别人(事件/定时器)重新schedule
 	void Fiber::YieldToHold() {
 		Fiber::fiberPtr cur = getThis();
 		WS_ASSERT(cur->getState() == EXEC);
-		cur->m_State = READY;
 		cur->swapOut();
 	}
 
@@ -146,17 +175,21 @@ namespace WebServer {
 		}
 		
 		Fiber::fiberPtr mainFiber(new Fiber);
-		// new FiberлὫs_FiberΪmainFiber
+		// new Fiber中会将s_Fiber置为mainFiber
 		WS_ASSERT((s_Fiber == mainFiber.get()));
 		s_ThreadFiber = mainFiber;
 		return s_Fiber->shared_from_this();
 	}
 
+	uint64_t Fiber::GetFiberId() {
+		return s_Fiber ? s_Fiber->m_Id : 0;
+	}
+
 	uint64_t Fiber::TotalFiber() {
 		return s_FiberCount;
 	}
 
-	// MainFuncһ̬,κһFiberʵ,MainFunʹgetThis൱ҵǰĸFiberõt_Fiber
+	// MainFunc是一个静态函数,他不属于任何一个Fiber实体,因此在MainFun里面使用getThis相当于在找当前是哪个Fiber被设置到了t_Fiber上
 	void Fiber::MainFunc() {
 		Fiber::fiberPtr cur = getThis();
 		WS_ASSERT(cur);
@@ -168,19 +201,20 @@ namespace WebServer {
 		}
 		catch(std::exception& except) {
 			cur->m_State = EXCEPT;
-			std::cout << "Fiber Except: " << "fiber_id=" << cur->getId() << std::endl;
+			WS_LOG_ERROR("Fiber Except: fiber_id={} what={}", cur->getId(), except.what());
+			Logger::Flush();
 			WS_ASSERT(false);
 		}
 		catch (...) {
 			cur->m_State = EXCEPT;
-			std::cout << "Fiber Except: " << "fiber_id=" << cur->getId() << std::endl;
+			WS_LOG_ERROR("Fiber Except: fiber_id={}", cur->getId());
 		}
 
 		auto ptr = cur.get();
-		cur.reset(); // ͷcur,൱ڽptrcur,ǲ˵ͷָָڴռ,ֻǽָĶ߳ȥ
+		cur.reset(); // 释放cur,相当于解绑ptr和cur,但是并不是说释放了指针指向的内存空间,只是将智能指针管理的东西给踢出去了
 		ptr->swapOut();
 
-		// ܵط,swapOutûгɹ˳
+		// 不能到这个地方,否则表明swapOut没有成功退出
 		WS_ASSERT_WITHPARAM(false, "never reach fiber_id=" + std::to_string(ptr->getId()) + " (do not reset this fiber)");
 	}
 
@@ -194,19 +228,20 @@ namespace WebServer {
 		}
 		catch (std::exception& except) {
 			cur->m_State = EXCEPT;
-			std::cout << "Fiber Except: " << "fiber_id=" << cur->getId() << std::endl;
+			WS_LOG_ERROR("Fiber Except: fiber_id={} what={}", cur->getId(), except.what());
+			Logger::Flush();
 			WS_ASSERT(false);
 		}
 		catch (...) {
 			cur->m_State = EXCEPT;
-			std::cout << "Fiber Except: " << "fiber_id=" << cur->getId() << std::endl;
+			WS_LOG_ERROR("Fiber Except: fiber_id={}", cur->getId());
 		}
 
 		auto ptr = cur.get();
 		cur.reset();
 		ptr->back();
 
-		// ܵط,swapOutûгɹ˳
+		// 不能到这个地方,否则表明swapOut没有成功退出
 		WS_ASSERT_WITHPARAM(false, "never reach fiber_id=" + std::to_string(ptr->getId()));
 	}
 
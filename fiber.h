@@ -1,7 +1,8 @@
 #pragma once
+#include <atomic>
 #include <memory>
-#include <functional>
-#include <ucontext.h>
+#include "context.h"
+#include "task.h"
 
 namespace WebServer {
 	
@@ -13,23 +14,40 @@ namespace WebServer {
 		typedef std::shared_ptr<Fiber> fiberPtr;
 
 		enum State {
-			INIT,    // ʼ״̬
-			HOLD,    // ͣ״̬
-			EXEC,    // ״̬
-			TERM,    // ״̬
-			READY,   // ִ״̬
-			EXCEPT   // 쳣״̬
+			INIT,    // 初始化状态
+			HOLD,    // 暂停状态
+			EXEC,    // 运行状态
+			TERM,    // 结束状态
+			READY,   // 可执行状态
+			EXCEPT   // 异常状态
 		};
 
 	private:
-		// Э
+		// 主协程
 		Fiber();
 
 	public:
-		Fiber(std::function<void()> func, size_t stackSize = 0, bool useCaller = false);
+		Fiber(Task func, size_t stackSize = 0, bool useCaller = false);
 		~Fiber();
 		
-		void reset(std::function<void()> func);
+		void reset(Task func);
+
+		/*
+		* @brief 创建一个默认栈大小的协程, 先从本线程的空闲协程里取, 取到的用reset重新设置入口
+		*        没有空闲协程时新建, 对象和shared_ptr的控制块一次分配
+		*/
+		static Fiber::fiberPtr Create(Task func);
+		/*
+		* @brief 已经结束的协程放回本线程的空闲链表, 成功时fiber被置空
+		*        只回收Create创建的协程, 并且调用方必须持有最后一个引用
+		*/
+		static bool Recycle(Fiber::fiberPtr& fiber);
+
+		// 设置每个线程最多缓存多少个空闲协程, 0表示不缓存; 已经缓存的不受影响
+		static void SetMaxCachedFibers(size_t count);
+		static size_t GetMaxCachedFibers();
+		// 当前线程缓存的空闲协程数
+		static size_t GetCachedFibers();
 		
 		void swapIn();
 		void swapOut();
@@ -38,14 +56,23 @@ namespace WebServer {
 		void back();
 
 		uint64_t getId() const { return m_Id; }
-		State getState() const { return m_State; }
+		State getState() const { return m_State.load(std::memory_order_acquire); }
 
 	public:
 		static void setThis(Fiber* ptr);
 		static Fiber::fiberPtr getThis();
+		// 当前协程的id, 不创建主协程, 不在协程里时返回0
+		static uint64_t GetFiberId();
 
 		static void YieldToReady();
 		static void YieldToHold();
+		/*
+		* @brief 当前协程睡眠us微秒, 期间工作线程可以执行其他协程
+		*        挂在当前IOManager的时间轮上, 到期直接重新调度, 精度1ms
+		*        不在IOManager线程上时退化为阻塞线程的nanosleep
+		*        需要定时器, 实现放在iomanager.cpp
+		*/
+		static void sleepFor(uint64_t us);
 
 		static void MainFunc();
 		static void CallerMainFunc();
@@ -55,10 +82,13 @@ namespace WebServer {
 	private:
 		uint64_t m_Id = 0;
 		uint32_t m_StackSize = 0;
-		State m_State = INIT;
+		// 协程可能在一个线程上切出的同时被另一个线程的调度器取到, 调度器在切出完成后用release写HOLD, 读用acquire
+		std::atomic<State> m_State{ INIT };
 
-		ucontext_t m_Context;
+		Context m_Context;
 		void* m_Stack = nullptr;
-		std::function<void()> m_Func;
+		Task m_Func;
+		// 由Create创建, 结束后可以放回空闲链表
+		bool m_Recyclable = false;
 	};
 }
\ No newline at end of file
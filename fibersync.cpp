@@ -0,0 +1,224 @@
+#include "fibersync.h"
+#include "scheduler.h"
+
+#include <sched.h>
+
+namespace WebServer {
+
+	void FiberWaitQueue::park(FiberWaiter& waiter, Mutex::Lock& lock) {
+		waiter.scheduler = Scheduler::getThis();
+		waiter.fiber = Fiber::getThis();
+		push(&waiter);
+		lock.unlock();
+		Fiber::YieldToHold();
+	}
+
+	void FiberWaitQueue::Wake(FiberWaiter* waiter) {
+		Scheduler* scheduler = waiter->scheduler;
+		Fiber::fiberPtr fiber;
+		fiber.swap(waiter->fiber);
+		scheduler->schedule(&fiber);
+	}
+
+	void FiberMutex::lockSlow() {
+		// 不在调度器里没法挂起, 只能自旋等锁空出来
+		if (!Scheduler::getThis()) {
+			while (!tryLock())
+				sched_yield();
+			return;
+		}
+
+		Mutex::Lock lock(m_Mtx);
+		int state = m_State.load();
+		while (true) {
+			// 队列里没人时才能直接拿锁, 否则排到后面
+			if (state == UNLOCKED && m_Waiters.empty()) {
+				if (m_State.compare_exchange_weak(state, LOCKED, std::memory_order_acquire))
+					return;
+				continue;
+			}
+			// 标记为CONTENDED之后持有者解锁必然走慢路径, 不会错过唤醒
+			if (state == CONTENDED || m_State.compare_exchange_weak(state, CONTENDED))
+				break;
+		}
+		FiberWaiter waiter;
+		m_Waiters.park(waiter, lock);
+		// 被唤醒时锁已经交到了这个协程手上
+	}
+
+	void FiberMutex::unlockSlow() {
+		Mutex::Lock lock(m_Mtx);
+		FiberWaiter* waiter = m_Waiters.pop();
+		if (!waiter) {
+			m_State.store(UNLOCKED, std::memory_order_release);
+			return;
+		}
+		// 锁不释放, 直接交给队首的协程
+		m_State.store(m_Waiters.empty() ? LOCKED : CONTENDED);
+		lock.unlock();
+		FiberWaitQueue::Wake(waiter);
+	}
+
+	void FiberCondVar::wait(FiberMutex& mutex) {
+		if (!Scheduler::getThis()) {
+			// 没法挂起, 放开锁让一次CPU, 由调用方的循环重新检查条件
+			mutex.unlock();
+			sched_yield();
+			mutex.lock();
+			return;
+		}
+
+		Mutex::Lock lock(m_Mtx);
+		++m_WaiterCount;
+		FiberWaiter waiter;
+		// 先入队再放开mutex, 之后的notify一定能看到这个协程
+		waiter.scheduler = Scheduler::getThis();
+		waiter.fiber = Fiber::getThis();
+		m_Waiters.push(&waiter);
+		lock.unlock();
+		mutex.unlock();
+		Fiber::YieldToHold();
+		mutex.lock();
+	}
+
+	void FiberCondVar::notifyOne() {
+		if (m_WaiterCount.load() == 0)
+			return;
+		Mutex::Lock lock(m_Mtx);
+		FiberWaiter* waiter = m_Waiters.pop();
+		if (!waiter)
+			return;
+		--m_WaiterCount;
+		lock.unlock();
+		FiberWaitQueue::Wake(waiter);
+	}
+
+	void FiberCondVar::notifyAll() {
+		if (m_WaiterCount.load() == 0)
+			return;
+		Mutex::Lock lock(m_Mtx);
+		FiberWaitQueue waiters = m_Waiters;
+		m_Waiters = FiberWaitQueue();
+		m_WaiterCount = 0;
+		lock.unlock();
+		// 先取next再唤醒, 唤醒之后节点可能已经不在了
+		FiberWaiter* waiter = waiters.pop();
+		while (waiter) {
+			FiberWaiter* next = waiters.pop();
+			FiberWaitQueue::Wake(waiter);
+			waiter = next;
+		}
+	}
+
+	void FiberSemaphore::waitSlow() {
+		if (!Scheduler::getThis()) {
+			while (!tryWait())
+				sched_yield();
+			return;
+		}
+
+		Mutex::Lock lock(m_Mtx);
+		// 先登记再检查许可, 和notify里先加许可再检查等待数配对, 两边至少有一方能看到对方
+		// tryWait里是relaxed读, 登记和读许可之间要一个seq_cst屏障, 否则弱内存序的平台上可能两边都看到旧值
+		++m_WaiterCount;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (tryWait()) {
+			--m_WaiterCount;
+			return;
+		}
+		FiberWaiter waiter;
+		m_Waiters.park(waiter, lock);
+		// 被唤醒时许可已经交到了这个协程手上
+	}
+
+	void FiberSemaphore::notifySlow() {
+		Mutex::Lock lock(m_Mtx);
+		if (m_Waiters.empty() || !tryWait())
+			return;
+		FiberWaiter* waiter = m_Waiters.pop();
+		--m_WaiterCount;
+		lock.unlock();
+		FiberWaitQueue::Wake(waiter);
+	}
+
+	void FiberRWMutex::rdlockSlow() {
+		if (!Scheduler::getThis()) {
+			while (true) {
+				uint32_t state = m_State.load(std::memory_order_relaxed);
+				if (!(state & (WRITER | WAITING)) && m_State.compare_exchange_weak(state, state + 1, std::memory_order_acquire))
+					return;
+				sched_yield();
+			}
+		}
+
+		Mutex::Lock lock(m_Mtx);
+		uint32_t state = m_State.load();
+		while (true) {
+			if (!(state & WRITER) && m_Waiters.empty()) {
+				if (m_State.compare_exchange_weak(state, state + 1, std::memory_order_acquire))
+					return;
+				continue;
+			}
+			if ((state & WAITING) || m_State.compare_exchange_weak(state, state | WAITING))
+				break;
+		}
+		FiberWaiter waiter;
+		waiter.writer = false;
+		m_Waiters.park(waiter, lock);
+	}
+
+	void FiberRWMutex::wrlockSlow() {
+		if (!Scheduler::getThis()) {
+			while (true) {
+				uint32_t expected = 0;
+				if (m_State.compare_exchange_weak(expected, WRITER, std::memory_order_acquire))
+					return;
+				sched_yield();
+			}
+		}
+
+		Mutex::Lock lock(m_Mtx);
+		uint32_t state = m_State.load();
+		while (true) {
+			if ((state & ~WAITING) == 0 && m_Waiters.empty()) {
+				if (m_State.compare_exchange_weak(state, WRITER, std::memory_order_acquire))
+					return;
+				continue;
+			}
+			if ((state & WAITING) || m_State.compare_exchange_weak(state, state | WAITING))
+				break;
+		}
+		FiberWaiter waiter;
+		waiter.writer = true;
+		m_Waiters.park(waiter, lock);
+	}
+
+	void FiberRWMutex::unlockSlow() {
+		Mutex::Lock lock(m_Mtx);
+		// 走到这里时状态是WRITER|WAITING(写者解锁)或者WAITING(最后一个读者解锁)
+		// 有WAITING时快路径都进不来, 慢路径又要先拿m_Mtx, 所以状态不会再变
+		FiberWaitQueue wake;
+		uint32_t state = 0;
+		if (!m_Waiters.empty() && m_Waiters.front()->writer) {
+			wake.push(m_Waiters.pop());
+			state = WRITER;
+		}
+		else {
+			while (!m_Waiters.empty() && !m_Waiters.front()->writer) {
+				wake.push(m_Waiters.pop());
+				++state;
+			}
+		}
+		if (!m_Waiters.empty())
+			state |= WAITING;
+		m_State.store(state, std::memory_order_release);
+		lock.unlock();
+
+		FiberWaiter* waiter = wake.pop();
+		while (waiter) {
+			FiberWaiter* next = wake.pop();
+			FiberWaitQueue::Wake(waiter);
+			waiter = next;
+		}
+	}
+}
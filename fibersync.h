@@ -0,0 +1,256 @@
+#pragma once
+#include "core.h"
+#include "fiber.h"
+#include "mutex.h"
+
+#include <atomic>
+#include <stdint.h>
+
+namespace WebServer {
+
+	class Scheduler;
+	class FiberCondVar;
+
+	// 挂起在同步对象上的协程, 节点放在等待协程自己的栈上, 入队不分配内存
+	struct FiberWaiter {
+		Scheduler* scheduler = nullptr;
+		Fiber::fiberPtr fiber;
+		FiberWaiter* next = nullptr;
+		// FiberRWMutex用: 等的是写锁
+		bool writer = false;
+	};
+
+	// 先进先出的等待队列, 由所属同步对象的内部锁保护
+	class FiberWaitQueue {
+	public:
+		bool empty() const { return !m_Head; }
+		FiberWaiter* front() const { return m_Head; }
+
+		void push(FiberWaiter* waiter) {
+			waiter->next = nullptr;
+			if (m_Tail)
+				m_Tail->next = waiter;
+			else
+				m_Head = waiter;
+			m_Tail = waiter;
+		}
+
+		FiberWaiter* pop() {
+			FiberWaiter* waiter = m_Head;
+			if (waiter) {
+				m_Head = waiter->next;
+				if (!m_Head)
+					m_Tail = nullptr;
+			}
+			return waiter;
+		}
+
+		// 从队列中间摘掉一个节点, 不在队列里返回false
+		bool remove(FiberWaiter* waiter) {
+			FiberWaiter* prev = nullptr;
+			for (FiberWaiter* i = m_Head; i; prev = i, i = i->next) {
+				if (i != waiter)
+					continue;
+				if (prev)
+					prev->next = i->next;
+				else
+					m_Head = i->next;
+				if (m_Tail == i)
+					m_Tail = prev;
+				return true;
+			}
+			return false;
+		}
+
+		/*
+		* @brief 把当前协程放进队列, 解开lock后挂起, 被Wake重新调度后返回
+		*        解锁和挂起之间被唤醒也没关系, 调度器会等协程切出去之后再执行它
+		*/
+		void park(FiberWaiter& waiter, Mutex::Lock& lock);
+
+		/*
+		* @brief 重新调度出队的协程, 可以在内部锁外调用
+		*        调用之后等待协程随时可能返回, 节点在它的栈上, 不能再访问
+		*/
+		static void Wake(FiberWaiter* waiter);
+
+	private:
+		FiberWaiter* m_Head = nullptr;
+		FiberWaiter* m_Tail = nullptr;
+	};
+
+	/*
+	* @brief 协程互斥锁, 等锁时挂起协程而不是阻塞线程, 同一线程上的其他协程照常执行
+	*        不竞争时加锁/解锁各一次原子操作; 有协程在等时解锁直接把锁交给队首的协程, 先来先得
+	*        不在调度器线程里调用时没法挂起, 退化为让出CPU的自旋
+	*/
+	class FiberMutex {
+	public:
+		typedef LockImpl<FiberMutex> Lock;
+
+		FiberMutex() = default;
+		FiberMutex(const FiberMutex&) = delete;
+		FiberMutex& operator=(const FiberMutex&) = delete;
+
+		void lock() {
+			int expected = UNLOCKED;
+			if (WS_LIKELY(m_State.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire)))
+				return;
+			lockSlow();
+		}
+
+		bool tryLock() {
+			int expected = UNLOCKED;
+			return m_State.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire);
+		}
+
+		void unlock() {
+			int expected = LOCKED;
+			if (WS_LIKELY(m_State.compare_exchange_strong(expected, UNLOCKED, std::memory_order_release)))
+				return;
+			unlockSlow();
+		}
+
+	private:
+		void lockSlow();
+		void unlockSlow();
+
+	private:
+		enum State {
+			UNLOCKED = 0,
+			LOCKED,
+			// 已加锁, 队列里有等待的协程, 解锁要走慢路径
+			CONTENDED
+		};
+
+		std::atomic<int> m_State{ UNLOCKED };
+		Mutex m_Mtx;
+		FiberWaitQueue m_Waiters;
+	};
+
+	/*
+	* @brief 协程条件变量, 配合FiberMutex使用
+	*        和pthread一样可能有虚假唤醒, 调用方要在循环里检查条件
+	*/
+	class FiberCondVar {
+	public:
+		FiberCondVar() = default;
+		FiberCondVar(const FiberCondVar&) = delete;
+		FiberCondVar& operator=(const FiberCondVar&) = delete;
+
+		// 调用时持有mutex, 挂起期间释放, 返回前重新加锁
+		void wait(FiberMutex& mutex);
+		void notifyOne();
+		void notifyAll();
+
+	private:
+		// 没有协程在等时notify只读一次原子变量
+		std::atomic<size_t> m_WaiterCount{ 0 };
+		Mutex m_Mtx;
+		FiberWaitQueue m_Waiters;
+	};
+
+	/*
+	* @brief 协程信号量, 有协程在等时notify直接把许可交给队首的协程
+	*        有许可时wait和没有协程在等时notify各一次原子操作
+	*/
+	class FiberSemaphore {
+	public:
+		FiberSemaphore(uint32_t count = 0)
+			: m_Count(count)
+		{
+		}
+		FiberSemaphore(const FiberSemaphore&) = delete;
+		FiberSemaphore& operator=(const FiberSemaphore&) = delete;
+
+		void wait() {
+			if (WS_LIKELY(tryWait()))
+				return;
+			waitSlow();
+		}
+
+		bool tryWait() {
+			int64_t count = m_Count.load(std::memory_order_relaxed);
+			while (count > 0) {
+				if (m_Count.compare_exchange_weak(count, count - 1, std::memory_order_acquire))
+					return true;
+			}
+			return false;
+		}
+
+		void notify() {
+			m_Count.fetch_add(1);
+			if (WS_UNLIKELY(m_WaiterCount.load() != 0))
+				notifySlow();
+		}
+
+	private:
+		void waitSlow();
+		void notifySlow();
+
+	private:
+		std::atomic<int64_t> m_Count;
+		std::atomic<size_t> m_WaiterCount{ 0 };
+		Mutex m_Mtx;
+		FiberWaitQueue m_Waiters;
+	};
+
+	/*
+	* @brief 协程读写锁, 写优先: 有协程在等时新来的读者也要排队, 避免写者饿死
+	*        不竞争时加读锁/写锁和解锁各一次原子操作
+	*        解锁时按队列顺序交接: 队首是写者就交给它, 否则唤醒队首连续的所有读者
+	*/
+	class FiberRWMutex {
+	public:
+		typedef ReadLockImpl<FiberRWMutex> ReadLock;
+		typedef WriteLockImpl<FiberRWMutex> WriteLock;
+
+		FiberRWMutex() = default;
+		FiberRWMutex(const FiberRWMutex&) = delete;
+		FiberRWMutex& operator=(const FiberRWMutex&) = delete;
+
+		void rdlock() {
+			uint32_t state = m_State.load(std::memory_order_relaxed);
+			if (WS_LIKELY(!(state & (WRITER | WAITING))
+				&& m_State.compare_exchange_strong(state, state + 1, std::memory_order_acquire)))
+				return;
+			rdlockSlow();
+		}
+
+		void wrlock() {
+			uint32_t expected = 0;
+			if (WS_LIKELY(m_State.compare_exchange_strong(expected, WRITER, std::memory_order_acquire)))
+				return;
+			wrlockSlow();
+		}
+
+		// 读锁和写锁都用它解锁, 持有写锁时状态里有WRITER位
+		void unlock() {
+			uint32_t state = m_State.load(std::memory_order_relaxed);
+			if (state & WRITER) {
+				uint32_t expected = WRITER;
+				if (WS_LIKELY(m_State.compare_exchange_strong(expected, 0, std::memory_order_release)))
+					return;
+			}
+			// 最后一个读者走了并且有人在等
+			else if (WS_LIKELY(m_State.fetch_sub(1, std::memory_order_release) - 1 != WAITING))
+				return;
+			unlockSlow();
+		}
+
+	private:
+		void rdlockSlow();
+		void wrlockSlow();
+		void unlockSlow();
+
+	private:
+		// 低位是持有读锁的协程数
+		static const uint32_t WRITER = 1u << 31;
+		// 队列里有等待的协程, 快路径都要让给慢路径
+		static const uint32_t WAITING = 1u << 30;
+
+		std::atomic<uint32_t> m_State{ 0 };
+		Mutex m_Mtx;
+		FiberWaitQueue m_Waiters;
+	};
+}
@@ -2,6 +2,7 @@
 #include <dlfcn.h>
 #include "fdmanager.h"
 #include "iomanager.h"
+#include "utils.h"
 
 namespace WebServer {
 
@@ -9,20 +10,33 @@ namespace WebServer {
 
 	#define HOOK_FUNC(FUNC) \
 		FUNC(sleep) \
+		FUNC(usleep) \
+		FUNC(nanosleep) \
 		FUNC(fcntl) \
 		FUNC(socket) \
 		FUNC(connect) \
-		FUNC(send) \
+		FUNC(read) \
+		FUNC(readv) \
 		FUNC(recv) \
+		FUNC(recvfrom) \
+		FUNC(recvmsg) \
+		FUNC(recvmmsg) \
+		FUNC(write) \
+		FUNC(writev) \
+		FUNC(send) \
+		FUNC(sendto) \
+		FUNC(sendmsg) \
+		FUNC(sendmmsg) \
 		FUNC(accept) \
-		FUNC(close)
+		FUNC(close) \
+		FUNC(setsockopt)
 
 	void hookInit() {
 		static bool isInited = false;
 		if (isInited) {
 			return;
 		}
-	// dlsym(RTLD_NEXT, "name")н׶νв,˺ҪnullptrЩ(sleep_f, fcntl_f)гʼ(),ӽ׶Ҳ
+	// dlsym(RTLD_NEXT, "name")是在运行阶段进行查找,因此后面要先用nullptr对这些函数(sleep_f, fcntl_f等)进行初始化(定义),避免链接阶段找不到
 	#define FUNC(name) name ## _f = (name ## _func)dlsym(RTLD_NEXT, #name);
 			HOOK_FUNC(FUNC);
 	#undef FUNC
@@ -32,7 +46,7 @@ namespace WebServer {
 	struct _HookIniter {
 		_HookIniter() {
 			hookInit();
-			// TODO: ļ
+			// TODO: 加入配置文件
 			s_ConnectTimeout = 1000;
 		}
 	};
@@ -51,8 +65,10 @@ struct timerInfo {
 	int cancelled = 0;
 };
 
+// completion不为空且IOManager是io_uring后端时, EAGAIN之后直接提交完成式请求, 不再走等就绪再重试的流程
 template<typename OriginFunc, typename... Args>
-static ssize_t doIO(int fd, OriginFunc func, const char* hookFuncName, uint32_t event, int socketType, Args&&... args) {
+static ssize_t doIO(int fd, OriginFunc func, const char* hookFuncName, uint32_t event, int socketType,
+	const WebServer::IOManager::IOArgs* completion, Args&&... args) {
 	if (!WebServer::t_HookEnable)
 		return func(fd, std::forward<Args>(args)...);
 	
@@ -73,17 +89,24 @@ static ssize_t doIO(int fd, OriginFunc func, const char* hookFuncName, uint32_t
 
 retry:
 	ssize_t n = func(fd, std::forward<Args>(args)...);
-	while (n == -1 && errno == EINTR) {
+	// 从retry回来时协程可能已经换了线程, errno要重新取
+	while (n == -1 && WebServer::GetErrno() == EINTR) {
 		n = func(fd, std::forward<Args>(args)...);
 	}
 
-	if (n == -1 && errno == EAGAIN) {
+	if (n == -1 && WebServer::GetErrno() == EAGAIN) {
 		WebServer::IOManager* ioManager = WebServer::IOManager::getThis();
+		// 不在IOManager里(比如普通Scheduler的线程)没法挂起等事件, 和没有hook一样直接返回
+		if (!ioManager)
+			return n;
+		if (completion && ioManager->getBackend() == WebServer::IOManager::IO_URING)
+			return ioManager->submitIO(fd, *completion, timeout);
+
 		WebServer::Timer::timerPtr timer;
 		std::weak_ptr<timerInfo> wInfo(tInfo);
 
-		// 볬ʱʱ,ڹ涨ʱûн,ͽwInfo/tInfocancelledΪETIMEDOUT,֮ͻ˳
-		// ,˳doIO,ôtInfoͻᱻͷ,ʱѾ˳ʱʱ,wInfo.lockΪnullptr,˻ֱӷ
+		// 加入超时定时器,如果在规定时间内这个阻塞没有结束,就将wInfo/tInfo的cancelled设置为ETIMEDOUT,之后就会退出了
+		// 如果阻塞结束了,即退出了这次doIO函数,那么tInfo就会被释放,此时如果已经设置了超时定时器,wInfo.lock就为nullptr,因此会直接返回
 		if (timeout != (uint64_t)-1) {
 			timer = ioManager->addConditionTimer(timeout, [wInfo, fd, ioManager, event]() {
 				auto t = wInfo.lock();
@@ -94,23 +117,23 @@ retry:
 			}, wInfo);
 		}
 
-		// ¼ʱ,ҲҪٰѴfuncӽȥ,ΪҪgotoretryȥ,func¼ŵ
+		// 加入事件的时候,也不需要再把处理函数func加进去了,因为反正都要goto到retry那里去,func还被记录着的
 		int rt = ioManager->addEvent(fd, (WebServer::IOManager::Event)(event));
 		if (rt) {
-			// ¼ûмɹ,ʱȡʱ
+			// 事件没有加入成功,暂时取消定时器
 			if (timer)
 				timer->cancel();
 			return -1;
 		}
 		else {
-			// ȽЭͣȻ˳,˳ЭREADY״̬,schedulerٴεscheduleЭ̶
+			// 协程挂起(HOLD), 等事件触发或者超时定时器cancelEvent时再被schedule回来
 			WebServer::Fiber::YieldToHold();
-			// Эֿʼִ,Ȱ֮ǰĶʱȡ
+			// 协程又开始执行,先把之前的定时器取消了
 			if (timer)
 				timer->cancel();
-			// Ѿʱ,ֱ˳
+			// 如果已经超时了,就直接退出了
 			if (tInfo->cancelled) {
-				errno = tInfo->cancelled;
+				WebServer::SetErrno(tInfo->cancelled);
 				return -1;
 			}
 			goto retry;
@@ -129,12 +152,32 @@ extern "C" {
 		if (!WebServer::t_HookEnable) {
 			return sleep_f(seconds);
 		}
+		WebServer::Fiber::sleepFor(seconds * 1000000ull);
+		return 0;
+	}
+
+	int usleep(useconds_t usec) {
+		if (!WebServer::t_HookEnable) {
+			return usleep_f(usec);
+		}
+		WebServer::Fiber::sleepFor(usec);
+		return 0;
+	}
 
-		WebServer::Fiber::fiberPtr fiber = WebServer::Fiber::getThis();
-		WebServer::IOManager* ioManager = WebServer::IOManager::getThis();
-		// std::bind()󶨺ĺ,βζvoid()ͽ
-		ioManager->addTimer(seconds * 1000, std::bind((void(WebServer::Scheduler::*)(WebServer::Fiber::fiberPtr, int thread)) & WebServer::IOManager::schedule, ioManager, fiber, -1));
-		WebServer::Fiber::YieldToHold();
+	int nanosleep(const struct timespec* req, struct timespec* rem) {
+		if (!WebServer::t_HookEnable) {
+			return nanosleep_f(req, rem);
+		}
+		if (!req || req->tv_nsec < 0 || req->tv_nsec >= 1000000000 || req->tv_sec < 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		// 不足1us的部分向上取整
+		WebServer::Fiber::sleepFor(req->tv_sec * 1000000ull + (req->tv_nsec + 999) / 1000);
+		if (rem) {
+			rem->tv_sec = 0;
+			rem->tv_nsec = 0;
+		}
 		return 0;
 	}
 
@@ -163,13 +206,20 @@ extern "C" {
 		if (context->getUserNonblock())
 			return connect_f(fd, addr, addrlen);
 
+		WebServer::IOManager* ioManager = WebServer::IOManager::getThis();
+		if (!ioManager)
+			return connect_f(fd, addr, addrlen);
+		if (ioManager->getBackend() == WebServer::IOManager::IO_URING) {
+			WebServer::IOManager::IOArgs args = { WebServer::IOManager::OP_CONNECT, (void*)addr, addrlen, nullptr, 0 };
+			return ioManager->submitIO(fd, args, timeoutMs);
+		}
+
 		int n = connect_f(fd, addr, addrlen);
 		if (n == 0)
 			return 0;
 		else if (n != -1 || errno != EINPROGRESS)
 			return n;
 
-		WebServer::IOManager* ioManager = WebServer::IOManager::getThis();
 		WebServer::Timer::timerPtr timer;
 		std::shared_ptr<timerInfo> tInfo(new timerInfo);
 		std::weak_ptr<timerInfo> wInfo(tInfo);
@@ -191,7 +241,7 @@ extern "C" {
 				timer->cancel();
 			}
 			if (tInfo->cancelled) {
-				errno = tInfo->cancelled;
+				WebServer::SetErrno(tInfo->cancelled);
 				return -1;
 			}
 		}
@@ -208,29 +258,75 @@ extern "C" {
 		if (!error)
 			return 0;
 		else {
-			errno = error;
+			WebServer::SetErrno(error);
 			return -1;
 		}
 	}
 
 	int connect(int fd, const struct sockaddr* addr, socklen_t addrlen) {
-		connect_with_timeout(fd, addr, addrlen, WebServer::s_ConnectTimeout);
+		return connect_with_timeout(fd, addr, addrlen, WebServer::s_ConnectTimeout);
 	}
 
 	int accept(int s, struct sockaddr* addr, socklen_t* addrlen) {
-		int fd = doIO(s, accept_f, "accept", WebServer::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+		WebServer::IOManager::IOArgs args = { WebServer::IOManager::OP_ACCEPT, addr, 0, addrlen, 0 };
+		int fd = doIO(s, accept_f, "accept", WebServer::IOManager::READ, SO_RCVTIMEO, &args, addr, addrlen);
 		if (fd >= 0) {
 			WebServer::FdMgr::GetInstance()->get(fd, true);
 		}
 		return fd;
 	}
 
+	// read
+	ssize_t read(int fd, void* buf, size_t count) {
+		return doIO(fd, read_f, "read", WebServer::IOManager::READ, SO_RCVTIMEO, nullptr, buf, count);
+	}
+
+	ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
+		return doIO(fd, readv_f, "readv", WebServer::IOManager::READ, SO_RCVTIMEO, nullptr, iov, iovcnt);
+	}
+
 	ssize_t recv(int sockfd, void* buf, size_t len, int flags) {
-		return doIO(sockfd, recv_f, "recv", WebServer::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+		WebServer::IOManager::IOArgs args = { WebServer::IOManager::OP_RECV, buf, len, nullptr, flags };
+		return doIO(sockfd, recv_f, "recv", WebServer::IOManager::READ, SO_RCVTIMEO, &args, buf, len, flags);
+	}
+
+	ssize_t recvfrom(int sockfd, void* buf, size_t len, int flags, struct sockaddr* srcAddr, socklen_t* addrlen) {
+		return doIO(sockfd, recvfrom_f, "recvfrom", WebServer::IOManager::READ, SO_RCVTIMEO, nullptr, buf, len, flags, srcAddr, addrlen);
+	}
+
+	ssize_t recvmsg(int sockfd, struct msghdr* msg, int flags) {
+		return doIO(sockfd, recvmsg_f, "recvmsg", WebServer::IOManager::READ, SO_RCVTIMEO, nullptr, msg, flags);
+	}
+
+	// 一个都没有时挂起等可读, 有多少收多少, 不等凑满vlen; timeout参数在非阻塞socket上没有意义, 超时用SO_RCVTIMEO
+	int recvmmsg(int sockfd, struct mmsghdr* msgvec, unsigned int vlen, int flags, struct timespec* timeout) {
+		return doIO(sockfd, recvmmsg_f, "recvmmsg", WebServer::IOManager::READ, SO_RCVTIMEO, nullptr, msgvec, vlen, flags, timeout);
+	}
+
+	// write
+	ssize_t write(int fd, const void* buf, size_t count) {
+		return doIO(fd, write_f, "write", WebServer::IOManager::WRITE, SO_SNDTIMEO, nullptr, buf, count);
+	}
+
+	ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+		return doIO(fd, writev_f, "writev", WebServer::IOManager::WRITE, SO_SNDTIMEO, nullptr, iov, iovcnt);
 	}
 
 	ssize_t send(int s, const void* msg, size_t len, int flags) {
-		return doIO(s, send_f, "send", WebServer::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+		WebServer::IOManager::IOArgs args = { WebServer::IOManager::OP_SEND, (void*)msg, len, nullptr, flags };
+		return doIO(s, send_f, "send", WebServer::IOManager::WRITE, SO_SNDTIMEO, &args, msg, len, flags);
+	}
+
+	ssize_t sendto(int s, const void* msg, size_t len, int flags, const struct sockaddr* to, socklen_t tolen) {
+		return doIO(s, sendto_f, "sendto", WebServer::IOManager::WRITE, SO_SNDTIMEO, nullptr, msg, len, flags, to, tolen);
+	}
+
+	ssize_t sendmsg(int s, const struct msghdr* msg, int flags) {
+		return doIO(s, sendmsg_f, "sendmsg", WebServer::IOManager::WRITE, SO_SNDTIMEO, nullptr, msg, flags);
+	}
+
+	int sendmmsg(int sockfd, struct mmsghdr* msgvec, unsigned int vlen, int flags) {
+		return doIO(sockfd, sendmmsg_f, "sendmmsg", WebServer::IOManager::WRITE, SO_SNDTIMEO, nullptr, msgvec, vlen, flags);
 	}
 
 	int close(int fd) {
@@ -249,9 +345,9 @@ extern "C" {
 		return close_f(fd);
 	}
 
-	// fcntlϵͳʵֵfcntl,ͬĸֻж̬ܹʵ֡Ϊ̬ʱ,ʹõһҵĺ,֮ͶͲټˡ
-	// fcntlֱĿԴļе,ӵʱҵ,֮Ͳϵͳfcntlʵˡ
-	// 궨dlsym(RTLD_NEXT, #name)ȥ,Դļǹ;RTLD_NEXTǴdlsym(RTLD_NEXT, #name)ڿһ⿪ʼҡ
+	// fcntl覆盖了系统实现的fcntl,这种同名函数的覆盖只有动态链接能够实现。因为动态链接时,会优先使用第一个找到的函数定义,之后就定义就不再加载了。
+	// 而这里的fcntl是直接在项目包含的源文件中的,所以链接的时候是最优先找到的,之后就不会加载系统的fcntl实现了。
+	// 而宏定义中dlsym(RTLD_NEXT, #name)是去共享库里面找,因此源文件不算是共享库;其次RTLD_NEXT是从dlsym(RTLD_NEXT, #name)所在库的下一个库开始找。
 	int fcntl(int fd, int cmd, ...) {
 		va_list va;
 		va_start(va, cmd);
@@ -291,4 +387,19 @@ extern "C" {
 		}
 	}
 
+	// 收发超时记到fd记录里, 由doIO用定时器实现; socket是非阻塞的, 内核的SO_RCVTIMEO/SO_SNDTIMEO不起作用
+	int setsockopt(int sockfd, int level, int optname, const void* optval, socklen_t optlen) {
+		if (!WebServer::t_HookEnable)
+			return setsockopt_f(sockfd, level, optname, optval, optlen);
+		if (level == SOL_SOCKET && (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO)
+			&& optval && optlen >= sizeof(timeval)) {
+			WebServer::FdContext::fdContextptr context = WebServer::FdMgr::GetInstance()->get(sockfd);
+			if (context) {
+				const timeval* tv = (const timeval*)optval;
+				context->setTimeout(optname, tv->tv_sec * 1000 + tv->tv_usec / 1000);
+			}
+		}
+		return setsockopt_f(sockfd, level, optname, optval, optlen);
+	}
+
 }
\ No newline at end of file
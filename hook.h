@@ -3,6 +3,7 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <stdint.h>
 #include <stdarg.h>
 #include <time.h>
@@ -17,9 +18,16 @@ namespace WebServer {
 
 
 extern "C" {
+	// sleep
 	typedef unsigned int (*sleep_func)(unsigned int seconds);
 	extern sleep_func sleep_f;
 
+	typedef int (*usleep_func)(useconds_t usec);
+	extern usleep_func usleep_f;
+
+	typedef int (*nanosleep_func)(const struct timespec* req, struct timespec* rem);
+	extern nanosleep_func nanosleep_f;
+
 	typedef int (*fcntl_func)(int fd, int cmd, ...);
 	extern fcntl_func fcntl_f;
 
@@ -33,14 +41,49 @@ extern "C" {
 	typedef int (*accept_func)(int s, struct sockaddr* addr, socklen_t* addrlen);
 	extern accept_func accept_f;
 
-	typedef ssize_t(*send_func)(int fd, const void* msg, size_t n, int flags);
-	extern send_func send_f;
+	// read
+	typedef ssize_t(*read_func)(int fd, void* buf, size_t count);
+	extern read_func read_f;
+
+	typedef ssize_t(*readv_func)(int fd, const struct iovec* iov, int iovcnt);
+	extern readv_func readv_f;
 
 	typedef ssize_t(*recv_func)(int sockfd, void* buf, size_t len, int flags);
 	extern recv_func recv_f;
 
+	typedef ssize_t(*recvfrom_func)(int sockfd, void* buf, size_t len, int flags, struct sockaddr* srcAddr, socklen_t* addrlen);
+	extern recvfrom_func recvfrom_f;
+
+	typedef ssize_t(*recvmsg_func)(int sockfd, struct msghdr* msg, int flags);
+	extern recvmsg_func recvmsg_f;
+
+	typedef int (*recvmmsg_func)(int sockfd, struct mmsghdr* msgvec, unsigned int vlen, int flags, struct timespec* timeout);
+	extern recvmmsg_func recvmmsg_f;
+
+	// write
+	typedef ssize_t(*write_func)(int fd, const void* buf, size_t count);
+	extern write_func write_f;
+
+	typedef ssize_t(*writev_func)(int fd, const struct iovec* iov, int iovcnt);
+	extern writev_func writev_f;
+
+	typedef ssize_t(*send_func)(int fd, const void* msg, size_t n, int flags);
+	extern send_func send_f;
+
+	typedef ssize_t(*sendto_func)(int s, const void* msg, size_t len, int flags, const struct sockaddr* to, socklen_t tolen);
+	extern sendto_func sendto_f;
+
+	typedef ssize_t(*sendmsg_func)(int s, const struct msghdr* msg, int flags);
+	extern sendmsg_func sendmsg_f;
+
+	typedef int (*sendmmsg_func)(int sockfd, struct mmsghdr* msgvec, unsigned int vlen, int flags);
+	extern sendmmsg_func sendmmsg_f;
+
 	typedef int (*close_func)(int fd);
 	extern close_func close_f;
 
+	typedef int (*setsockopt_func)(int sockfd, int level, int optname, const void* optval, socklen_t optlen);
+	extern setsockopt_func setsockopt_f;
+
 	extern int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen, uint64_t timeoutMs);
 }
\ No newline at end of file
@@ -1,113 +1,200 @@
 #include "iomanager.h"
 #include "core.h"
+#include "hook.h"
+#include "log.h"
+#include "uring.h"
 #include "utils.h"
 
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <string.h>
 
 namespace WebServer {
 
-	IOManager::FdContext::EventContext& IOManager::FdContext::getContext(IOManager::Event event) {
+	// io_uring后端的user_data: 低3位是类型, poll请求的高16位是EventContext::seq
+	enum {
+		TAG_INTERNAL = 0,
+		TAG_POLL_READ = 1,
+		TAG_POLL_WRITE = 2,
+		TAG_REQUEST = 3,
+		TAG_POLL_ERROR = 4
+	};
+	static const uint64_t TAG_MASK = 7;
+	static const int SEQ_SHIFT = 48;
+	static const uint64_t PTR_MASK = ((uint64_t)1 << SEQ_SHIFT) - 1;
+
+	static const unsigned RING_ENTRIES = 1024;
+	// 攒够这么多SQE就直接提交, 不再等工作线程空闲
+	static const unsigned SUBMIT_BATCH = 32;
+
+	struct IORequest {
+		Fiber::fiberPtr fiber;
+		Scheduler* scheduler = nullptr;
+		// 完成时把协程投回发起请求时指定的线程
+		int thread = -1;
+		FdContext* fdcontext = nullptr;
+		IOManager::Event event = IOManager::NONE;
+		int32_t result = 0;
+		bool cancelled = false;
+		__kernel_timespec timeout;
+	};
+
+	static uint64_t PollUserData(void* fdcontext, IOManager::Event event, uint16_t seq) {
+		uint64_t tag = event == IOManager::READ ? TAG_POLL_READ : (event == IOManager::WRITE ? TAG_POLL_WRITE : TAG_POLL_ERROR);
+		return ((uint64_t)seq << SEQ_SHIFT) | (uint64_t)(uintptr_t)fdcontext | tag;
+	}
+
+	static uint32_t PollMask(IOManager::Event event) {
+		uint32_t mask = event == IOManager::READ ? POLLIN : (event == IOManager::WRITE ? POLLOUT : POLLERR);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		// poll32_events在大端机器上是按16位交换存放的
+		mask = (mask << 16) | (mask >> 16);
+#endif
+		return mask;
+	}
+
+	FdContext::EventContext& FdContext::getContext(int event) {
 		switch (event) {
 		case IOManager::READ:
 			return read;
 		case IOManager::WRITE:
 			return write;
+		case IOManager::ERROR:
+			return error;
 		default:
 			WS_ASSERT_WITHPARAM(false, "getContext");
 		}
 		throw std::invalid_argument("getContext invalid event");
 	}
 
-	void IOManager::FdContext::resetContext(EventContext& context) {
+	void FdContext::resetContext(EventContext& context) {
 		context.scheduler = nullptr;
+		context.thread = -1;
 		context.fiber.reset();
 		context.func = nullptr;
 	}
 
-	void IOManager::FdContext::triggerEvent(IOManager::Event event) {
+	void FdContext::triggerEvent(int event) {
 		WS_ASSERT(event & events);
-		events = (Event)(events & ~event);
+		events = events & ~event;
 		EventContext& context = getContext(event);
 		if (context.func)
 			context.scheduler->schedule(&context.func);
 		else
-			context.scheduler->schedule(&context.fiber);
+			context.scheduler->schedule(&context.fiber, context.thread);
 		context.scheduler = nullptr;
+		context.thread = -1;
 		return;
 	}
 
-	IOManager::IOManager(size_t threads, bool useCaller, const std::string& name)
+	IOManager::IOManager(size_t threads, bool useCaller, const std::string& name, Backend backend)
 		: Scheduler(threads, useCaller, name)
+		, m_Backend(backend)
 	{
-		m_EpollFd = epoll_create(5000);
-		WS_ASSERT(m_EpollFd > 0);
-
-		int rt = pipe(m_TickleFds);
-		WS_ASSERT(!rt);
-
-		epoll_event event;
-		memset(&event, 0, sizeof(epoll_event));
-		event.events = EPOLLIN | EPOLLET;
-		event.data.fd = m_TickleFds[0];
-
-		rt = fcntl(m_TickleFds[0], F_SETFL, O_NONBLOCK);
-		WS_ASSERT(!rt);
-
-		rt = epoll_ctl(m_EpollFd, EPOLL_CTL_ADD, m_TickleFds[0], &event);
-		WS_ASSERT(!rt);
+		if (m_Backend == IO_URING && !initRing())
+			m_Backend = EPOLL;
+		if (m_Backend == EPOLL) {
+			m_EpollFd = epoll_create(5000);
+			WS_ASSERT(m_EpollFd > 0);
+		}
+		// I/O完成的通知源: epoll后端是共享的epoll, io_uring后端是ring注册的eventfd
+		int source = m_Backend == EPOLL ? m_EpollFd : m_RingEventFd;
+
+		m_Notifiers.resize(getWorkerCount());
+		for (auto& i : m_Notifiers) {
+			i.reset(new Notifier);
+			i->epollFd = epoll_create1(EPOLL_CLOEXEC);
+			WS_ASSERT(i->epollFd >= 0);
+			i->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			WS_ASSERT(i->eventFd >= 0);
+
+			epoll_event event;
+			memset(&event, 0, sizeof(epoll_event));
+			event.events = EPOLLIN;
+			event.data.fd = i->eventFd;
+			int rt = epoll_ctl(i->epollFd, EPOLL_CTL_ADD, i->eventFd, &event);
+			WS_ASSERT(!rt);
+
+			// 老内核不支持EPOLLEXCLUSIVE时退化为全部唤醒, 只是多一些空唤醒
+			event.events = EPOLLIN | EPOLLEXCLUSIVE;
+			event.data.fd = source;
+			rt = epoll_ctl(i->epollFd, EPOLL_CTL_ADD, source, &event);
+			if (rt && errno == EINVAL) {
+				event.events = EPOLLIN;
+				rt = epoll_ctl(i->epollFd, EPOLL_CTL_ADD, source, &event);
+			}
+			WS_ASSERT(!rt);
+		}
 
-		contextResize(32);
 		start();
 	}
 
 	IOManager::~IOManager() {
 		stop();  // from scheduler
+		for (auto& i : m_Notifiers) {
+			close(i->eventFd);
+			close(i->epollFd);
+		}
+		if (m_EpollFd >= 0)
+			close(m_EpollFd);
+		// 关闭ring时内核会取消所有还没完成的请求
+		m_Ring.reset();
+		if (m_RingEventFd >= 0)
+			close(m_RingEventFd);
 	}
 
-	void IOManager::contextResize(size_t size) {
-		m_FdContexts.resize(size);
-		for (size_t i = 0; i < m_FdContexts.size(); i++) {
-			if (!m_FdContexts[i]) {
-				m_FdContexts[i] = new FdContext;
-				m_FdContexts[i]->fd = i;
-			}
+	bool IOManager::initRing() {
+		static const uint8_t ops[] = {
+			IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_ASYNC_CANCEL, IORING_OP_LINK_TIMEOUT,
+			IORING_OP_RECV, IORING_OP_SEND, IORING_OP_ACCEPT, IORING_OP_CONNECT
+		};
+		std::unique_ptr<IoUring> ring(new IoUring);
+		if (!ring->init(RING_ENTRIES, ops, sizeof(ops)))
+			return false;
+		int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd < 0)
+			return false;
+		if (!ring->registerEventFd(fd)) {
+			close(fd);
+			return false;
 		}
+		m_Ring.swap(ring);
+		m_RingEventFd = fd;
+		return true;
 	}
 
-	int IOManager::addEvent(int fd, Event event, std::function<void()> func) {
-		FdContext* fdcontext = nullptr;
-		RWMutexType::ReadLock lock(m_Mtx);
-		if ((int)m_FdContexts.size() > fd) {
-			fdcontext = m_FdContexts[fd];
-			lock.unlock();
-		}
-		else {
-			lock.unlock();
-			RWMutexType::WriteLock lock2(m_Mtx);
-			contextResize(fd * 1.5f);
-			fdcontext = m_FdContexts[fd];
-		}
+	IOManager::FdContext* IOManager::getFdContext(int fd, bool autoCreate) {
+		return FdMgr::GetInstance()->getRecord(fd, autoCreate);
+	}
 
+	int IOManager::addEvent(int fd, Event event, Task func) {
+		FdContext* fdcontext = getFdContext(fd, true);
+		if (WS_UNLIKELY(!fdcontext)) {
+			errno = EBADF;
+			return -1;
+		}
 		FdContext::MutexType::Lock lock2(fdcontext->mtx);
 		if (WS_UNLIKELY(fdcontext->events & event)) {
-			std::cout << "addEvent assert fd=" << fd
-				<< " event=" << (EPOLL_EVENTS)event
-				<< " fd_ctx.event=" << (EPOLL_EVENTS)fdcontext->events;
+			WS_LOG_ERROR("addEvent assert fd={} event={} fd_ctx.event={}", fd, (int)event, (int)fdcontext->events);
+			Logger::Flush();
 			WS_ASSERT(!(fdcontext->events & event));
 		}
 
-		int op = fdcontext->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-		epoll_event epollEvent;
-		epollEvent.events = EPOLLET | fdcontext->events | event;
-		epollEvent.data.ptr = fdcontext;
-
-		int rt = epoll_ctl(m_EpollFd, op, fd, &epollEvent);
-		if (rt) {
-			WS_ASSERT(false);
-			return -1;
+		if (m_Backend == EPOLL) {
+			int op = fdcontext->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+			epoll_event epollEvent;
+			epollEvent.events = EPOLLET | fdcontext->events | event;
+			epollEvent.data.ptr = fdcontext;
+
+			// fd可能刚被其他线程close, 交给调用方按I/O失败处理
+			int rt = epoll_ctl(m_EpollFd, op, fd, &epollEvent);
+			if (rt) {
+				WS_LOG_ERROR("epoll_ctl({}, {}, {}):{} ({}) ({})", m_EpollFd, fd, epollEvent.events, rt, errno, strerror(errno));
+				return -1;
+			}
 		}
 
 		++m_WaitingEventCount;
@@ -120,34 +207,40 @@ namespace WebServer {
 			eventContext.func.swap(func);
 		else {
 			eventContext.fiber = Fiber::getThis();
+			eventContext.thread = Scheduler::GetTaskThread();
 			WS_ASSERT((eventContext.fiber->getState() == Fiber::EXEC));
 		}
 
+		// io_uring后端用一次性的POLL_ADD, 触发后内核自动移除, 不需要再MOD/DEL
+		if (m_Backend == IO_URING)
+			submitPoll(fdcontext, event);
 		return 0;
 	}
 
 	bool IOManager::delEvent(int fd, Event event) {
-		RWMutexType::ReadLock lock(m_Mtx);
-		if ((int)m_FdContexts.size() <= fd)
+		FdContext* fdcontext = getFdContext(fd, false);
+		if (!fdcontext)
 			return false;
-		FdContext* fdcontext = m_FdContexts[fd];
-		lock.unlock();
 
 		FdContext::MutexType::Lock lock2(fdcontext->mtx);
 		if (WS_UNLIKELY(!(fdcontext->events & event)))
 			return false;
 
 		Event newEvents = (Event)(fdcontext->events & ~event);
-		int op = newEvents ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-		epoll_event epollEvent;
-		epollEvent.events = EPOLLET | newEvents;
-		epollEvent.data.ptr = fdcontext;
-
-		int rt = epoll_ctl(m_EpollFd, op, fd, &epollEvent);
-		if (rt) {
-			printf("epoll_ctl failed in delEvent\n");
-			return false;
+		if (m_Backend == EPOLL) {
+			int op = newEvents ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+			epoll_event epollEvent;
+			epollEvent.events = EPOLLET | newEvents;
+			epollEvent.data.ptr = fdcontext;
+
+			int rt = epoll_ctl(m_EpollFd, op, fd, &epollEvent);
+			if (rt) {
+				WS_LOG_ERROR("epoll_ctl failed in delEvent fd={} errno={} errstr={}", fd, errno, strerror(errno));
+				return false;
+			}
 		}
+		else
+			removePoll(fdcontext, event);
 
 		--m_WaitingEventCount;
 		fdcontext->events = newEvents;
@@ -158,13 +251,29 @@ namespace WebServer {
 
 	bool IOManager::cancelEvent(int fd, Event event)
 	{
-		RWMutexType::ReadLock lock(m_Mtx);
-		if (fd >= (int)m_FdContexts.size())
+		FdContext* fdcontext = getFdContext(fd, false);
+		if (!fdcontext)
 			return false;
-		FdContext* fdcontext = m_FdContexts[fd];
-		lock.unlock();
 
 		FdContext::MutexType::Lock lock2(fdcontext->mtx);
+		if (m_Backend == IO_URING) {
+			bool cancelled = false;
+			FdContext::EventContext& eventContext = fdcontext->getContext(event);
+			if (eventContext.request) {
+				cancelRequest(eventContext.request);
+				cancelled = true;
+			}
+			if (fdcontext->events & event) {
+				removePoll(fdcontext, event);
+				fdcontext->triggerEvent(event);
+				--m_WaitingEventCount;
+				cancelled = true;
+			}
+			if (cancelled)
+				flushSubmissions();
+			return cancelled;
+		}
+
 		if (WS_UNLIKELY(!(fdcontext->events & event)))
 			return false;
 		Event newEvents = (Event)(fdcontext->events & ~event);
@@ -175,7 +284,7 @@ namespace WebServer {
 
 		int rt = epoll_ctl(m_EpollFd, op, fd, &cancelEvent);
 		if (rt) {
-			printf("epoll_ctl failed in cancelEvent\n");
+			WS_LOG_ERROR("epoll_ctl failed in cancelEvent fd={} errno={} errstr={}", fd, errno, strerror(errno));
 			return false;
 		}
 
@@ -185,14 +294,32 @@ namespace WebServer {
 	}
 
 	bool IOManager::cancelAll(int fd) {
-		RWMutexType::ReadLock lock(m_Mtx);
-		if ((int)m_FdContexts.size() <= fd)
+		FdContext* fdcontext = getFdContext(fd, false);
+		if (!fdcontext)
 			return false;
 
-		FdContext* fdcontext = m_FdContexts[fd];
-		lock.unlock();
-
 		FdContext::MutexType::Lock lock2(fdcontext->mtx);
+		if (m_Backend == IO_URING) {
+			// 马上提交, close之前内核要先放掉请求持有的文件引用
+			bool cancelled = false;
+			for (Event event : { READ, WRITE, ERROR }) {
+				FdContext::EventContext& eventContext = fdcontext->getContext(event);
+				if (eventContext.request) {
+					cancelRequest(eventContext.request);
+					cancelled = true;
+				}
+				if (fdcontext->events & event) {
+					removePoll(fdcontext, event);
+					fdcontext->triggerEvent(event);
+					--m_WaitingEventCount;
+					cancelled = true;
+				}
+			}
+			if (cancelled)
+				flushSubmissions();
+			return cancelled;
+		}
+
 		if (!fdcontext->events)
 			return false;
 
@@ -203,9 +330,7 @@ namespace WebServer {
 
 		int rt = epoll_ctl(m_EpollFd, op, fd, &epevent);
 		if (rt) {
-			std::cout << "epoll_ctl(" << m_EpollFd << ", "
-				<< fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-				<< rt << " (" << errno << ") (" << strerror(errno) << ")";
+			WS_LOG_ERROR("epoll_ctl({}, {}, {}):{} ({}) ({})", m_EpollFd, fd, epevent.events, rt, errno, strerror(errno));
 			return false;
 		}
 
@@ -217,6 +342,10 @@ namespace WebServer {
 			fdcontext->triggerEvent(WRITE);
 			--m_WaitingEventCount;
 		}
+		if (fdcontext->events & ERROR) {
+			fdcontext->triggerEvent(ERROR);
+			--m_WaitingEventCount;
+		}
 
 		WS_ASSERT(fdcontext->events == 0);
 		return true;
@@ -226,15 +355,56 @@ namespace WebServer {
 		return dynamic_cast<IOManager*>(Scheduler::getThis());
 	}
 
+	uint64_t IOManager::getWakeupCount() const {
+		uint64_t count = 0;
+		for (auto& i : m_Notifiers)
+			count += i->wakeups;
+		return count;
+	}
+
+	uint64_t IOManager::getUsefulWakeupCount() const {
+		uint64_t count = 0;
+		for (auto& i : m_Notifiers)
+			count += i->usefulWakeups;
+		return count;
+	}
+
+	bool IOManager::notify(Notifier& notifier) {
+		int expected = Notifier::SLEEPING;
+		if (!notifier.state.compare_exchange_strong(expected, Notifier::NOTIFIED))
+			return false;
+		uint64_t one = 1;
+		int rt = write_f(notifier.eventFd, &one, sizeof(one));
+		WS_ASSERT(rt == sizeof(one));
+		++m_TickleCount;
+		return true;
+	}
+
 	void IOManager::tickle() {
 		if (!hasIdleThreads())
 			return;
-		int rt = write(m_TickleFds[1], "T", 1);
-		WS_ASSERT(rt == 1);
+		// 和idle里设置SLEEPING之后的检查配对, 保证任务入队和睡眠判断不会互相错过
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		size_t count = m_Notifiers.size();
+		size_t start = m_NextTickle++;
+		for (size_t i = 0; i < count; i++) {
+			if (notify(*m_Notifiers[(start + i) % count]))
+				return;
+		}
+	}
+
+	void IOManager::tickleWorker(size_t index) {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		notify(*m_Notifiers[index]);
 	}
 
 	void IOManager::idle() {
-		printf("idle\n");
+		WS_LOG_DEBUG("IOManager::idle");
+		int index = getWorkerIndex();
+		WS_ASSERT(index >= 0);
+		Notifier& notifier = *m_Notifiers[index];
+		int source = m_Backend == EPOLL ? m_EpollFd : m_RingEventFd;
+
 		const uint64_t MAX_EVENTS = 256;
 		epoll_event* events = new epoll_event[MAX_EVENTS]();
 		std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr) {
@@ -244,40 +414,76 @@ namespace WebServer {
 		while (true) {
 			uint64_t nextTimeout = 0;
 			if (stopping(nextTimeout)) {
-				printf("idle stopping exit\n");
+				WS_LOG_DEBUG("IOManager::idle stopping exit");
 				break;
 			}
 
+			// 睡眠之前把攒着的SQE一次提交
+			if (m_Backend == IO_URING)
+				flushSubmissions();
+
+			// 先标记SLEEPING再检查一次任务, 和tickle里的检查配对, 任务入队和睡眠不会互相错过
+			notifier.state.store(Notifier::SLEEPING);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			bool wait = !hasWork(index);
+
+			// 有任务时不睡眠, 但也要不阻塞地看一次I/O, 否则任务一直不断时I/O事件永远得不到处理
 			int rt = 0;
-			do {
+			if (!wait) {
+				do {
+					rt = epoll_wait(notifier.epollFd, events, MAX_EVENTS, 0);
+				} while (rt < 0 && errno == EINTR);
+			}
+			while (wait) {
 				static const int MAX_TIMEOUT = 3000;
 				if (nextTimeout != ~0ull)
 					nextTimeout = (int)nextTimeout > MAX_TIMEOUT ? MAX_TIMEOUT : nextTimeout;
 				else
 					nextTimeout = MAX_TIMEOUT;
-				rt = epoll_wait(m_EpollFd, events, MAX_EVENTS, (int)nextTimeout); // ȴֱ¼߳ʱ
+				rt = epoll_wait(notifier.epollFd, events, MAX_EVENTS, (int)nextTimeout); // 等待直到有事件或者超时
 				if (rt < 0 && errno == EINTR) {
 				}
 				else {
 					break;
 				}
-			} while (true);
-
-			std::vector<std::function<void()>> funcs;
-			listExpiredFunc(funcs);
+			}
+			notifier.state.store(Notifier::RUNNING);
+			// 每轮循环刷新一次本线程的缓存时间, 这一轮的定时器到期判断都用它
+			UpdateCachedMS();
+			bool useful = false;
+
+			std::vector<Task> funcs;
+			std::vector<Fiber::fiberPtr> fibers;
+			listExpiredFunc(funcs, fibers);
 			if (!funcs.empty()) {
 				schedule(funcs.begin(), funcs.end());
 				funcs.clear();
+				useful = true;
 			}
-			
+			if (!fibers.empty()) {
+				schedule(fibers.begin(), fibers.end());
+				fibers.clear();
+				useful = true;
+			}
+
+			bool hasIO = false;
 			for (int i = 0; i < rt; i++) {
-				epoll_event& event = events[i];
-				if (event.data.fd == m_TickleFds[0]) {
-					uint8_t dummy[256];
-					while (read(m_TickleFds[0], dummy, sizeof(dummy)) > 0);
-					continue;
+				if (events[i].data.fd == notifier.eventFd) {
+					uint64_t dummy;
+					while (read_f(notifier.eventFd, &dummy, sizeof(dummy)) > 0);
 				}
+				else if (events[i].data.fd == source) {
+					hasIO = true;
+				}
+			}
+
+			if (hasIO && m_Backend == IO_URING && reapCompletions())
+				useful = true;
 
+			// 共享的epoll可读, 取出就绪的I/O事件(不阻塞)
+			rt = hasIO && m_Backend == EPOLL ? epoll_wait(m_EpollFd, events, MAX_EVENTS, 0) : 0;
+			for (int i = 0; i < rt; i++) {
+				epoll_event& event = events[i];
 				FdContext* fdcontext = (FdContext*)event.data.ptr;
 				FdContext::MutexType::Lock lock(fdcontext->mtx);
 				if (event.events & (EPOLLERR | EPOLLHUP))
@@ -287,8 +493,12 @@ namespace WebServer {
 					realEvents |= READ;
 				if (event.events & EPOLLOUT)
 					realEvents |= WRITE;
+				if (event.events & EPOLLERR)
+					realEvents |= ERROR;
+				// EPOLLERR/EPOLLHUP不管注册没有都会报告, 只触发注册过的事件
+				realEvents &= fdcontext->events;
 
-				if ((fdcontext->events & realEvents) == NONE)
+				if (realEvents == NONE)
 					continue;
 
 				int leftEvents = (fdcontext->events & ~realEvents);
@@ -297,7 +507,7 @@ namespace WebServer {
 
 				int rt2 = epoll_ctl(m_EpollFd, op, fdcontext->fd, &event);
 				if (rt2) {
-					printf("epoll falied in idle\n");
+					WS_LOG_ERROR("epoll_ctl failed in idle fd={} errno={} errstr={}", fdcontext->fd, errno, strerror(errno));
 					continue;
 				}
 
@@ -310,6 +520,18 @@ namespace WebServer {
 					fdcontext->triggerEvent(WRITE);
 					--m_WaitingEventCount;
 				}
+
+				if (realEvents & ERROR) {
+					fdcontext->triggerEvent(ERROR);
+					--m_WaitingEventCount;
+				}
+				useful = true;
+			}
+
+			if (wait) {
+				++notifier.wakeups;
+				if (useful || hasWork(index))
+					++notifier.usefulWakeups;
 			}
 
 			Fiber::fiberPtr cur = Fiber::getThis();
@@ -319,18 +541,237 @@ namespace WebServer {
 		}
 	}
 
+	ssize_t IOManager::submitIO(int fd, const IOArgs& args, uint64_t timeoutMs) {
+		WS_ASSERT(m_Backend == IO_URING);
+		FdContext* fdcontext = getFdContext(fd, true);
+		if (WS_UNLIKELY(!fdcontext)) {
+			SetErrno(EBADF);
+			return -1;
+		}
+
+		IORequest request;
+		request.fdcontext = fdcontext;
+		request.event = (args.op == OP_RECV || args.op == OP_ACCEPT) ? READ : WRITE;
+		if (timeoutMs != (uint64_t)-1) {
+			request.timeout.tv_sec = timeoutMs / 1000;
+			request.timeout.tv_nsec = timeoutMs % 1000 * 1000000;
+		}
+
+		while (true) {
+			request.fiber = Fiber::getThis();
+			request.scheduler = Scheduler::getThis();
+			request.thread = Scheduler::GetTaskThread();
+			request.cancelled = false;
+			{
+				FdContext::MutexType::Lock lock(fdcontext->mtx);
+				FdContext::EventContext& eventContext = fdcontext->getContext(request.event);
+				WS_ASSERT(!eventContext.request);
+				eventContext.request = &request;
+				++m_WaitingEventCount;
+
+				Mutex::Lock lock2(m_SqMtx);
+				io_uring_sqe* sqe = getSqe(timeoutMs != (uint64_t)-1 ? 2 : 1);
+				switch (args.op) {
+				case OP_RECV:
+					sqe->opcode = IORING_OP_RECV;
+					sqe->msg_flags = args.flags;
+					break;
+				case OP_SEND:
+					sqe->opcode = IORING_OP_SEND;
+					sqe->msg_flags = args.flags;
+					break;
+				case OP_ACCEPT:
+					sqe->opcode = IORING_OP_ACCEPT;
+					sqe->addr2 = (uint64_t)(uintptr_t)args.addr2;
+					sqe->accept_flags = args.flags;
+					break;
+				case OP_CONNECT:
+					sqe->opcode = IORING_OP_CONNECT;
+					sqe->off = args.len;
+					break;
+				}
+				sqe->fd = fd;
+				sqe->addr = (uint64_t)(uintptr_t)args.addr;
+				if (args.op == OP_RECV || args.op == OP_SEND)
+					sqe->len = args.len;
+				sqe->user_data = (uint64_t)(uintptr_t)&request | TAG_REQUEST;
+
+				// 超时用链在后面的LINK_TIMEOUT, 到期时内核取消前面的请求, 不需要Timer
+				if (timeoutMs != (uint64_t)-1) {
+					sqe->flags |= IOSQE_IO_LINK;
+					io_uring_sqe* link = getSqe(1);
+					link->opcode = IORING_OP_LINK_TIMEOUT;
+					link->addr = (uint64_t)(uintptr_t)&request.timeout;
+					link->len = 1;
+					link->user_data = TAG_INTERNAL;
+				}
+				if (m_Ring->pending() >= SUBMIT_BATCH)
+					m_Ring->submit();
+			}
+
+			Fiber::YieldToHold();
+
+			int32_t res = request.result;
+			if (res == -ECANCELED) {
+				// 被cancelEvent取消时和epoll后端一样重新等待, 否则就是超时
+				if (request.cancelled)
+					continue;
+				SetErrno(ETIMEDOUT);
+				return -1;
+			}
+			if (res == -EINTR)
+				continue;
+			if (res < 0) {
+				SetErrno(-res);
+				return -1;
+			}
+			return res;
+		}
+	}
+
+	io_uring_sqe* IOManager::getSqe(unsigned n) {
+		m_SqDirty.store(true, std::memory_order_relaxed);
+		io_uring_sqe* sqe = m_Ring->getSqe(n);
+		while (!sqe) {
+			// 提交队列满了, 先把攒着的交给内核
+			m_Ring->submit();
+			sqe = m_Ring->getSqe(n);
+		}
+		return sqe;
+	}
+
+	void IOManager::submitPoll(FdContext* fdcontext, Event event) {
+		FdContext::EventContext& eventContext = fdcontext->getContext(event);
+		++eventContext.seq;
+
+		Mutex::Lock lock(m_SqMtx);
+		io_uring_sqe* sqe = getSqe(1);
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fdcontext->fd;
+		sqe->poll32_events = PollMask(event);
+		sqe->user_data = PollUserData(fdcontext, event, eventContext.seq);
+		if (m_Ring->pending() >= SUBMIT_BATCH)
+			m_Ring->submit();
+	}
+
+	void IOManager::removePoll(FdContext* fdcontext, Event event) {
+		FdContext::EventContext& eventContext = fdcontext->getContext(event);
+		uint64_t userData = PollUserData(fdcontext, event, eventContext.seq);
+		// 序号加一, 之后这个poll再有CQE回来也会被当成过期的忽略掉
+		++eventContext.seq;
+
+		Mutex::Lock lock(m_SqMtx);
+		io_uring_sqe* sqe = getSqe(1);
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->addr = userData;
+		sqe->user_data = TAG_INTERNAL;
+	}
+
+	void IOManager::cancelRequest(IORequest* request) {
+		request->cancelled = true;
+		Mutex::Lock lock(m_SqMtx);
+		io_uring_sqe* sqe = getSqe(1);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = (uint64_t)(uintptr_t)request | TAG_REQUEST;
+		sqe->user_data = TAG_INTERNAL;
+	}
+
+	void IOManager::flushSubmissions() {
+		Mutex::Lock lock(m_SqMtx);
+		m_Ring->submit();
+		m_SqDirty.store(m_Ring->unconsumed() != 0, std::memory_order_relaxed);
+	}
+
+	bool IOManager::reapCompletions() {
+		uint64_t dummy;
+		while (read_f(m_RingEventFd, &dummy, sizeof(dummy)) > 0);
+
+		// 同一时刻只有一个线程收割, 拿不到锁就等, 不能直接跳过, 否则eventfd已经被读掉会丢通知
+		bool useful = false;
+		Mutex::Lock lock(m_CqMtx);
+		m_Ring->reap([this, &useful](uint64_t userData, int32_t res) {
+			if (onCompletion(userData, res))
+				useful = true;
+		});
+		return useful;
+	}
+
+	bool IOManager::onCompletion(uint64_t userData, int32_t res) {
+		uint64_t tag = userData & TAG_MASK;
+		if (tag == TAG_INTERNAL)
+			return false;
+
+		if (tag == TAG_REQUEST) {
+			IORequest* request = (IORequest*)(uintptr_t)(userData & ~TAG_MASK);
+			FdContext* fdcontext = request->fdcontext;
+			{
+				FdContext::MutexType::Lock lock(fdcontext->mtx);
+				FdContext::EventContext& eventContext = fdcontext->getContext(request->event);
+				if (eventContext.request == request)
+					eventContext.request = nullptr;
+			}
+			request->result = res;
+			--m_WaitingEventCount;
+			// schedule之后协程随时可能返回, request在它的栈上, 不能再访问
+			request->scheduler->schedule(&request->fiber, request->thread);
+			return true;
+		}
+
+		FdContext* fdcontext = (FdContext*)(uintptr_t)(userData & PTR_MASK & ~TAG_MASK);
+		Event event = tag == TAG_POLL_READ ? READ : (tag == TAG_POLL_WRITE ? WRITE : ERROR);
+		FdContext::MutexType::Lock lock(fdcontext->mtx);
+		if (!(fdcontext->events & event) || fdcontext->getContext(event).seq != (uint16_t)(userData >> SEQ_SHIFT))
+			return false;
+		fdcontext->triggerEvent(event);
+		--m_WaitingEventCount;
+		return true;
+	}
+
 	bool IOManager::stopping(uint64_t& timeout) {
-		return false;
+		timeout = getNextTimer();
+		return timeout == ~0ull && m_WaitingEventCount == 0 && Scheduler::stopping();
 	}
 
 	bool IOManager::stopping() {
-		// uint64_t timeout = 0;
-		// return stopping(timeout);
-		return false;
+		uint64_t timeout = 0;
+		return stopping(timeout);
+	}
+
+	void IOManager::poll() {
+		// 工作线程一直有任务时不会进idle, 在这里提交攒着的SQE并收割已经完成的CQE, 都不阻塞
+		// 否则挂起在I/O上的协程要等到有线程空闲或者攒满一批才能提交和恢复
+		if (m_Backend == IO_URING) {
+			if (m_SqDirty.load(std::memory_order_relaxed))
+				flushSubmissions();
+			if (m_Ring->hasCompletions())
+				reapCompletions();
+		}
+		if (!hasExpiredTimer())
+			return;
+		UpdateCachedMS();
+		std::vector<Task> funcs;
+		std::vector<Fiber::fiberPtr> fibers;
+		listExpiredFunc(funcs, fibers);
+		if (!funcs.empty())
+			schedule(funcs.begin(), funcs.end());
+		if (!fibers.empty())
+			schedule(fibers.begin(), fibers.end());
 	}
 
 	void IOManager::onTimerInsertedAtFront() {
 		tickle();
 	}
 
-}
\ No newline at end of file
+	void Fiber::sleepFor(uint64_t us) {
+		IOManager* iom = IOManager::getThis();
+		if (!iom) {
+			struct timespec ts;
+			ts.tv_sec = us / 1000000;
+			ts.tv_nsec = (us % 1000000) * 1000;
+			while (nanosleep_f(&ts, &ts) == -1 && errno == EINTR);
+			return;
+		}
+		iom->addSleepTimer(us, getThis());
+		YieldToHold();
+	}
+}
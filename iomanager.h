@@ -1,9 +1,16 @@
 #pragma once
 #include "scheduler.h"
 #include "timer.h"
+#include "fdmanager.h"
+
+#include <memory>
+
+struct io_uring_sqe;
 
 namespace WebServer {
 
+	class IoUring;
+
 	class IOManager : public Scheduler, public TimerManager {
 	public:
 		typedef std::shared_ptr<IOManager> ioManagerPtr;
@@ -12,60 +19,116 @@ namespace WebServer {
 		enum Event {
 			NONE =  0x0,
 			READ =  0x1,
-			WRITE = 0x4
+			WRITE = 0x4,
+			// 错误队列有数据(EPOLLERR), 比如MSG_ZEROCOPY的发送完成通知
+			ERROR = 0x8
+		};
+
+		// I/O后端, 构造时选择; 内核不支持io_uring时自动退回EPOLL
+		enum Backend {
+			EPOLL = 0,
+			IO_URING
+		};
+
+		// io_uring后端支持的完成式操作
+		enum IOOp {
+			OP_RECV = 0,
+			OP_SEND,
+			OP_ACCEPT,
+			OP_CONNECT
+		};
+
+		// 完成式操作的参数, 含义和对应的系统调用一致
+		struct IOArgs {
+			IOOp op;
+			void* addr;     // recv/send的缓冲区, accept/connect的sockaddr
+			uint64_t len;   // 缓冲区长度, connect时为addrlen
+			void* addr2;    // accept的socklen_t*
+			int flags;      // recv/send的flags, accept的accept4 flags
 		};
 		
 	public:
-		IOManager(size_t threads = 1, bool useCaller = true, const std::string& name = "");
+		IOManager(size_t threads = 1, bool useCaller = true, const std::string& name = "", Backend backend = EPOLL);
 		~IOManager();
 
-		int addEvent(int fd, Event event, std::function<void()> func = nullptr);
+		int addEvent(int fd, Event event, Task func = nullptr);
 		bool delEvent(int fd, Event event);
 		bool cancelEvent(int fd, Event event);
 		bool cancelAll(int fd);
 
+		/*
+		* @brief 提交一个完成式I/O请求并挂起当前协程, 只能在IO_URING后端的协程里调用
+		*        被cancelEvent取消时和epoll后端一样重新提交, 只有超时才返回
+		* @param[in] timeoutMs 超时时间, -1表示不超时
+		* @return 和对应系统调用一致, 失败返回-1并设置errno, 超时为ETIMEDOUT
+		*/
+		ssize_t submitIO(int fd, const IOArgs& args, uint64_t timeoutMs);
+
+		Backend getBackend() const { return m_Backend; }
+
 		static IOManager* getThis();
 
+		// tickle实际写eventfd的次数 / idle被唤醒的次数 / 唤醒后确实有事可做的次数
+		uint64_t getTickleCount() const { return m_TickleCount; }
+		uint64_t getWakeupCount() const;
+		uint64_t getUsefulWakeupCount() const;
+
 	protected:
 		void idle() override;
+		void poll() override;
 		bool stopping() override;
 		void tickle() override;
+		void tickleWorker(size_t index) override;
 		void onTimerInsertedAtFront() override;
+		bool hookEnabled() const override { return true; }
 
-		void contextResize(size_t size);
 		bool stopping(uint64_t& timeout);
 		
 	private:
-		struct FdContext {
-			typedef Mutex MutexType;
+		// 每个fd的事件上下文和hook的fd记录是同一个对象, 存放在FdManager里
+		typedef WebServer::FdContext FdContext;
 
-			struct EventContext {
-				Scheduler* scheduler = nullptr;
-				Fiber::fiberPtr fiber;
-				std::function<void()> func;
+		// 每个工作线程一个唤醒器: 私有epoll里放自己的eventfd和共享的m_EpollFd(EPOLLEXCLUSIVE)
+		// I/O就绪时只唤醒一个线程, tickle也只唤醒一个空闲线程或者指定的线程
+		struct alignas(64) Notifier {
+			enum State {
+				RUNNING = 0,
+				SLEEPING,
+				NOTIFIED
 			};
 
-			EventContext& getContext(Event event);
-			void resetContext(EventContext& context);
-			void triggerEvent(Event event);
-			
-			/// ¼
-			EventContext read;
-			/// д¼
-			EventContext write;
-			/// ¼ľ
-			int fd = 0;
-			/// ǰ¼
-			Event events = NONE;
-			/// ¼Mutex
-			MutexType mtx;
+			int epollFd = -1;
+			int eventFd = -1;
+			std::atomic<int> state{ RUNNING };
+			std::atomic<uint64_t> wakeups{ 0 };
+			std::atomic<uint64_t> usefulWakeups{ 0 };
 		};
 
-		int m_EpollFd = 0;
-		int m_TickleFds[2];
-		std::atomic<size_t> m_WaitingEventCount{ 0 }; // ǰȴִе¼
-		RWMutexType m_Mtx;
-	public:
-		std::vector<FdContext*> m_FdContexts;
+		bool notify(Notifier& notifier);
+
+		FdContext* getFdContext(int fd, bool autoCreate);
+
+		// io_uring后端: SQE先攒在提交队列里, 工作线程空闲前或者攒满一批时一次提交
+		bool initRing();
+		io_uring_sqe* getSqe(unsigned n);
+		void submitPoll(FdContext* fdcontext, Event event);
+		void removePoll(FdContext* fdcontext, Event event);
+		void cancelRequest(IORequest* request);
+		void flushSubmissions();
+		bool reapCompletions();
+		bool onCompletion(uint64_t userData, int32_t res);
+
+		Backend m_Backend;
+		int m_EpollFd = -1;
+		std::unique_ptr<IoUring> m_Ring;
+		int m_RingEventFd = -1;
+		Mutex m_SqMtx;
+		// 提交队列里有没交给内核的SQE, poll不加锁先看它
+		std::atomic<bool> m_SqDirty{ false };
+		Mutex m_CqMtx;
+		std::vector<std::unique_ptr<Notifier>> m_Notifiers;
+		std::atomic<size_t> m_NextTickle{ 0 };
+		std::atomic<uint64_t> m_TickleCount{ 0 };
+		std::atomic<size_t> m_WaitingEventCount{ 0 }; // 当前等待执行的事件数量
 	};
 }
\ No newline at end of file
@@ -0,0 +1,323 @@
+#include "log.h"
+#include "mutex.h"
+#include "thread.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace WebServer {
+
+	// 每个线程缓冲区的记录数, 2的幂
+	static const size_t LOG_BUFFER_RECORDS = 1024;
+	// 格式化结果攒到这么多字节就write一次
+	static const size_t LOG_WRITE_BATCH = 64 * 1024;
+	// 后台线程没有日志可写时的最长睡眠时间
+	static const uint64_t LOG_MAX_IDLE_US = 10 * 1000;
+
+	std::atomic<int> Logger::s_Level{ WS_LOG_LEVEL };
+	uint64_t (*Logger::s_FiberIdGetter)() = nullptr;
+	static std::atomic<uint64_t> s_DroppedCount{ 0 };
+
+	/*
+	* @brief 一个线程的日志缓冲区, 单生产者单消费者
+	*        生产者是所属线程, 消费者是持有LogManager::flushMtx的线程
+	*        线程退出时标记closed, 消费者写完剩下的日志后释放
+	*/
+	struct LogBuffer {
+		LogRecord records[LOG_BUFFER_RECORDS];
+		alignas(64) std::atomic<uint64_t> head{ 0 };
+		// 生产者缓存的tail, 只有缓冲区看起来满了才重新读一次
+		uint64_t cachedTail = 0;
+		std::atomic<uint64_t> dropped{ 0 };
+		alignas(64) std::atomic<uint64_t> tail{ 0 };
+		// 消费者已经报告过的丢弃数
+		uint64_t reportedDropped = 0;
+		std::atomic<bool> closed{ false };
+		uint32_t threadId = 0;
+	};
+
+	struct LogBufferHolder {
+		~LogBufferHolder() {
+			destroyed = true;
+			if (buffer)
+				buffer->closed.store(true, std::memory_order_release);
+		}
+
+		LogBuffer* buffer = nullptr;
+		static thread_local bool destroyed;
+	};
+
+	thread_local bool LogBufferHolder::destroyed = false;
+	static thread_local LogBufferHolder t_LogBuffer;
+
+	struct LogManager {
+		Mutex listMtx;
+		std::vector<LogBuffer*> buffers;
+		// 同一时刻只有一个消费者
+		Mutex flushMtx;
+		std::string out;
+		std::atomic<int> fd{ STDOUT_FILENO };
+		std::atomic<bool> stopping{ false };
+		Thread* flusher = nullptr;
+		// 上一次格式化时间用的秒和对应的字符串
+		time_t lastSecond = -1;
+		char secondBuf[32];
+
+		void registerBuffer(LogBuffer* buffer) {
+			Mutex::Lock lock(listMtx);
+			buffers.push_back(buffer);
+		}
+
+		size_t flush();
+		size_t drain(LogBuffer* buffer);
+		void format(const LogRecord& record, uint32_t threadId);
+		void writeOut();
+		void run();
+	};
+
+	static void ShutdownLogger();
+
+	static LogManager* CreateLogManager() {
+		LogManager* manager = new LogManager;
+		manager->out.reserve(LOG_WRITE_BATCH * 2);
+		manager->flusher = new Thread([manager]() { manager->run(); }, "log");
+		atexit(&ShutdownLogger);
+		return manager;
+	}
+
+	// 第一次写日志时创建, 不析构, 退出时由atexit停掉后台线程并写完剩下的日志
+	static LogManager* GetLogManager() {
+		static LogManager* manager = CreateLogManager();
+		return manager;
+	}
+
+	static void ShutdownLogger() {
+		LogManager* manager = GetLogManager();
+		manager->stopping = true;
+		manager->flusher->join();
+		manager->flush();
+	}
+
+	void LogManager::run() {
+		uint64_t idleUs = 1000;
+		while (!stopping) {
+			if (flush()) {
+				idleUs = 1000;
+				continue;
+			}
+			usleep(idleUs);
+			if (idleUs < LOG_MAX_IDLE_US)
+				idleUs *= 2;
+		}
+	}
+
+	size_t LogManager::flush() {
+		Mutex::Lock lock(flushMtx);
+		std::vector<LogBuffer*> snapshot;
+		{
+			Mutex::Lock lock2(listMtx);
+			snapshot = buffers;
+		}
+
+		size_t count = 0;
+		for (auto buffer : snapshot) {
+			// 先读closed再取日志, closed之后不会再有新日志, 取完就可以释放
+			bool closed = buffer->closed.load(std::memory_order_acquire);
+			count += drain(buffer);
+			if (!closed)
+				continue;
+			{
+				Mutex::Lock lock2(listMtx);
+				for (size_t i = 0; i < buffers.size(); i++) {
+					if (buffers[i] == buffer) {
+						buffers[i] = buffers.back();
+						buffers.pop_back();
+						break;
+					}
+				}
+			}
+			delete buffer;
+		}
+		writeOut();
+		return count;
+	}
+
+	size_t LogManager::drain(LogBuffer* buffer) {
+		uint64_t tail = buffer->tail.load(std::memory_order_relaxed);
+		uint64_t head = buffer->head.load(std::memory_order_acquire);
+		for (uint64_t i = tail; i != head; i++) {
+			format(buffer->records[i & (LOG_BUFFER_RECORDS - 1)], buffer->threadId);
+			if (out.size() >= LOG_WRITE_BATCH)
+				writeOut();
+		}
+		buffer->tail.store(head, std::memory_order_release);
+
+		uint64_t dropped = buffer->dropped.load(std::memory_order_relaxed);
+		if (dropped != buffer->reportedDropped) {
+			char line[128];
+			int len = snprintf(line, sizeof(line), "WARN  log: thread %u dropped %" PRIu64 " records, buffer full\n",
+				buffer->threadId, dropped - buffer->reportedDropped);
+			out.append(line, len);
+			buffer->reportedDropped = dropped;
+		}
+		return head - tail;
+	}
+
+	static const char* s_LevelNames[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+	// 把一个编码过的参数追加到out, 返回下一个参数的位置
+	static const char* AppendArg(std::string& out, const char* ptr) {
+		char buf[64];
+		int len = 0;
+		uint8_t tag = *ptr++;
+		switch (tag) {
+		case LogRecord::TAG_BOOL:
+			out.append(*ptr ? "true" : "false");
+			return ptr + 1;
+		case LogRecord::TAG_INT: {
+			int64_t v;
+			memcpy(&v, ptr, sizeof(v));
+			len = snprintf(buf, sizeof(buf), "%" PRId64, v);
+			out.append(buf, len);
+			return ptr + sizeof(v);
+		}
+		case LogRecord::TAG_UINT: {
+			uint64_t v;
+			memcpy(&v, ptr, sizeof(v));
+			len = snprintf(buf, sizeof(buf), "%" PRIu64, v);
+			out.append(buf, len);
+			return ptr + sizeof(v);
+		}
+		case LogRecord::TAG_DOUBLE: {
+			double v;
+			memcpy(&v, ptr, sizeof(v));
+			len = snprintf(buf, sizeof(buf), "%g", v);
+			out.append(buf, len);
+			return ptr + sizeof(v);
+		}
+		case LogRecord::TAG_STR: {
+			uint16_t n;
+			memcpy(&n, ptr, sizeof(n));
+			out.append(ptr + sizeof(n), n);
+			return ptr + sizeof(n) + n;
+		}
+		case LogRecord::TAG_PTR: {
+			const void* v;
+			memcpy(&v, ptr, sizeof(v));
+			len = snprintf(buf, sizeof(buf), "%p", v);
+			out.append(buf, len);
+			return ptr + sizeof(v);
+		}
+		default:
+			return nullptr;
+		}
+	}
+
+	// 时间 级别 线程 协程 文件:行 消息
+	void LogManager::format(const LogRecord& record, uint32_t threadId) {
+		time_t second = record.time / 1000000;
+		if (second != lastSecond) {
+			struct tm tm;
+			localtime_r(&second, &tm);
+			strftime(secondBuf, sizeof(secondBuf), "%Y-%m-%d %H:%M:%S", &tm);
+			lastSecond = second;
+		}
+		const char* file = strrchr(record.file, '/');
+		file = file ? file + 1 : record.file;
+		char head[160];
+		int len = snprintf(head, sizeof(head), "%s.%06u %s %u %" PRIu64 " %s:%u ", secondBuf, (unsigned)(record.time % 1000000),
+			s_LevelNames[record.level], threadId, record.fiberId, file, record.line);
+		out.append(head, len);
+
+		const char* arg = record.data;
+		int argc = record.argc;
+		for (const char* p = record.fmt; *p; p++) {
+			if (p[0] == '{' && p[1] == '}') {
+				if (argc > 0 && arg) {
+					arg = AppendArg(out, arg);
+					--argc;
+				}
+				else
+					out.append("{?}");
+				p++;
+				continue;
+			}
+			out.push_back(*p);
+		}
+		out.push_back('\n');
+	}
+
+	void LogManager::writeOut() {
+		const char* ptr = out.data();
+		size_t left = out.size();
+		while (left) {
+			ssize_t n = ::write(fd, ptr, left);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			ptr += n;
+			left -= n;
+		}
+		out.clear();
+	}
+
+	void Logger::SetFd(int fd) {
+		GetLogManager()->fd = fd;
+	}
+
+	void Logger::Flush() {
+		GetLogManager()->flush();
+	}
+
+	uint64_t Logger::GetDroppedCount() {
+		return s_DroppedCount.load(std::memory_order_relaxed);
+	}
+
+	LogRecord* Logger::BeginRecord(Level level, const char* file, int line, const char* fmt) {
+		if (WS_UNLIKELY(LogBufferHolder::destroyed))
+			return nullptr;
+		LogBuffer* buffer = t_LogBuffer.buffer;
+		if (WS_UNLIKELY(!buffer)) {
+			buffer = new LogBuffer;
+			buffer->threadId = GetThreadId();
+			GetLogManager()->registerBuffer(buffer);
+			t_LogBuffer.buffer = buffer;
+		}
+
+		uint64_t head = buffer->head.load(std::memory_order_relaxed);
+		if (WS_UNLIKELY(head - buffer->cachedTail >= LOG_BUFFER_RECORDS)) {
+			buffer->cachedTail = buffer->tail.load(std::memory_order_acquire);
+			if (head - buffer->cachedTail >= LOG_BUFFER_RECORDS) {
+				buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+				s_DroppedCount.fetch_add(1, std::memory_order_relaxed);
+				return nullptr;
+			}
+		}
+
+		LogRecord* record = &buffer->records[head & (LOG_BUFFER_RECORDS - 1)];
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		record->time = ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+		record->fiberId = s_FiberIdGetter ? s_FiberIdGetter() : 0;
+		record->file = file;
+		record->fmt = fmt;
+		record->line = line;
+		record->level = level;
+		record->argc = 0;
+		record->size = 0;
+		return record;
+	}
+
+	void Logger::CommitRecord() {
+		LogBuffer* buffer = t_LogBuffer.buffer;
+		buffer->head.store(buffer->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include "core.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+
+// 编译期日志级别, 低于WS_LOG_LEVEL的日志语句连同参数求值一起被编译器去掉
+#define WS_LOG_LEVEL_DEBUG 0
+#define WS_LOG_LEVEL_INFO  1
+#define WS_LOG_LEVEL_WARN  2
+#define WS_LOG_LEVEL_ERROR 3
+#define WS_LOG_LEVEL_OFF   4
+
+#ifndef WS_LOG_LEVEL
+	#define WS_LOG_LEVEL WS_LOG_LEVEL_INFO
+#endif
+
+// 格式串里的每个{}依次替换成一个参数, 格式串必须是字符串字面量, 后台线程格式化时才读它
+#define WS_LOG(level, ...) \
+	do { \
+		if ((level) >= WS_LOG_LEVEL && WebServer::Logger::IsEnabled((WebServer::Logger::Level)(level))) \
+			WebServer::Logger::Write((WebServer::Logger::Level)(level), __FILE__, __LINE__, __VA_ARGS__); \
+	} while (0)
+
+#define WS_LOG_DEBUG(...) WS_LOG(WS_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define WS_LOG_INFO(...)  WS_LOG(WS_LOG_LEVEL_INFO, __VA_ARGS__)
+#define WS_LOG_WARN(...)  WS_LOG(WS_LOG_LEVEL_WARN, __VA_ARGS__)
+#define WS_LOG_ERROR(...) WS_LOG(WS_LOG_LEVEL_ERROR, __VA_ARGS__)
+
+namespace WebServer {
+
+	static const size_t LOG_RECORD_SIZE = 256;
+
+	// 环形缓冲区里的一条日志, 参数按类型编码在data里, 由后台线程格式化
+	struct LogRecord {
+		uint64_t time;      // 墙上时间, 微秒
+		uint64_t fiberId;   // 不在协程里时为0
+		const char* file;
+		const char* fmt;
+		uint32_t line;
+		uint8_t level;
+		uint8_t argc;
+		uint16_t size;      // data里已经使用的字节数
+		char data[LOG_RECORD_SIZE - 40];
+
+		enum Tag : uint8_t {
+			TAG_BOOL,
+			TAG_INT,
+			TAG_UINT,
+			TAG_DOUBLE,
+			TAG_STR,
+			TAG_PTR
+		};
+	};
+
+	// 把参数写进LogRecord::data, 写不下的参数丢掉, 字符串按剩余空间截断
+	class LogEncoder {
+	public:
+		LogEncoder(LogRecord* record)
+			: m_Record(record)
+		{
+		}
+
+		void put(bool v) { putValue(LogRecord::TAG_BOOL, (uint8_t)v); }
+		void put(double v) { putValue(LogRecord::TAG_DOUBLE, v); }
+		void put(const void* v) { putValue(LogRecord::TAG_PTR, v); }
+		void put(const char* v) { putString(v ? v : "(null)", v ? strlen(v) : 6); }
+		void put(const std::string& v) { putString(v.data(), v.size()); }
+
+		template<typename T>
+		typename std::enable_if<(std::is_integral<T>::value || std::is_enum<T>::value) && !std::is_same<T, bool>::value>::type
+		put(T v) {
+			if (std::is_signed<T>::value || std::is_enum<T>::value)
+				putValue(LogRecord::TAG_INT, (int64_t)v);
+			else
+				putValue(LogRecord::TAG_UINT, (uint64_t)v);
+		}
+
+		template<typename T>
+		typename std::enable_if<std::is_floating_point<T>::value && !std::is_same<T, double>::value>::type
+		put(T v) { put((double)v); }
+
+	private:
+		template<typename T>
+		void putValue(uint8_t tag, T v) {
+			if (m_Record->size + 1 + sizeof(T) > sizeof(m_Record->data))
+				return;
+			char* ptr = m_Record->data + m_Record->size;
+			*ptr = tag;
+			memcpy(ptr + 1, &v, sizeof(T));
+			m_Record->size += 1 + sizeof(T);
+			++m_Record->argc;
+		}
+
+		void putString(const char* str, size_t len) {
+			size_t left = sizeof(m_Record->data) - m_Record->size;
+			if (left < 1 + sizeof(uint16_t))
+				return;
+			if (len > left - 1 - sizeof(uint16_t))
+				len = left - 1 - sizeof(uint16_t);
+			uint16_t len16 = (uint16_t)len;
+			char* ptr = m_Record->data + m_Record->size;
+			*ptr = LogRecord::TAG_STR;
+			memcpy(ptr + 1, &len16, sizeof(len16));
+			memcpy(ptr + 1 + sizeof(len16), str, len);
+			m_Record->size += 1 + sizeof(len16) + len;
+			++m_Record->argc;
+		}
+
+	private:
+		LogRecord* m_Record;
+	};
+
+	/*
+	* @brief 异步日志
+	*        每个线程一个无锁的单生产者环形缓冲区, 写日志只拷贝参数, 不格式化、不加锁、不做系统调用
+	*        后台线程轮询所有缓冲区, 格式化后批量write; 缓冲区满时丢弃新日志并计数, 不阻塞调用方
+	*        不同线程的日志之间不保证按时间排序
+	*/
+	class Logger {
+	public:
+		enum Level {
+			DEBUG = WS_LOG_LEVEL_DEBUG,
+			INFO = WS_LOG_LEVEL_INFO,
+			WARN = WS_LOG_LEVEL_WARN,
+			ERROR = WS_LOG_LEVEL_ERROR
+		};
+
+		// 运行时级别, 只能在编译期级别的基础上再提高
+		static bool IsEnabled(Level level) { return level >= s_Level.load(std::memory_order_relaxed); }
+		static void SetLevel(Level level) { s_Level.store(level, std::memory_order_relaxed); }
+		static Level GetLevel() { return (Level)s_Level.load(std::memory_order_relaxed); }
+
+		// 日志写到哪个fd, 默认标准输出
+		static void SetFd(int fd);
+
+		// 在调用线程里把所有缓冲区中的日志格式化并写出, 进程退出和断言失败之前调用
+		static void Flush();
+
+		// 因为缓冲区满丢弃的日志总数
+		static uint64_t GetDroppedCount();
+
+		// 取当前协程id的函数, fiber.cpp在静态初始化时设置, 只链接了ByteArray等模块时日志里的协程id为0
+		static void SetFiberIdGetter(uint64_t (*getter)()) { s_FiberIdGetter = getter; }
+
+		template<typename... Args>
+		static void Write(Level level, const char* file, int line, const char* fmt, const Args&... args) {
+			LogRecord* record = BeginRecord(level, file, line, fmt);
+			if (WS_UNLIKELY(!record))
+				return;
+			LogEncoder encoder(record);
+			(encoder.put(args), ...);
+			CommitRecord();
+		}
+
+	private:
+		// 取本线程缓冲区的下一个空位并填好头部, 缓冲区满时返回nullptr
+		static LogRecord* BeginRecord(Level level, const char* file, int line, const char* fmt);
+		static void CommitRecord();
+
+	private:
+		static std::atomic<int> s_Level;
+		static uint64_t (*s_FiberIdGetter)();
+	};
+}
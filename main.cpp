@@ -1,6 +1,7 @@
 ﻿#include "iomanager.h"
 #include "address.h"
 #include "socket.h"
+#include "ByteArray.h"
 #include "hook.h"
 #include <unistd.h>
 #include <vector>
@@ -58,16 +59,15 @@ void TestConnect() {
         return;
     }
 
-    std::string buffs;
-    buffs.resize(4096);
-    rt = sock->receive(&buffs[0], buffs.size());
+    WebServer::ByteArray ba;
+    rt = sock->readInto(ba, 4096);
     if (rt <= 0) {
         std::cout << "receive failed rt=" << rt << std::endl;
         return;
     }
 
-    buffs.resize(rt);
-    std::cout << buffs << std::endl;
+    ba.setPosition(0);
+    std::cout << ba.toString() << std::endl;
 }
 
 
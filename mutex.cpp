@@ -12,7 +12,7 @@ namespace WebServer {
 		sem_destroy(&m_Semaphore);
 	}
 	
-	// sem_waitɹ0,ʧܷ-1
+	// sem_wait成功返回0,失败返回-1
 	void Semaphore::wait() {
 		if (sem_wait(&m_Semaphore)) {
 			throw std::logic_error("sem_wait error");
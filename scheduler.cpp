@@ -1,18 +1,30 @@
 #include "scheduler.h"
 #include "core.h"
+#include "hook.h"
+#include "log.h"
 #include "utils.h"
 
 namespace WebServer {
 
 	static thread_local Scheduler* s_Scheduler = nullptr;
 	static thread_local Fiber* s_SchedulerFiber = nullptr;
+	static thread_local void* s_Worker = nullptr;
+	// 正在执行的任务指定的线程
+	static thread_local int s_TaskThread = -1;
 	
-	// useCaller: Ƿ񵥶һ߳+ЭΪȡר
+	// useCaller: 是否单独开一个线程+协程作为调取器的专属
 	Scheduler::Scheduler(size_t threads, bool useCaller, const std::string& name)
 		: m_Name(name)
 	{
 		WS_ASSERT(threads > 0);
 
+		m_Workers.resize(threads);
+		for (size_t i = 0; i < m_Workers.size(); i++) {
+			m_Workers[i].reset(new Worker);
+			m_Workers[i]->scheduler = this;
+			m_Workers[i]->index = i;
+		}
+
 		if (useCaller) {
 			WebServer::Fiber::getThis();
 			--threads;
@@ -20,13 +32,16 @@ namespace WebServer {
 			WS_ASSERT(getThis() == nullptr);
 			s_Scheduler = this;
 
-			m_RootFiber.reset(new Fiber(std::bind(&Scheduler::run, this), 0, true));
+			m_RootFiber.reset(new Fiber(std::bind(&Scheduler::run, this, 0), 0, true));
 			Thread::setName(m_Name);
 
 			s_SchedulerFiber = m_RootFiber.get();
 			m_RootThread = GetThreadId();
 
 			m_ThreadIds.push_back(m_RootThread);
+			// 根协程跑在当前线程上, 当前线程就是0号Worker的所有者
+			m_Workers[0]->threadId = m_RootThread;
+			s_Worker = m_Workers[0].get();
 		}
 		else {
 			m_RootThread = -1;
@@ -38,6 +53,22 @@ namespace WebServer {
 		WS_ASSERT(m_Stopping);
 		if (this == getThis())
 			s_Scheduler = nullptr;
+
+		for (auto& w : m_Workers) {
+			if (s_Worker == w.get())
+				s_Worker = nullptr;
+			FiberAndThread* ft = nullptr;
+			while (w->queue.steal(ft))
+				delete ft;
+			for (auto i : w->pinned)
+				delete i;
+			ft = w->inbox.exchange(nullptr);
+			while (ft) {
+				FiberAndThread* next = ft->next;
+				delete ft;
+				ft = next;
+			}
+		}
 	}
 
 	Scheduler* Scheduler::getThis() {
@@ -52,9 +83,12 @@ namespace WebServer {
 		return s_SchedulerFiber;
 	}
 
+	int Scheduler::GetTaskThread() {
+		return s_TaskThread;
+	}
+
 	bool Scheduler::stopping() {
-		MutexType::Lock lock(m_Mtx);
-		return m_AutoStop && m_Stopping && m_Fibers.empty() && m_ActiveThreadCount == 0;
+		return m_AutoStop && m_Stopping && m_PendingCount == 0 && m_ActiveThreadCount == 0;
 	}
 
 	void Scheduler::stop() {
@@ -74,7 +108,7 @@ namespace WebServer {
 		if (m_RootFiber)
 			tickle();
 
-		// Ϊ֮ǰrootFiberûб,оrootFiberɨβ
+		// 因为之前rootFiber没有被调用,感觉这里rootFiber是用来扫尾的
 		if (m_RootFiber) {
 			if (!stopping())
 				m_RootFiber->call();
@@ -93,119 +127,288 @@ namespace WebServer {
 
 	void Scheduler::start() {
 		MutexType::Lock lock(m_Mtx);
-		if (!m_Stopping)                 // m_Stopping=falseѾ
+		if (!m_Stopping)                 // m_Stopping=false表明已经启动了
 			return;
 		m_Stopping = true;
 		WS_ASSERT(m_Threads.empty());
 
+		size_t offset = m_RootFiber ? 1 : 0;
 		m_Threads.resize(m_ThreadCount);
 		for (size_t i = 0; i < m_ThreadCount; i++) {
-			m_Threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_Name + "_" + std::to_string(i)));
+			m_Threads[i].reset(new Thread(std::bind(&Scheduler::run, this, i + offset), m_Name + "_" + std::to_string(i)));
 			m_ThreadIds.push_back(m_Threads[i]->getId());
+			m_Workers[i + offset]->threadId = m_Threads[i]->getId();
 		}
 		lock.unlock();
 	}
 
 	void Scheduler::idle() {
-		printf("idle\n");
+		WS_LOG_DEBUG("Scheduler::idle");
 		while (!stopping())
 			Fiber::YieldToHold();
 	}
 
 	void Scheduler::tickle() {
-		printf("tickle\n");
+		WS_LOG_DEBUG("Scheduler::tickle");
 	}
 
-	// Э̵ڵ̵߳runûеõ
-	void Scheduler::run() {
+	void Scheduler::tickleWorker(size_t index) {
+		tickle();
+	}
+
+	int Scheduler::getWorkerIndex() const {
+		Worker* self = (Worker*)s_Worker;
+		if (!self || self->scheduler != this)
+			return -1;
+		return self->index;
+	}
+
+	bool Scheduler::hasWork(size_t index) const {
+		const Worker* self = m_Workers[index].get();
+		if (self->inbox.load(std::memory_order_seq_cst) || !self->pinned.empty())
+			return true;
+		for (auto& i : m_Workers) {
+			if (!i->queue.empty())
+				return true;
+		}
+		return false;
+	}
+
+	uint64_t Scheduler::getLocalTaskCount() const {
+		uint64_t count = 0;
+		for (auto& i : m_Workers)
+			count += i->localCount.load(std::memory_order_relaxed);
+		return count;
+	}
+
+	uint64_t Scheduler::getStolenTaskCount() const {
+		uint64_t count = 0;
+		for (auto& i : m_Workers)
+			count += i->stolenCount.load(std::memory_order_relaxed);
+		return count;
+	}
+
+	std::ostream& Scheduler::dump(std::ostream& os) const {
+		os << "[Scheduler name=" << m_Name
+		   << " pending=" << m_PendingCount
+		   << " local=" << getLocalTaskCount()
+		   << " stolen=" << getStolenTaskCount();
+		for (size_t i = 0; i < m_Workers.size(); i++) {
+			os << " worker" << i << "(thread=" << m_Workers[i]->threadId
+			   << " local=" << m_Workers[i]->localCount
+			   << " stolen=" << m_Workers[i]->stolenCount << ")";
+		}
+		os << "]";
+		return os;
+	}
+
+	Scheduler::Worker* Scheduler::getWorker(int thread) const {
+		for (auto& i : m_Workers) {
+			if (i->threadId == thread)
+				return i.get();
+		}
+		return nullptr;
+	}
+
+	bool Scheduler::enqueue(FiberAndThread* ft) {
+		bool needTickle = m_PendingCount.fetch_add(1) == 0;
+		Worker* self = (Worker*)s_Worker;
+		if (self && self->scheduler != this)
+			self = nullptr;
+
+		Worker* target = nullptr;
+		if (ft->thread != -1) {
+			target = getWorker(ft->thread);
+			// 指定的线程不属于本调度器, 按不指定线程处理
+			if (!target)
+				ft->thread = -1;
+		}
+
+		if (self && ft->thread == -1) {
+			self->queue.push(ft);
+			return needTickle;
+		}
+		if (self && target == self) {
+			self->pinned.push_back(ft);
+			return needTickle;
+		}
+
+		// 其他线程的任务或者外部线程投递的任务, 放进目标Worker的inbox, 由它自己取出
+		if (!target)
+			target = m_Workers[m_NextWorker++ % m_Workers.size()].get();
+		FiberAndThread* head = target->inbox.load(std::memory_order_relaxed);
+		do {
+			ft->next = head;
+		} while (!target->inbox.compare_exchange_weak(head, ft, std::memory_order_seq_cst, std::memory_order_relaxed));
+		// inbox里的任务只能由它自己取出, 只唤醒这一个线程
+		tickleWorker(target->index);
+		return false;
+	}
+
+	void Scheduler::drainInbox(Worker* self) {
+		if (!self->inbox.load(std::memory_order_relaxed))
+			return;
+		FiberAndThread* ft = self->inbox.exchange(nullptr, std::memory_order_acquire);
+
+		// 无锁栈是后进先出的, 先反转成投递顺序
+		FiberAndThread* head = nullptr;
+		while (ft) {
+			FiberAndThread* next = ft->next;
+			ft->next = head;
+			head = ft;
+			ft = next;
+		}
+
+		while (head) {
+			FiberAndThread* next = head->next;
+			head->next = nullptr;
+			if (head->thread != -1)
+				self->pinned.push_back(head);
+			else
+				self->queue.push(head);
+			head = next;
+		}
+	}
+
+	Scheduler::FiberAndThread* Scheduler::take(Worker* self) {
+		drainInbox(self);
+
+		FiberAndThread* ft = nullptr;
+		if (!self->pinned.empty()) {
+			ft = self->pinned.front();
+			self->pinned.pop_front();
+		}
+		else {
+			bool abort = false;
+			do {
+				abort = false;
+				if (self->queue.steal(ft, &abort))
+					break;
+				ft = nullptr;
+			} while (abort);
+		}
+
+		// 先计入活动线程再减待执行数, stopping()不会看到两者同时为0而任务还在手里
+		if (ft) {
+			self->localCount.fetch_add(1, std::memory_order_relaxed);
+			++m_ActiveThreadCount;
+			--m_PendingCount;
+			return ft;
+		}
+
+		// 本线程没有任务了, 从其他线程的队列尾部偷
+		size_t count = m_Workers.size();
+		for (size_t i = 1; i < count; i++) {
+			Worker* victim = m_Workers[(self->index + i) % count].get();
+			bool abort = false;
+			do {
+				abort = false;
+				if (victim->queue.steal(ft, &abort)) {
+					self->stolenCount.fetch_add(1, std::memory_order_relaxed);
+					++m_ActiveThreadCount;
+					--m_PendingCount;
+					return ft;
+				}
+			} while (abort);
+		}
+		return nullptr;
+	}
+
+	// 协程调度器所在的线程的run函数是没有调用的
+	void Scheduler::run(size_t index) {
 		setThis();
+		// 协程可能被其他线程偷走执行, hook开关是线程局部的, 每个工作线程都要打开
+		// 只有IOManager的工作线程打开, 退出时恢复, use_caller的调用线程stop之后还是原来的设置
+		bool hookEnable = isHookEnable();
+		if (hookEnabled())
+			setHookEnable(true);
+		Worker* self = m_Workers[index].get();
+		s_Worker = self;
+		self->threadId = GetThreadId();
 		if (GetThreadId() != m_RootThread)
 			s_SchedulerFiber = Fiber::getThis().get();
 
 		Fiber::fiberPtr idleFiber(new Fiber(std::bind(&Scheduler::idle, this)));
 		Fiber::fiberPtr funcFiber;
 
-		FiberAndThread ft;
 		while (true) {
-			ft.reset();
-			bool tickleMe = false;
-			bool isActive = false;
-
-			{
-				MutexType::Lock lock(m_Mtx);
-				auto it = m_Fibers.begin();
-				while (it != m_Fibers.end()) {
-					// Ӧ߳ϵõЭ
-					if (it->thread != -1 && it->thread != GetThreadId()) {
-						++it;
-						tickleMe = true;
-						continue;
-					}
-
-					// Э
-					WS_ASSERT(it->fiber || it->func);
-					if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
-						it++;
-						continue;
-					}
-
-					// ȡЭִ
-					ft = *it;
-					m_Fibers.erase(it++);
-					++m_ActiveThreadCount;
-					isActive = true;
-					break;
-				}
-				// ûеһ,ɹȡ,һ
-				tickleMe |= (it != m_Fibers.end());
+			poll();
+			FiberAndThread* ft = take(self);
+
+			// 协程还在其他线程上执行(还没有切出去), 放回本线程队列稍后再取
+			// 同样先加回待执行数再减活动线程数
+			if (ft && ft->fiber && ft->fiber->getState() == Fiber::EXEC) {
+				++m_PendingCount;
+				--m_ActiveThreadCount;
+				if (ft->thread != -1)
+					self->pinned.push_back(ft);
+				else
+					self->queue.push(ft);
+				continue;
 			}
 
-			if (tickleMe)
+			// 本线程还有能被偷的任务, 唤醒空闲线程来偷; pinned里的任务只能本线程执行, 唤醒别人没用
+			if (!self->queue.empty() || self->inbox.load(std::memory_order_relaxed))
 				tickle();
 
-			if (ft.fiber && (ft.fiber->getState() != Fiber::TERM) && ft.fiber->getState() != Fiber::EXCEPT) {
-				ft.fiber->swapIn();
+			if (ft && ft->fiber && (ft->fiber->getState() != Fiber::TERM) && ft->fiber->getState() != Fiber::EXCEPT) {
+				s_TaskThread = ft->thread;
+				ft->fiber->swapIn();
+				s_TaskThread = -1;
 				--m_ActiveThreadCount;
 
-				if (ft.fiber->getState() == Fiber::READY) {
-					schedule(ft.fiber); // ִ껹READY״̬,ٴμm_Fibers
+				if (ft->fiber->getState() == Fiber::READY) {
+					schedule(ft->fiber, ft->thread); // 如果执行完还是READY状态,就再次加入队列
+				}
+				else if(ft->fiber->getState() != Fiber::TERM && ft->fiber->getState() != Fiber::EXCEPT) {
+					ft->fiber->m_State.store(Fiber::HOLD, std::memory_order_release);
 				}
-				else if(ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT) {
-					ft.fiber->m_State = Fiber::HOLD;
+				else {
+					// 挂起过的任务协程在这里结束, 放回空闲链表, 下一个任务不用再新建协程
+					Fiber::Recycle(ft->fiber);
 				}
-				ft.reset();
+				delete ft;
 			}
-			else if (ft.func) {
+			else if (ft && ft->func) {
 				if (funcFiber)
-					funcFiber->reset(ft.func);
+					funcFiber->reset(std::move(ft->func));
 				else
-					funcFiber.reset(new Fiber(ft.func));
-				ft.reset();
+					funcFiber = Fiber::Create(std::move(ft->func));
+				int thread = ft->thread;
+				delete ft;
+				s_TaskThread = thread;
 				funcFiber->swapIn();
+				s_TaskThread = -1;
 				--m_ActiveThreadCount;
 				if (funcFiber->getState() == Fiber::READY) {
-					schedule(funcFiber);
+					schedule(std::move(funcFiber), thread);
+					funcFiber.reset();
+				}
+				else if (funcFiber->getState() != Fiber::TERM && funcFiber->getState() != Fiber::EXCEPT) {
+					// 挂起等待事件的协程由事件持有, 这里不能再复用
+					funcFiber->m_State.store(Fiber::HOLD, std::memory_order_release);
 					funcFiber.reset();
 				}
 			}
 			else {
-				if (isActive) {
+				if (ft) {
+					delete ft;
 					--m_ActiveThreadCount;
 					continue;
 				}
 				if (idleFiber->getState() == Fiber::TERM) {
-					printf("idle fiber term\n");
+					WS_LOG_DEBUG("idle fiber term");
 					break;
 				}
 				++m_IdleThreadCount;
 				idleFiber->swapIn();
 				--m_IdleThreadCount;
 				if ((idleFiber->getState() != Fiber::TERM) && (idleFiber->getState() != Fiber::EXCEPT)) {
-					idleFiber->m_State = Fiber::HOLD;
+					idleFiber->m_State.store(Fiber::HOLD, std::memory_order_release);
 				}
 			}
 		}
-
+		setHookEnable(hookEnable);
 	}
 
-}
\ No newline at end of file
+}
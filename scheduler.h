@@ -2,10 +2,13 @@
 #include <memory>
 #include <vector>
 #include <atomic>
-#include <functional>
+#include <deque>
+#include <ostream>
 #include "mutex.h"
 #include "fiber.h"
+#include "task.h"
 #include "thread.h"
+#include "workqueue.h"
 
 namespace WebServer {
 
@@ -19,68 +22,97 @@ namespace WebServer {
 		~Scheduler();
 
 		const std::string& getName() const { return m_Name; }
+		// 所有工作线程的id, start之后不再变化; useCaller时第一个是调用者线程, 它在stop里才开始执行任务
+		const std::vector<int>& getThreadIds() const { return m_ThreadIds; }
 
 		static Scheduler* getThis();
-		static Fiber* GetMainFiber();  // Э̵ҲһЭϵ
+		static Fiber* GetMainFiber();  // 协程调度器也是运行在一个协程上的
+		// 当前任务投递时指定的线程, -1表示任意线程; 挂起等事件的协程恢复时要投回这个线程
+		static int GetTaskThread();
 
 		void start();
 		void stop();
 
+		/*
+		* @brief 投递协程或者可调用对象
+		*        右值直接移进任务节点, 闭包不超过Task::INLINE_SIZE时不分配内存; 传入Task*或Fiber::fiberPtr*时取走它的内容
+		* @param[in] thread 指定执行的线程id, -1表示任意线程
+		*/
 		template<typename FiberOrFunc>
-		void schedule(FiberOrFunc ff, int thread = -1) {
-			bool needTickle = false;
-			{
-				MutexType::Lock lock(m_Mtx);
-				needTickle = scheduleNoLock(ff, thread);
-			}
-
-			if (needTickle)
+		void schedule(FiberOrFunc&& ff, int thread = -1) {
+			if (scheduleNoLock(std::forward<FiberOrFunc>(ff), thread))
 				tickle();
 		}
 
 		template<typename InputIterator>
 		void schedule(InputIterator begin, InputIterator end) {
 			bool needTickle = false;
-			{
-				MutexType::Lock lock(m_Mtx);
-				while (begin != end) {
-					needTickle = scheduleNoLock(&*begin, -1) || needTickle;
-					++begin;
-				}
+			while (begin != end) {
+				needTickle = scheduleNoLock(&*begin, -1) || needTickle;
+				++begin;
 			}
 			if (needTickle)
 				tickle();
 		}
 
+		// 从本线程队列取出执行的任务数 / 从其他线程偷来执行的任务数
+		uint64_t getLocalTaskCount() const;
+		uint64_t getStolenTaskCount() const;
+		std::ostream& dump(std::ostream& os) const;
+
 	protected:
 		virtual void idle();
+		// 工作线程每取一个任务之前调用, 忙碌时idle不会运行, 子类在这里处理到期的定时器
+		virtual void poll() {}
 		virtual bool stopping();
+		// 唤醒任意一个空闲线程
 		virtual void tickle();
+		// 唤醒指定的线程, 任务投递到了它的inbox或者指定在它上面执行
+		virtual void tickleWorker(size_t index);
+		// 工作线程是否打开hook, 只有IOManager能让hook挂起的协程恢复
+		virtual bool hookEnabled() const { return false; }
 
 		void setThis();
-		void run();
+		void run(size_t index);
 
 		bool hasIdleThreads() { return m_IdleThreadCount > 0; }
 
+		size_t getWorkerCount() const { return m_Workers.size(); }
+		// 当前线程在本调度器中的Worker下标, 不是本调度器的线程返回-1
+		int getWorkerIndex() const;
+		// index号线程是否有任务可以执行(自己的inbox/指定任务, 或者任意队列中可以偷的任务)
+		bool hasWork(size_t index) const;
+
 	private:
+		struct FiberAndThread;
+		struct Worker;
+
+		// 任务队列都是无锁的, 这里不再加锁, 保留原来的名字
 		template<typename FiberOrFunc>
-		bool scheduleNoLock(FiberOrFunc ff, int thread) {
-			bool needTickle = m_Fibers.empty();
-			FiberAndThread ft(ff, thread);
-			if (ft.fiber || ft.func)
-				m_Fibers.push_back(ft);
-			return needTickle;
+		bool scheduleNoLock(FiberOrFunc&& ff, int thread) {
+			FiberAndThread* ft = new FiberAndThread(std::forward<FiberOrFunc>(ff), thread);
+			if (!ft->fiber && !ft->func) {
+				delete ft;
+				return false;
+			}
+			return enqueue(ft);
 		}
 
+		bool enqueue(FiberAndThread* ft);
+		FiberAndThread* take(Worker* self);
+		void drainInbox(Worker* self);
+		Worker* getWorker(int thread) const;
+
 	private:
 		struct FiberAndThread {
 		public:
 			Fiber::fiberPtr fiber;
-			std::function<void()> func;
-			int thread;  // ʹĸ߳
+			Task func;
+			int thread;  // 使用哪个线程
+			FiberAndThread* next = nullptr;  // 投递到其他线程inbox时使用
 
 			FiberAndThread(Fiber::fiberPtr fb, int thr)
-				: fiber(fb), thread(thr)
+				: fiber(std::move(fb)), thread(thr)
 			{
 			}
 
@@ -90,13 +122,12 @@ namespace WebServer {
 				fiber.swap(*fbptr);
 			}
 
-			FiberAndThread(std::function<void()> f, int thr)
-				: thread(thr)
+			FiberAndThread(Task f, int thr)
+				: func(std::move(f)), thread(thr)
 			{
-				func.swap(f);
 			}
 
-			FiberAndThread(std::function<void()>* f, int thr)
+			FiberAndThread(Task* f, int thr)
 				: thread(thr)
 			{
 				func.swap(*f);
@@ -114,11 +145,25 @@ namespace WebServer {
 			}
 		};
 
+		// 每个执行run的线程一个, 按cache line对齐避免相邻Worker的计数器互相干扰
+		struct alignas(64) Worker {
+			Scheduler* scheduler = nullptr;
+			size_t index = 0;
+			std::atomic<int> threadId{ -1 };
+			WorkStealingQueue<FiberAndThread*> queue;        // 本线程产生的任务, 其他线程可以偷
+			std::deque<FiberAndThread*> pinned;              // 指定在本线程执行的任务, 只有本线程访问
+			std::atomic<FiberAndThread*> inbox{ nullptr };   // 其他线程投递过来的任务, 无锁栈
+			std::atomic<uint64_t> localCount{ 0 };
+			std::atomic<uint64_t> stolenCount{ 0 };
+		};
+
 	private:
 		MutexType m_Mtx;
-		std::vector<Thread::threadPtr> m_Threads;         // ̳߳
-		std::vector<FiberAndThread> m_Fibers;             // Э̳
-		Fiber::fiberPtr m_RootFiber;                      // Э̵ĸЭ
+		std::vector<Thread::threadPtr> m_Threads;         // 线程池
+		std::vector<std::unique_ptr<Worker>> m_Workers;   // 每个线程的任务队列
+		std::atomic<size_t> m_PendingCount{ 0 };          // 所有队列中还没取出的任务数
+		std::atomic<size_t> m_NextWorker{ 0 };            // 非本调度器线程投递任务时轮询
+		Fiber::fiberPtr m_RootFiber;                      // 协程调度器运行在哪个协程上
 		std::string m_Name;
 	
 	protected:
@@ -0,0 +1,127 @@
+#include "sendqueue.h"
+#include "log.h"
+#include "utils.h"
+
+#include <poll.h>
+#include <string.h>
+
+namespace WebServer {
+
+	SendQueue::SendQueue(Socket::socketPtr sock, size_t highWater, size_t lowWater)
+		: m_Sock(sock)
+		, m_HighWater(highWater)
+		, m_LowWater(lowWater < highWater ? lowWater : highWater)
+		, m_Pending(new ByteArray())
+		, m_Sending(new ByteArray())
+	{
+	}
+
+	SendQueue::~SendQueue() {
+	}
+
+	bool SendQueue::send(const void* data, size_t len) {
+		Scheduler* scheduler = Scheduler::getThis();
+		MutexType::Lock lock(m_Mtx);
+		// 超过高水位, 挂起等flush降到低水位以下, 不在调度器里时没法挂起, 直接入队
+		while (scheduler && !m_Error && m_Bytes >= m_HighWater) {
+			m_Waiters.push_back(std::make_pair(scheduler, Fiber::getThis()));
+			lock.unlock();
+			Fiber::YieldToHold();
+			lock.lock();
+		}
+		if (m_Error)
+			return false;
+
+		m_Pending->write(data, len);
+		m_Bytes += len;
+		++m_MessageCount;
+		if (m_Flushing)
+			return true;
+		m_Flushing = true;
+		lock.unlock();
+
+		if (scheduler)
+			// 投递到当前线程的队尾, 本轮调度里后面入队的消息会合并到同一次发送
+			scheduler->schedule(std::bind(&SendQueue::flush, shared_from_this()), GetThreadId());
+		else
+			flush();
+		return !m_Error;
+	}
+
+	bool SendQueue::send(const ByteArray& ba) {
+		std::vector<iovec> iovs;
+		ba.getReadBuffers(iovs);
+		if (iovs.empty())
+			return !m_Error;
+		if (iovs.size() == 1)
+			return send(iovs[0].iov_base, iovs[0].iov_len);
+
+		// 跨内存块的消息先拼起来, 保证一条消息在队列里是连续的
+		std::string msg;
+		msg.reserve(ba.getReadSize());
+		for (auto& i : iovs)
+			msg.append((const char*)i.iov_base, i.iov_len);
+		return send(msg);
+	}
+
+	void SendQueue::flush() {
+		while (true) {
+			{
+				MutexType::Lock lock(m_Mtx);
+				if (m_Sending->getReadSize() == 0) {
+					if (m_Error || m_Pending->getSize() == 0) {
+						m_Flushing = false;
+						return;
+					}
+					// 内存块还给线程的内存块池
+					m_Sending->clear();
+					std::swap(m_Sending, m_Pending);
+					m_Sending->setPosition(0);
+				}
+			}
+
+			// m_Sending只有flush协程访问, 发送时不用加锁
+			int rt = m_Sock->writeFrom(*m_Sending, MSG_NOSIGNAL);
+			++m_SyscallCount;
+			// 不在调度器线程里时发送没有经过hook, socket是非阻塞的, 写满时在这里等可写再继续发
+			if (rt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && !Scheduler::getThis()) {
+				if (waitWritable())
+					continue;
+			}
+
+			MutexType::Lock lock(m_Mtx);
+			if (rt <= 0) {
+				WS_LOG_ERROR("SendQueue sock={} send rt={} errno={} errstr={}", m_Sock->getSocket(), rt, errno, strerror(errno));
+				m_Error = true;
+				m_Bytes = 0;
+				m_Pending->clear();
+				m_Sending->clear();
+				m_Flushing = false;
+				wakeWaiters();
+				return;
+			}
+			m_Bytes -= rt;
+			if (m_Bytes <= m_LowWater)
+				wakeWaiters();
+		}
+	}
+
+	bool SendQueue::waitWritable() {
+		pollfd pfd;
+		pfd.fd = m_Sock->getSocket();
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+		int rt;
+		do {
+			rt = ::poll(&pfd, 1, -1);
+		} while (rt < 0 && errno == EINTR);
+		// POLLERR/POLLHUP也返回true, 由下一次发送拿到具体的错误
+		return rt > 0;
+	}
+
+	void SendQueue::wakeWaiters() {
+		for (auto& i : m_Waiters)
+			i.first->schedule(i.second);
+		m_Waiters.clear();
+	}
+}
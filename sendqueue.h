@@ -0,0 +1,79 @@
+#pragma once
+#include "ByteArray.h"
+#include "mutex.h"
+#include "scheduler.h"
+#include "socket.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace WebServer {
+
+	/*
+	* @brief 每个连接一个的发送队列, 合并小包
+	*        send只把消息拷进队列, 队列从空变成非空时在当前线程投递一个flush任务
+	*        同一轮调度里(flush任务被取出执行之前)入队的消息由一次sendmsg发出去
+	*        flush过程中新入队的消息等这一批发完后再一起发, socket写满时flush协程挂在写事件上
+	*        队列里未发送的字节数达到高水位时send挂起当前协程, 降到低水位以下再唤醒
+	*/
+	class SendQueue : public std::enable_shared_from_this<SendQueue> {
+	public:
+		typedef std::shared_ptr<SendQueue> sendQueuePtr;
+		typedef Mutex MutexType;
+
+		/*
+		* @param[in] sock 已经连接的socket
+		* @param[in] highWater 高水位, 未发送字节数达到它时send挂起
+		* @param[in] lowWater 低水位, 未发送字节数降到它以下时唤醒挂起的send
+		*/
+		SendQueue(Socket::socketPtr sock, size_t highWater = 1024 * 1024, size_t lowWater = 256 * 1024);
+		~SendQueue();
+
+		/*
+		* @brief 消息入队, 拷贝一次
+		*        不在调度器线程里调用时不会挂起, 也没有flush任务, 在调用线程里阻塞到发完或者出错
+		*        socket写满时用poll等可写, 不当成错误
+		* @return 连接已经出错时返回false
+		*/
+		bool send(const void* data, size_t len);
+		bool send(const std::string& msg) { return send(msg.data(), msg.size()); }
+		// 发送ba从当前位置开始的可读数据, ba的position不变
+		bool send(const ByteArray& ba);
+
+		const Socket::socketPtr& getSocket() const { return m_Sock; }
+		size_t getPendingBytes() const { return m_Bytes; }
+		bool isError() const { return m_Error; }
+
+		// 统计: 入队的消息数 / 发送用的系统调用次数
+		uint64_t getMessageCount() const { return m_MessageCount; }
+		uint64_t getSyscallCount() const { return m_SyscallCount; }
+
+	private:
+		void flush();
+		// 不在调度器线程里时阻塞等socket可写, 出错返回false
+		bool waitWritable();
+		// 调用时持有m_Mtx
+		void wakeWaiters();
+
+	private:
+		Socket::socketPtr m_Sock;
+		size_t m_HighWater;
+		size_t m_LowWater;
+
+		MutexType m_Mtx;
+		// 新入队的消息写到m_Pending, flush协程发m_Sending, 发完后两者交换
+		ByteArray::bytearrayPtr m_Pending;
+		ByteArray::bytearrayPtr m_Sending;
+		// 两个缓冲区里还没发出去的字节数
+		std::atomic<size_t> m_Bytes{ 0 };
+		bool m_Flushing = false;
+		std::atomic<bool> m_Error{ false };
+		// 因为高水位挂起的协程
+		std::vector<std::pair<Scheduler*, Fiber::fiberPtr>> m_Waiters;
+
+		std::atomic<uint64_t> m_MessageCount{ 0 };
+		std::atomic<uint64_t> m_SyscallCount{ 0 };
+	};
+}
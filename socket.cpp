@@ -1,14 +1,40 @@
 #include "socket.h"
+#include "ByteArray.h"
 #include "core.h"
 #include "hook.h"
 #include "fdmanager.h"
 #include "iomanager.h"
+#include "log.h"
+#include "utils.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
 #include <limits.h>
+#include <mutex>
+#include <poll.h>
+#include <linux/errqueue.h>
+#include <netinet/udp.h>
 #include <sstream>
 #include <sys/socket.h>
 
 namespace WebServer {
 
+	// close时等零拷贝完成通知的最长时间
+	static const uint64_t s_ZeroCopyCloseWaitMs = 1000;
+
+	struct Socket::ZeroCopyState {
+		Mutex mtx;
+		bool enabled = false;
+		size_t threshold = 0;
+		// 内核给每次成功的MSG_ZEROCOPY发送分配一个从0开始递增的序号, 完成通知按序号区间返回
+		uint32_t nextId = 0;
+		// 每次零拷贝发送的序号和它引用的数据
+		std::deque<std::pair<uint32_t, std::shared_ptr<ByteArray>>> pending;
+		// 在哪个IOManager上等ERROR事件, 为空表示没有在等
+		IOManager* waiting = nullptr;
+		uint64_t copied = 0;
+	};
+
 	Socket::socketPtr Socket::CreateTCP(WebServer::Address::addressPtr address) {
 		Socket::socketPtr sock(new Socket(address->getFamily(), TCP, 0));
 		return sock;
@@ -29,7 +55,7 @@ namespace WebServer {
 	Socket::socketPtr Socket::CreateUDPSocket()
 	{
 		Socket::socketPtr sock(new Socket(IPv4, UDP, 0));
-		// ΪUDPһӵЭ,ֱͰ׽ֵļ,TCPܺҪж
+		// 可能是因为UDP是一种无连接的协议,因此直接在这里就把套接字的文件描述符创建了,但是TCP可能后续还要判断
 		sock->newSock();
 		sock->m_IsConnected = true;
 		return sock;
@@ -86,9 +112,7 @@ namespace WebServer {
 	bool Socket::getOption(int level, int option, void* result, socklen_t* len) {
 		int rt = getsockopt(m_Sock, level, option, result, (socklen_t*)len);
 		if (rt) {
-			std::cout << "getOption sock=" << m_Sock
-				<< " level=" << level << " option=" << option
-				<< " errno=" << errno << " errstr=" << strerror(errno);
+			WS_LOG_ERROR("getOption sock={} level={} option={} errno={} errstr={}", m_Sock, level, option, errno, strerror(errno));
 			return false;
 		}
 		return true;
@@ -96,9 +120,7 @@ namespace WebServer {
 
 	bool Socket::setOption(int level, int option, const void* result, socklen_t len) {
 		if (setsockopt(m_Sock, level, option, result, len)) {
-			std::cout << "setOption sock=" << m_Sock
-				<< " level=" << level << " option=" << option
-				<< " errno=" << errno << " errstr=" << strerror(errno);
+			WS_LOG_ERROR("setOption sock={} level={} option={} errno={} errstr={}", m_Sock, level, option, errno, strerror(errno));
 			return false;
 		}
 		return true;
@@ -117,6 +139,16 @@ namespace WebServer {
 		return false;
 	}
 
+	bool Socket::setReusePort() {
+		if (!isValid()) {
+			newSock();
+			if (WS_UNLIKELY(!isValid()))
+				return false;
+		}
+		int val = 1;
+		return setOption(SOL_SOCKET, SO_REUSEPORT, val);
+	}
+
 	bool Socket::bind(const Address::addressPtr addr) {
 		if (!isValid()) {
 			newSock();
@@ -125,18 +157,15 @@ namespace WebServer {
 		}
 
 		if (WS_UNLIKELY(addr->getFamily() != m_Family)) {
-			std::cout << "bind sock.family("
-				<< m_Family << ") addr.family(" << addr->getFamily()
-				<< ") not equal, addr=" << addr->toString();
+			WS_LOG_ERROR("bind sock.family({}) addr.family({}) not equal, addr={}", m_Family, addr->getFamily(), addr->toString());
 			return false;
 		}
 
 		// TODO: UnixAddress
 
-		// ::ʾȫռµĺ,ʹĳضռµĺ
+		// ::表示全局命名空间下的函数,即不使用某个特定命名空间下的函数
 		if (::bind(m_Sock, addr->getAddr(), addr->getAddrLen())) {
-			std::cout << "bind error errrno=" << errno
-				<< " errstr=" << strerror(errno);
+			WS_LOG_ERROR("bind sock={} addr={} errno={} errstr={}", m_Sock, addr->toString(), errno, strerror(errno));
 				return false;
 		}
 		getLocalAddress();
@@ -152,25 +181,20 @@ namespace WebServer {
 		}
 
 		if (WS_UNLIKELY(addr->getFamily() != m_Family)) {
-			std::cout << "connect sock.family("
-				<< m_Family << ") addr.family(" << addr->getFamily()
-				<< ") not equal, addr=" << addr->toString();
+			WS_LOG_ERROR("connect sock.family({}) addr.family({}) not equal, addr={}", m_Family, addr->getFamily(), addr->toString());
 			return false;
 		}
 
 		if (timeoutMs == (uint64_t)-1) {
 			if (::connect(m_Sock, addr->getAddr(), addr->getAddrLen())) {
-				std::cout << "sock=" << m_Sock << " connect(" << addr->toString()
-					<< ") error errno=" << errno << " errstr=" << strerror(errno);
+				WS_LOG_ERROR("sock={} connect({}) error errno={} errstr={}", m_Sock, addr->toString(), errno, strerror(errno));
 				close();
 				return false;
 			}
 		}
 		else {
 			if (::connect_with_timeout(m_Sock, addr->getAddr(), addr->getAddrLen(), timeoutMs)) {
-				std::cout << "sock=" << m_Sock << " connect(" << addr->toString()
-					<< ") timeout=" << timeoutMs << " error errno="
-					<< errno << " errstr=" << strerror(errno);
+				WS_LOG_ERROR("sock={} connect({}) timeout={} error errno={} errstr={}", m_Sock, addr->toString(), timeoutMs, errno, strerror(errno));
 				close();
 				return false;
 			}
@@ -183,7 +207,7 @@ namespace WebServer {
 
 	bool Socket::reconnect(uint64_t timeoutMs) {
 		if (!m_RemoteAddress) {
-			std::cout << "[error] reconnect m_remoteAddress is null";
+			WS_LOG_ERROR("reconnect sock={} m_RemoteAddress is null", m_Sock);
 			return false;
 		}
 		m_LocalAddress.reset();
@@ -192,13 +216,12 @@ namespace WebServer {
 
 	bool Socket::listen(int backlog) {
 		if (!isValid()) {
-			std::cout << "listen error sock=-1";
+			WS_LOG_ERROR("listen error sock=-1");
 			return false;
 		}
 
 		if (::listen(m_Sock, backlog)) {
-			std::cout << "listen error errno=" << errno
-				<< " errstr=" << strerror(errno);
+			WS_LOG_ERROR("listen sock={} errno={} errstr={}", m_Sock, errno, strerror(errno));
 			return false;
 		}
 		return true;
@@ -209,8 +232,7 @@ namespace WebServer {
 		Socket::socketPtr sock(new Socket(m_Family, m_Type, m_Protocol));
 		int newsock = ::accept(m_Sock, nullptr, nullptr);
 		if (newsock == -1) {
-			std::cout << "accept(" << m_Sock << ") errno="
-				<< errno << " errstr=" << strerror(errno);
+			WS_LOG_ERROR("accept({}) errno={} errstr={}", m_Sock, errno, strerror(errno));
 			return nullptr;
 		}
 
@@ -225,6 +247,8 @@ namespace WebServer {
 
 		m_IsConnected = false;
 		if (m_Sock != -1) {
+			if (m_ZeroCopy)
+				drainZeroCopy();
 			::close(m_Sock);
 			m_Sock = -1;
 		}
@@ -238,13 +262,13 @@ namespace WebServer {
 	}
 
 	/*
-	msg.msg_name = nullptr     Ŀַ
-    msg.msg_namelen = 0        Ŀַ
-    msg.msg_iov = iov;         ݻ
-    msg.msg_iovlen = 1;        ݻ
-    msg.msg_control = NULL;    
-    msg.msg_controllen = 0;    ݳ
-    msg.msg_flags = 0;         ־
+	msg.msg_name = nullptr     目标地址
+    msg.msg_namelen = 0        目标地址长度
+    msg.msg_iov = iov;         数据缓冲区描述
+    msg.msg_iovlen = 1;        数据缓冲区个数
+    msg.msg_control = NULL;    辅助数据
+    msg.msg_controllen = 0;    辅助数据长度
+    msg.msg_flags = 0;         操作标志
 	*/
 	int Socket::send(const iovec* buffers, size_t length, int flags) {
 		if (m_IsConnected) {
@@ -293,6 +317,444 @@ namespace WebServer {
 		return -1;
 	}
 
+	// 一次sendmsg/recvmsg最多IOV_MAX个iovec, 起始块可能只用一部分, 所以留一块余量
+	static size_t MaxIovBytes(const ByteArray& ba) {
+		return (IOV_MAX - 1) * ba.getBaseSize();
+	}
+
+	int Socket::readInto(ByteArray& ba, size_t maxBytes, int flags) {
+		maxBytes = std::min(maxBytes, MaxIovBytes(ba));
+		if (maxBytes == 0)
+			return 0;
+		std::vector<iovec> iovs;
+		iovs.reserve(maxBytes / ba.getBaseSize() + 2);
+		size_t position = ba.getPosition();
+		ba.getWriteBuffers(iovs, maxBytes);
+		int rt = receive(&iovs[0], iovs.size(), flags);
+		if (rt > 0)
+			ba.setPosition(position + rt);
+		return rt;
+	}
+
+	// 批量收发用的消息头, 不多的时候放在协程栈上
+	// 不能用线程局部的缓冲区: 调用里协程可能挂起, 醒来时已经换了线程
+	struct BatchHeaders {
+		static const size_t STACK_COUNT = 64;
+
+		BatchHeaders(Socket::Datagram* msgs, size_t count) {
+			if (count > STACK_COUNT) {
+				heapHdrs.resize(count);
+				heapIovs.resize(count);
+				hdrs = &heapHdrs[0];
+				iovs = &heapIovs[0];
+			}
+			for (size_t i = 0; i < count; i++) {
+				iovs[i].iov_base = msgs[i].buffer;
+				iovs[i].iov_len = msgs[i].length;
+				msghdr& hdr = hdrs[i].msg_hdr;
+				memset(&hdr, 0, sizeof(hdr));
+				hdr.msg_iov = &iovs[i];
+				hdr.msg_iovlen = 1;
+				if (msgs[i].addr) {
+					hdr.msg_name = msgs[i].addr->getAddr();
+					hdr.msg_namelen = msgs[i].addr->getAddrLen();
+				}
+				hdrs[i].msg_len = 0;
+			}
+		}
+
+		mmsghdr stackHdrs[STACK_COUNT];
+		iovec stackIovs[STACK_COUNT];
+		std::vector<mmsghdr> heapHdrs;
+		std::vector<iovec> heapIovs;
+		mmsghdr* hdrs = stackHdrs;
+		iovec* iovs = stackIovs;
+	};
+
+	// 内核一次最多处理UIO_MAXIOV(IOV_MAX)个
+	int Socket::receiveBatch(Datagram* msgs, size_t count, int flags) {
+		if (!m_IsConnected)
+			return -1;
+		count = std::min(count, (size_t)IOV_MAX);
+		if (count == 0)
+			return 0;
+		BatchHeaders batch(msgs, count);
+		int rt = ::recvmmsg(m_Sock, batch.hdrs, count, flags, nullptr);
+		for (int i = 0; i < rt; i++) {
+			msgs[i].length = batch.hdrs[i].msg_len;
+			msgs[i].flags = batch.hdrs[i].msg_hdr.msg_flags;
+		}
+		return rt;
+	}
+
+	int Socket::sendBatch(Datagram* msgs, size_t count, int flags) {
+		if (!m_IsConnected)
+			return -1;
+		count = std::min(count, (size_t)IOV_MAX);
+		if (count == 0)
+			return 0;
+		BatchHeaders batch(msgs, count);
+		return ::sendmmsg(m_Sock, batch.hdrs, count, flags);
+	}
+
+	// UDP GSO一次sendmsg最多的分段数和字节数
+	static const size_t s_GsoMaxSegments = 64;
+	static const size_t s_GsoMaxBytes = 65000;
+	// 内核不支持GSO时置为false, 之后直接走sendmmsg
+	static std::atomic<bool> s_GsoSupported{ true };
+	static std::once_flag s_GsoProbed;
+
+	bool Socket::IsGsoSupported() {
+		return s_GsoSupported;
+	}
+
+	// 第一次sendSegments时探测一次: 没有UDP_SEGMENT的老内核对这个cmsg返回EINVAL, 和参数错误分不开, 先用getsockopt问清楚
+	static void ProbeGso(int sock) {
+		int val = 0;
+		socklen_t len = sizeof(val);
+		if (::getsockopt(sock, SOL_UDP, UDP_SEGMENT, &val, &len) && (errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+			WS_LOG_WARN("UDP GSO unavailable errno={} errstr={}, fall back to sendmmsg", errno, strerror(errno));
+			s_GsoSupported = false;
+		}
+	}
+
+	// 从iovec数组里按顺序切出指定长度的片段, 片段可以跨iovec
+	struct IovCursor {
+		IovCursor(const iovec* iov_, size_t count_)
+			: iov(iov_), count(count_)
+		{
+		}
+
+		size_t take(size_t len, std::vector<iovec>& out) {
+			size_t taken = 0;
+			while (len > 0 && index < count) {
+				size_t n = std::min(iov[index].iov_len - offset, len);
+				if (n)
+					out.push_back({ (char*)iov[index].iov_base + offset, n });
+				offset += n;
+				taken += n;
+				len -= n;
+				if (offset == iov[index].iov_len) {
+					++index;
+					offset = 0;
+				}
+			}
+			return taken;
+		}
+
+		const iovec* iov;
+		size_t count;
+		size_t index = 0;
+		size_t offset = 0;
+	};
+
+	int Socket::sendSegments(const iovec* buffers, size_t count, size_t segmentSize, Address::addressPtr to, int flags) {
+		if (!m_IsConnected || segmentSize == 0)
+			return -1;
+		size_t total = 0;
+		for (size_t i = 0; i < count; i++)
+			total += buffers[i].iov_len;
+
+		std::call_once(s_GsoProbed, ProbeGso, m_Sock);
+
+		IovCursor cursor(buffers, count);
+		size_t sent = 0;
+		std::vector<iovec> iovs;
+		// 每段最多占用的iovec数是段内跨越的iovec数, count + 分段数是上限, 预留好避免扩容让指针失效
+		iovs.reserve(count + s_GsoMaxSegments);
+		while (sent < total) {
+			size_t segments = std::min(s_GsoMaxSegments, std::max<size_t>(1, s_GsoMaxBytes / segmentSize));
+			size_t chunk = std::min(total - sent, segments * segmentSize);
+
+			if (s_GsoSupported) {
+				iovs.clear();
+				IovCursor saved = cursor;
+				cursor.take(chunk, iovs);
+
+				msghdr msg;
+				memset(&msg, 0, sizeof(msg));
+				if (to) {
+					msg.msg_name = to->getAddr();
+					msg.msg_namelen = to->getAddrLen();
+				}
+				msg.msg_iov = &iovs[0];
+				msg.msg_iovlen = iovs.size();
+				char control[CMSG_SPACE(sizeof(uint16_t))];
+				memset(control, 0, sizeof(control));
+				if (chunk > segmentSize) {
+					msg.msg_control = control;
+					msg.msg_controllen = sizeof(control);
+					cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+					cm->cmsg_level = SOL_UDP;
+					cm->cmsg_type = UDP_SEGMENT;
+					cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+					*(uint16_t*)CMSG_DATA(cm) = segmentSize;
+				}
+				int rt = ::sendmsg(m_Sock, &msg, flags);
+				if (rt >= 0) {
+					sent += chunk;
+					continue;
+				}
+				// EINVAL/EIO也可能是调用方的问题(比如分段超过路径MTU), 只返回给调用方, 不关掉整个进程的GSO
+				if (errno != ENOPROTOOPT && errno != EOPNOTSUPP)
+					return sent ? sent : -1;
+				// 内核不支持, 这一块改用sendmmsg重发
+				WS_LOG_WARN("sendSegments sock={} UDP GSO unavailable errno={} errstr={}, fall back to sendmmsg", m_Sock, errno, strerror(errno));
+				s_GsoSupported = false;
+				cursor = saved;
+			}
+
+			// 一个分段一个mmsghdr, 分段跨iovec时一个mmsghdr有多个iovec
+			iovs.clear();
+			std::vector<mmsghdr> hdrs(segments);
+			size_t n = 0;
+			size_t bytes = 0;
+			while (bytes < chunk) {
+				size_t first = iovs.size();
+				size_t len = cursor.take(std::min(segmentSize, chunk - bytes), iovs);
+				msghdr& hdr = hdrs[n].msg_hdr;
+				memset(&hdr, 0, sizeof(hdr));
+				if (to) {
+					hdr.msg_name = to->getAddr();
+					hdr.msg_namelen = to->getAddrLen();
+				}
+				hdr.msg_iov = &iovs[first];
+				hdr.msg_iovlen = iovs.size() - first;
+				hdrs[n].msg_len = 0;
+				bytes += len;
+				++n;
+			}
+			size_t done = 0;
+			while (done < n) {
+				int rt = ::sendmmsg(m_Sock, &hdrs[done], n - done, flags);
+				if (rt <= 0)
+					return sent ? sent : -1;
+				for (int i = 0; i < rt; i++)
+					sent += hdrs[done + i].msg_len;
+				done += rt;
+			}
+		}
+		return sent;
+	}
+
+	bool Socket::setGro(bool on) {
+		int val = on ? 1 : 0;
+		// 不支持是正常情况, 不用setOption打印错误
+		return ::setsockopt(m_Sock, SOL_UDP, UDP_GRO, &val, sizeof(val)) == 0;
+	}
+
+	int Socket::receiveSegments(void* buffer, size_t length, std::vector<iovec>& segments, Address::addressPtr from, int flags) {
+		segments.clear();
+		if (!m_IsConnected)
+			return -1;
+		iovec iov = { buffer, length };
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		if (from) {
+			msg.msg_name = from->getAddr();
+			msg.msg_namelen = from->getAddrLen();
+		}
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		char control[CMSG_SPACE(sizeof(int))];
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		int rt = ::recvmsg(m_Sock, &msg, flags);
+		if (rt <= 0)
+			return rt;
+
+		// 没有UDP_GRO控制消息时就是单个数据报
+		size_t segmentSize = rt;
+		for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+				int size;
+				memcpy(&size, CMSG_DATA(cm), sizeof(size));
+				if (size > 0)
+					segmentSize = size;
+			}
+		}
+		for (size_t offset = 0; offset < (size_t)rt; offset += segmentSize)
+			segments.push_back({ (char*)buffer + offset, std::min(segmentSize, rt - offset) });
+		return segments.size();
+	}
+
+	int Socket::writeFrom(ByteArray& ba, int flags) {
+		std::vector<iovec> iovs;
+		if (ba.getReadBuffers(iovs, MaxIovBytes(ba)) == 0)
+			return 0;
+		int rt = send(&iovs[0], iovs.size(), flags);
+		if (rt > 0)
+			ba.setPosition(ba.getPosition() + rt);
+		return rt;
+	}
+
+	bool Socket::setZeroCopy(bool on, size_t threshold) {
+		int val = on ? 1 : 0;
+		// 不支持是正常情况, 不用setOption打印错误
+		if (::setsockopt(m_Sock, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val)))
+			return false;
+		if (!m_ZeroCopy)
+			m_ZeroCopy.reset(new ZeroCopyState);
+		Mutex::Lock lock(m_ZeroCopy->mtx);
+		m_ZeroCopy->enabled = on;
+		m_ZeroCopy->threshold = threshold;
+		return true;
+	}
+
+	int Socket::sendZeroCopy(std::shared_ptr<ByteArray> ba, int flags) {
+		ZeroCopyState* zc = m_ZeroCopy.get();
+		if (!zc || !zc->enabled || ba->getReadSize() < zc->threshold)
+			return writeFrom(*ba, flags);
+
+		IOManager* iom = IOManager::getThis();
+		std::vector<iovec> iovs;
+		ba->getReadBuffers(iovs, MaxIovBytes(*ba));
+		uint32_t id;
+		{
+			Mutex::Lock lock(zc->mtx);
+			// 不在IOManager里时没有ERROR事件, 每次发送前顺便收一下完成通知
+			if (!iom)
+				reapZeroCopy();
+			// 先登记再发送, 否则完成通知可能比登记先到
+			id = zc->nextId;
+			zc->pending.push_back(std::make_pair(id, ba));
+		}
+
+		int rt = send(&iovs[0], iovs.size(), flags | MSG_ZEROCOPY);
+		int error = errno;
+		Mutex::Lock lock(zc->mtx);
+		if (rt <= 0) {
+			// 发送失败时内核会收回序号
+			zc->pending.pop_back();
+			lock.unlock();
+			// 锁定的页面超过了optmem限制, 这次改为拷贝发送
+			if (error == ENOBUFS)
+				return writeFrom(*ba, flags);
+			errno = error;
+			return rt;
+		}
+		++zc->nextId;
+		ba->setPosition(ba->getPosition() + rt);
+		if (iom)
+			waitZeroCopy(iom);
+		return rt;
+	}
+
+	size_t Socket::getZeroCopyPending() {
+		if (!m_ZeroCopy)
+			return 0;
+		Mutex::Lock lock(m_ZeroCopy->mtx);
+		if (!m_ZeroCopy->waiting && m_Sock != -1)
+			reapZeroCopy();
+		return m_ZeroCopy->pending.size();
+	}
+
+	uint64_t Socket::getZeroCopyCopied() {
+		if (!m_ZeroCopy)
+			return 0;
+		Mutex::Lock lock(m_ZeroCopy->mtx);
+		return m_ZeroCopy->copied;
+	}
+
+	void Socket::reapZeroCopy() {
+		ZeroCopyState* zc = m_ZeroCopy.get();
+		char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+		while (!zc->pending.empty()) {
+			msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			// 错误队列为空时不能挂起等可读, 用原始的recvmsg, 不经过hook
+			if (recvmsg_f(m_Sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+				break;
+
+			for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+				if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+					&& !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+					continue;
+				sock_extended_err err;
+				memcpy(&err, CMSG_DATA(cm), sizeof(err));
+				if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0)
+					continue;
+				// 序号区间[lo, hi]内的发送都完成了, 序号回绕时按无符号差值比较
+				uint32_t lo = err.ee_info;
+				uint32_t hi = err.ee_data;
+				if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+					zc->copied += hi - lo + 1;
+				for (auto it = zc->pending.begin(); it != zc->pending.end();) {
+					if (it->first - lo <= hi - lo)
+						it = zc->pending.erase(it);
+					else
+						++it;
+				}
+			}
+		}
+	}
+
+	void Socket::drainZeroCopy() {
+		ZeroCopyState* zc = m_ZeroCopy.get();
+		Mutex::Lock lock(zc->mtx);
+		// 关闭之后不会再有完成通知, 先取消ERROR事件, 不取消的话IOManager会一直等下去
+		if (zc->waiting) {
+			IOManager* iom = zc->waiting;
+			zc->waiting = nullptr;
+			iom->cancelEvent(m_Sock, IOManager::ERROR);
+		}
+		// 内核可能还在引用没完成的数据, 提前释放的话内存被复用, 对端会收到错的内容
+		// close可能在析构里、调度器的主协程或回调里调用, 不能挂起协程, 直接读错误队列, 用不经过hook的poll有上限地等
+		// 错误队列非空时poll总是返回POLLERR, 不用关心其他事件
+		uint64_t deadline = GetMonotonicMS() + s_ZeroCopyCloseWaitMs;
+		reapZeroCopy();
+		while (!zc->pending.empty()) {
+			uint64_t now = GetMonotonicMS();
+			if (now >= deadline)
+				break;
+			lock.unlock();
+			pollfd pfd;
+			pfd.fd = m_Sock;
+			pfd.events = 0;
+			pfd.revents = 0;
+			::poll(&pfd, 1, (int)(deadline - now));
+			lock.lock();
+			reapZeroCopy();
+		}
+		if (!zc->pending.empty()) {
+			// 对端长时间不确认, 只能放弃等待; 内核可能还在读这些内存, 宁可泄漏也不释放
+			WS_LOG_WARN("Socket::close sock={} {} zero copy sends not completed, leak their buffers", m_Sock, zc->pending.size());
+			for (auto& i : zc->pending)
+				new std::shared_ptr<ByteArray>(std::move(i.second));
+			zc->pending.clear();
+		}
+	}
+
+	void Socket::waitZeroCopy(IOManager* iom) {
+		ZeroCopyState* zc = m_ZeroCopy.get();
+		if (zc->waiting || zc->pending.empty())
+			return;
+		// 只持有weak_ptr, socket析构时close会取消事件
+		socketWeakPtr weak = shared_from_this();
+		int rt = iom->addEvent(m_Sock, IOManager::ERROR, [weak]() {
+			socketPtr sock = weak.lock();
+			if (sock)
+				sock->onZeroCopyEvent();
+		});
+		if (rt == 0)
+			zc->waiting = iom;
+	}
+
+	void Socket::onZeroCopyEvent() {
+		ZeroCopyState* zc = m_ZeroCopy.get();
+		Mutex::Lock lock(zc->mtx);
+		// 已经被close取消
+		IOManager* iom = zc->waiting;
+		if (!iom)
+			return;
+		zc->waiting = nullptr;
+		reapZeroCopy();
+		waitZeroCopy(iom);
+	}
+
 	int Socket::receiveFrom(void* buffer, size_t length, Address::addressPtr from, int flags) {
 		if (m_IsConnected) {
 			socklen_t len = from->getAddrLen();
@@ -333,8 +795,7 @@ namespace WebServer {
 
 		socklen_t addrLen = result->getAddrLen();
 		if (getsockname(m_Sock, result->getAddr(), &addrLen)) {
-			std::cout << "getsockname error sock=" << m_Sock
-				<< " errno=" << errno << " errstr=" << strerror(errno);
+			WS_LOG_ERROR("getsockname error sock={} errno={} errstr={}", m_Sock, errno, strerror(errno));
 			return Address::addressPtr(new UnknownAddress(m_Family));
 		}
 
@@ -367,8 +828,7 @@ namespace WebServer {
 
 		socklen_t addrLen = result->getAddrLen();
 		if (getsockname(m_Sock, result->getAddr(), &addrLen)) {
-			std::cout << "getsockname error sock=" << m_Sock
-				<< " errno=" << errno << " errstr=" << strerror(errno);
+			WS_LOG_ERROR("getsockname error sock={} errno={} errstr={}", m_Sock, errno, strerror(errno));
 			return Address::addressPtr(new UnknownAddress(m_Family));
 		}
 
@@ -393,9 +853,7 @@ namespace WebServer {
 		if (WS_LIKELY(m_Sock) != -1)
 			initSock();
 		else {
-			std::cout << "socket(" << m_Family
-				<< ", " << m_Type << ", " << m_Protocol << ") errno="
-				<< errno << " errstr=" << strerror(errno);
+			WS_LOG_ERROR("socket({}, {}, {}) errno={} errstr={}", m_Family, m_Type, m_Protocol, errno, strerror(errno));
 		}
 	}
 
@@ -2,6 +2,7 @@
 #include "address.h"
 
 #include <memory>
+#include <vector>
 #include <netinet/tcp.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -10,6 +11,9 @@
 
 namespace WebServer {
 
+	class ByteArray;
+	class IOManager;
+
 	class Socket : public std::enable_shared_from_this<Socket> {
 	public:
 		typedef std::shared_ptr<Socket> socketPtr;
@@ -20,6 +24,18 @@ namespace WebServer {
 			UDP = SOCK_DGRAM
 		};
 
+		// 批量收发的一个数据报
+		struct Datagram {
+			// 收: 接收缓冲区 / 发: 要发送的数据
+			void* buffer = nullptr;
+			// 收: 调用前是缓冲区大小, 返回后是数据报的长度 / 发: 数据长度
+			size_t length = 0;
+			// 收: 来源地址, 要预先创建好对应地址族的Address, 为空时不取 / 发: 目标地址, 为空时发给connect的地址
+			Address::addressPtr addr;
+			// 收: 返回后是msg_flags, 有MSG_TRUNC表示缓冲区太小被截断了
+			int flags = 0;
+		};
+
 		enum Family {
 			IPv4 = AF_INET,
 			IPv6 = AF_INET6,
@@ -63,11 +79,13 @@ namespace WebServer {
 		}
 
 		/*
-		* @brief   connect
-		* @return  ɹӵsocket,ʧܷnullptr
+		* @brief   接收connect链接
+		* @return  成功返回新链接的socket,失败返回nullptr
 		*/
 		virtual Socket::socketPtr accept();
 		
+		// 开启SO_REUSEPORT, 要在bind之前调用, 多个socket可以监听同一个端口, 由内核分发连接
+		bool setReusePort();
 		virtual bool bind(const Address::addressPtr addr);
 
 		virtual bool connect(const Address::addressPtr addr, uint64_t timeoutMs = -1);
@@ -85,6 +103,81 @@ namespace WebServer {
 		virtual int receiveFrom(void* buffer, size_t length, Address::addressPtr from, int flags = 0);
 		virtual int receiveFrom(iovec* buffers, size_t length, Address::addressPtr from, int flags = 0);
 
+		/*
+		* @brief 直接收到ByteArray的内存块里, 从ba当前位置开始写, 成功后position和size后移
+		*        内核数据只拷贝一次, 不经过临时缓冲区
+		* @param[in] maxBytes 最多接收的字节数, 不够的容量会先分配好, 同样受IOV_MAX个内存块的限制
+		* @return 同receive, 收到的字节数, 0表示对端关闭, <0出错
+		*/
+		int readInto(ByteArray& ba, size_t maxBytes, int flags = 0);
+
+		/*
+		* @brief 一次recvmmsg收最多count个数据报, 一个都没有时协程挂起等可读
+		* @return 收到的数据报个数, <0出错
+		*/
+		int receiveBatch(Datagram* msgs, size_t count, int flags = 0);
+
+		/*
+		* @brief 一次sendmmsg发最多count个数据报, 发送缓冲区满时协程挂起等可写
+		* @return 发出去的数据报个数, 可能小于count, <0出错
+		*/
+		int sendBatch(Datagram* msgs, size_t count, int flags = 0);
+
+		/*
+		* @brief 把一大块数据按segmentSize切成多个数据报发给同一个地址, 最后一个可以不满
+		*        内核支持UDP_SEGMENT(GSO)时每次sendmsg带最多64个分段, 由内核切分
+		*        不支持时(第一次发送失败后记住)退回sendmmsg逐个发送, 调用方不用区分
+		* @param[in] buffers 数据, 比如ByteArray::getReadBuffers的结果, 分段可以跨iovec
+		* @param[in] to 目标地址, 为空时发给connect的地址
+		* @return 发送的字节数, <0出错
+		*/
+		int sendSegments(const iovec* buffers, size_t count, size_t segmentSize, Address::addressPtr to = nullptr, int flags = 0);
+
+		/*
+		* @brief 开启UDP_GRO, 内核把同一个流的多个数据报合并成一次接收
+		* @return 内核不支持时返回false, receiveSegments照常按单个数据报工作
+		*/
+		bool setGro(bool on);
+
+		/*
+		* @brief 收一次, 开启了GRO时可能是多个合并的数据报, 按内核给的分段大小拆开
+		* @param[in] length 开启GRO时缓冲区要能放下64KB
+		* @param[out] segments 每个数据报在buffer里的位置
+		* @return 数据报个数, 0表示对端关闭, <0出错
+		*/
+		int receiveSegments(void* buffer, size_t length, std::vector<iovec>& segments, Address::addressPtr from = nullptr, int flags = 0);
+
+		// 内核是否支持UDP GSO, 第一次sendSegments时探测, 之前返回true
+		static bool IsGsoSupported();
+
+		/*
+		* @brief 把ByteArray从当前位置开始的可读数据直接发出去, 成功后position后移
+		*        只发一次, 一次最多IOV_MAX个内存块, 返回值可能小于可读数据, 调用方按需重试
+		* @return 同send, 发送的字节数, <0出错
+		*/
+		int writeFrom(ByteArray& ba, int flags = 0);
+
+		/*
+		* @brief 开启零拷贝发送(SO_ZEROCOPY), 之后sendZeroCopy里不小于threshold字节的数据用MSG_ZEROCOPY发送
+		*        小数据固定/取消页面映射的开销比拷贝还大, 低于阈值的照常拷贝
+		* @return 内核或者socket类型不支持时返回false, sendZeroCopy照常拷贝发送
+		*/
+		bool setZeroCopy(bool on, size_t threshold = 16 * 1024);
+
+		/*
+		* @brief 和writeFrom一样发送ba从当前位置开始的可读数据, 只发一次, 成功后position后移
+		*        开启了零拷贝且可读数据不小于阈值时内核直接引用ba的内存块, Socket持有ba
+		*        直到内核从错误队列通知发送完成(由IOManager的ERROR事件处理), 在此之前调用方不能修改ba
+		*        同一个socket上的零拷贝发送不能并发
+		* @return 同send, 发送的字节数, <0出错
+		*/
+		int sendZeroCopy(std::shared_ptr<ByteArray> ba, int flags = 0);
+
+		// 还没收到完成通知的零拷贝发送次数
+		size_t getZeroCopyPending();
+		// 完成通知里内核实际做了拷贝的发送次数(比如回环, 或者网卡不支持)
+		uint64_t getZeroCopyCopied();
+
 		Address::addressPtr getRemoteAddress();
 		Address::addressPtr getLocalAddress();
 
@@ -108,6 +201,17 @@ namespace WebServer {
 		void initSock();
 		void newSock();
 		virtual bool init(int sock);
+	private:
+		// 零拷贝发送的状态, 开启零拷贝后才创建
+		struct ZeroCopyState;
+
+		// 读完错误队列里的完成通知, 释放对应的数据, 调用时持有ZeroCopyState::mtx
+		void reapZeroCopy();
+		// 有待完成的发送且没有在等时, 在当前IOManager上等ERROR事件, 调用时持有ZeroCopyState::mtx
+		void waitZeroCopy(IOManager* iom);
+		void onZeroCopyEvent();
+		// close时取消ERROR事件, 不挂起协程, 有上限地等完成通知收完
+		void drainZeroCopy();
 	private:
 		int m_Sock;
 		int m_Family;
@@ -117,5 +221,6 @@ namespace WebServer {
 
 		Address::addressPtr m_LocalAddress;
 		Address::addressPtr m_RemoteAddress;
+		std::unique_ptr<ZeroCopyState> m_ZeroCopy;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "stackallocator.h"
+#include "core.h"
+
+#include <atomic>
+#include <new>
+#include <vector>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace WebServer {
+
+	static std::atomic<size_t> s_MaxCachedBytes{ 16 * 1024 * 1024 };
+
+	static size_t GetPageSize() {
+		static size_t pageSize = sysconf(_SC_PAGESIZE);
+		return pageSize;
+	}
+
+	struct StackPool {
+		struct Block {
+			void* ptr;
+			size_t size;
+		};
+
+		~StackPool() {
+			for (auto& i : blocks)
+				munmap((char*)i.ptr - GetPageSize(), i.size + GetPageSize());
+			blocks.clear();
+			bytes = 0;
+			destroyed = true;
+		}
+
+		std::vector<Block> blocks;
+		size_t bytes = 0;
+		static thread_local bool destroyed;
+	};
+
+	thread_local bool StackPool::destroyed = false;
+	static thread_local StackPool t_StackPool;
+
+	static void* MapStack(size_t size) {
+		size_t guard = GetPageSize();
+		void* base = mmap(nullptr, size + guard, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+		if (WS_UNLIKELY(base == MAP_FAILED))
+			throw std::bad_alloc();
+		// 栈向低地址增长, 保护页放在最低处, 溢出时直接SIGSEGV而不是踩坏相邻内存
+		if (WS_UNLIKELY(mprotect(base, guard, PROT_NONE))) {
+			munmap(base, size + guard);
+			throw std::bad_alloc();
+		}
+		return (char*)base + guard;
+	}
+
+	static void UnmapStack(void* ptr, size_t size) {
+		size_t guard = GetPageSize();
+		munmap((char*)ptr - guard, size + guard);
+	}
+
+	void* MallocStackAllocator::Alloc(size_t size) {
+		return malloc(size);
+	}
+
+	void MallocStackAllocator::Dealloc(void* ptr, size_t size) {
+		free(ptr);
+	}
+
+	size_t PooledStackAllocator::RoundUp(size_t size) {
+		size_t page = GetPageSize();
+		return (size + page - 1) & ~(page - 1);
+	}
+
+	void* PooledStackAllocator::Alloc(size_t size) {
+		size = RoundUp(size);
+		if (!StackPool::destroyed) {
+			auto& blocks = t_StackPool.blocks;
+			// 从尾部往前找, 最近释放的栈最先被复用
+			for (size_t i = blocks.size(); i > 0; --i) {
+				if (blocks[i - 1].size != size)
+					continue;
+				void* ptr = blocks[i - 1].ptr;
+				blocks.erase(blocks.begin() + (i - 1));
+				t_StackPool.bytes -= size;
+				return ptr;
+			}
+		}
+		return MapStack(size);
+	}
+
+	void PooledStackAllocator::Dealloc(void* ptr, size_t size) {
+		if (!ptr)
+			return;
+		size = RoundUp(size);
+		if (StackPool::destroyed || t_StackPool.bytes + size > s_MaxCachedBytes) {
+			UnmapStack(ptr, size);
+			return;
+		}
+		t_StackPool.blocks.push_back({ ptr, size });
+		t_StackPool.bytes += size;
+	}
+
+	void PooledStackAllocator::SetMaxCachedBytes(size_t bytes) {
+		s_MaxCachedBytes = bytes;
+	}
+
+	size_t PooledStackAllocator::GetMaxCachedBytes() {
+		return s_MaxCachedBytes;
+	}
+
+	size_t PooledStackAllocator::GetCachedBytes() {
+		return StackPool::destroyed ? 0 : t_StackPool.bytes;
+	}
+}
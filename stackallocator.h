@@ -0,0 +1,38 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+namespace WebServer {
+
+	class MallocStackAllocator {
+	public:
+		static void* Alloc(size_t size);
+		static void Dealloc(void* ptr, size_t size);
+	};
+
+	/*
+	* @brief 每个线程一个栈缓存池, 栈由mmap分配, 栈底(低地址)带一页PROT_NONE保护页
+	*        释放的栈按LIFO复用, 保证最近用过的栈还在cache里; 每个线程缓存的总字节数有上限
+	*/
+	class PooledStackAllocator {
+	public:
+		static void* Alloc(size_t size);
+		static void Dealloc(void* ptr, size_t size);
+
+		// 设置每个线程最多缓存多少字节的空闲栈(不含保护页), 0表示不缓存
+		static void SetMaxCachedBytes(size_t bytes);
+		static size_t GetMaxCachedBytes();
+
+		// 当前线程缓存的空闲栈字节数
+		static size_t GetCachedBytes();
+
+		// 栈大小向上对齐到页
+		static size_t RoundUp(size_t size);
+	};
+
+#ifdef WS_FIBER_MALLOC_STACK
+	using StackAllocator = MallocStackAllocator;
+#else
+	using StackAllocator = PooledStackAllocator;
+#endif
+}
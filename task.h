@@ -0,0 +1,148 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace WebServer {
+
+	/*
+	* @brief 只能移动的void()任务, 调度器/定时器/IOManager里代替std::function
+	*        不超过INLINE_SIZE字节并且移动不抛异常的可调用对象直接放在内部缓冲区, 构造和移动都不分配内存
+	*        更大的放到堆上, 只在构造时分配一次, 之后的移动只是交换指针
+	*        std::function的内部缓冲区只有16字节, 而且要求可拷贝, 投递时构造一次, 交给协程时再拷贝一次
+	*/
+	class Task {
+	public:
+		static const size_t INLINE_SIZE = 48;
+
+		Task() {}
+		Task(std::nullptr_t) {}
+
+		// 只接受可以无参调用的对象, 避免和调度器里Fiber::fiberPtr的重载冲突
+		template<typename F, typename Func = typename std::decay<F>::type,
+			typename = typename std::enable_if<!std::is_same<Func, Task>::value>::type,
+			typename = decltype(std::declval<Func&>()())>
+		Task(F&& f) {
+			if (IsNull(f))
+				return;
+			assign<Func>(std::forward<F>(f), std::integral_constant<bool, FitsInline<Func>()>());
+		}
+
+		Task(Task&& other) noexcept {
+			moveFrom(other);
+		}
+
+		Task& operator=(Task&& other) noexcept {
+			if (this != &other) {
+				reset();
+				moveFrom(other);
+			}
+			return *this;
+		}
+
+		Task& operator=(std::nullptr_t) {
+			reset();
+			return *this;
+		}
+
+		Task(const Task&) = delete;
+		Task& operator=(const Task&) = delete;
+
+		~Task() { reset(); }
+
+		explicit operator bool() const { return m_Ops != nullptr; }
+
+		// 和std::function一样, 以非const方式调用保存的对象
+		void operator()() const { m_Ops->invoke(m_Storage); }
+
+		void swap(Task& other) {
+			Task tmp(std::move(other));
+			other = std::move(*this);
+			*this = std::move(tmp);
+		}
+
+		void reset() {
+			if (m_Ops) {
+				m_Ops->destroy(m_Storage);
+				m_Ops = nullptr;
+			}
+		}
+
+		// 可调用对象是否放在内部缓冲区
+		bool isInline() const { return m_Ops && m_Ops->inlined; }
+
+	private:
+		struct Ops {
+			void (*invoke)(void* storage);
+			// 把src里的对象移到未初始化的dst, 并析构src里的对象
+			void (*move)(void* dst, void* src);
+			void (*destroy)(void* storage);
+			bool inlined;
+		};
+
+		template<typename Func>
+		struct InlineOps {
+			static void Invoke(void* storage) { (*(Func*)storage)(); }
+			static void Move(void* dst, void* src) {
+				::new(dst) Func(std::move(*(Func*)src));
+				((Func*)src)->~Func();
+			}
+			static void Destroy(void* storage) { ((Func*)storage)->~Func(); }
+			static const Ops s_Ops;
+		};
+
+		template<typename Func>
+		struct HeapOps {
+			static void Invoke(void* storage) { (**(Func**)storage)(); }
+			static void Move(void* dst, void* src) { *(Func**)dst = *(Func**)src; }
+			static void Destroy(void* storage) { delete *(Func**)storage; }
+			static const Ops s_Ops;
+		};
+
+		template<typename Func>
+		static constexpr bool FitsInline() {
+			return sizeof(Func) <= INLINE_SIZE && alignof(Func) <= alignof(std::max_align_t)
+				&& std::is_nothrow_move_constructible<Func>::value;
+		}
+
+		template<typename Func, typename F>
+		void assign(F&& f, std::true_type) {
+			::new((void*)m_Storage) Func(std::forward<F>(f));
+			m_Ops = &InlineOps<Func>::s_Ops;
+		}
+
+		template<typename Func, typename F>
+		void assign(F&& f, std::false_type) {
+			*(Func**)m_Storage = new Func(std::forward<F>(f));
+			m_Ops = &HeapOps<Func>::s_Ops;
+		}
+
+		void moveFrom(Task& other) {
+			if (other.m_Ops) {
+				other.m_Ops->move(m_Storage, other.m_Storage);
+				m_Ops = other.m_Ops;
+				other.m_Ops = nullptr;
+			}
+		}
+
+		// 空的函数指针和std::function得到空任务, 和原来用std::function时一样可以用nullptr表示没有回调
+		template<typename F>
+		static bool IsNull(const F&) { return false; }
+		template<typename R, typename... Args>
+		static bool IsNull(R (*f)(Args...)) { return !f; }
+		template<typename Sig>
+		static bool IsNull(const std::function<Sig>& f) { return !f; }
+
+	private:
+		alignas(std::max_align_t) mutable unsigned char m_Storage[INLINE_SIZE];
+		const Ops* m_Ops = nullptr;
+	};
+
+	template<typename Func>
+	const Task::Ops Task::InlineOps<Func>::s_Ops = { &Invoke, &Move, &Destroy, true };
+
+	template<typename Func>
+	const Task::Ops Task::HeapOps<Func>::s_Ops = { &Invoke, &Move, &Destroy, false };
+}
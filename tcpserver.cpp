@@ -0,0 +1,112 @@
+#include "tcpserver.h"
+#include "core.h"
+#include "log.h"
+#include "utils.h"
+
+#include <string.h>
+
+namespace WebServer {
+
+	// 监听socket的accept超时, ms
+	static const uint64_t s_AcceptTimeout = 1000;
+
+	TcpServer::TcpServer(IOManager* worker, size_t shards)
+		: m_Worker(worker), m_Shards(shards)
+	{
+		WS_ASSERT(m_Worker);
+		if (!m_Shards)
+			m_Shards = m_Worker->getThreadIds().size();
+		if (!m_Shards)
+			m_Shards = 1;
+	}
+
+	TcpServer::~TcpServer() {
+		for (auto& i : m_Socks)
+			i->close();
+		m_Socks.clear();
+	}
+
+	bool TcpServer::bind(Address::addressPtr addr) {
+		if (bindShards(addr, m_Shards))
+			return true;
+		// 内核不支持SO_REUSEPORT, 退回单个监听socket
+		if (m_Shards > 1 && bindShards(addr, 1)) {
+			WS_LOG_WARN("TcpServer {} SO_REUSEPORT unavailable, fall back to 1 listener", m_Name);
+			return true;
+		}
+		return false;
+	}
+
+	bool TcpServer::bindShards(Address::addressPtr addr, size_t shards) {
+		for (auto& i : m_Socks)
+			i->close();
+		m_Socks.clear();
+
+		Address::addressPtr bindAddr = addr;
+		for (size_t i = 0; i < shards; i++) {
+			Socket::socketPtr sock = Socket::CreateTCP(addr);
+			if ((shards > 1 && !sock->setReusePort()) || !sock->bind(bindAddr) || !sock->listen()) {
+				WS_LOG_ERROR("TcpServer {} bind {} shard={} errno={} errstr={}", m_Name, addr->toString(), i, errno, strerror(errno));
+				for (auto& j : m_Socks)
+					j->close();
+				m_Socks.clear();
+				return false;
+			}
+			// 绑定的是0端口时, 其余分片要用第一个分片实际拿到的端口
+			if (i == 0)
+				bindAddr = sock->getLocalAddress();
+			// stop的取消可能赶在accept挂上读事件之前, 超时醒来再检查一次m_IsStop
+			sock->setReceiveTimeout(s_AcceptTimeout);
+			m_Socks.push_back(sock);
+		}
+		return true;
+	}
+
+	bool TcpServer::start() {
+		if (!m_IsStop)
+			return true;
+		if (m_Socks.empty())
+			return false;
+		m_IsStop = false;
+		const std::vector<int>& threads = m_Worker->getThreadIds();
+		for (size_t i = 0; i < m_Socks.size(); i++) {
+			int thread = threads.empty() ? -1 : threads[i % threads.size()];
+			m_Worker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), m_Socks[i]), thread);
+		}
+		return true;
+	}
+
+	void TcpServer::stop() {
+		m_IsStop = true;
+		auto self = shared_from_this();
+		// 只取消挂在监听socket上的accept, 由接收协程自己close
+		// 在这里close的话, 另一个线程上的接收协程可能正要把这个fd加进epoll
+		m_Worker->schedule([this, self]() {
+			for (auto& i : m_Socks)
+				i->cancelAll();
+			m_Socks.clear();
+		});
+	}
+
+	void TcpServer::handleClient(Socket::socketPtr client) {
+	}
+
+	void TcpServer::startAccept(Socket::socketPtr sock) {
+		// 接收协程投递时固定在这个线程上, 挂起等连接后IOManager会把它投回同一个线程
+		int thread = GetThreadId();
+		while (!m_IsStop) {
+			Socket::socketPtr client = sock->accept();
+			if (client) {
+				++m_AcceptCount;
+				if (WS_UNLIKELY(GetThreadId() != thread))
+					++m_MigratedAcceptCount;
+				client->setReceiveTimeout(m_RecvTimeout);
+				// 在完成accept的线程上处理, 连接的第一次I/O和accept用同一份热缓存
+				m_Worker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client), GetThreadId());
+			}
+			else if (!sock->isValid())
+				break;
+		}
+		sock->close();
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "iomanager.h"
+#include "socket.h"
+#include "address.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace WebServer {
+
+	/*
+	* @brief TCP服务器, 按SO_REUSEPORT分片监听
+	*        每个分片是一个独立的监听socket, 接收协程固定在一个工作线程上启动, 内核按四元组哈希把新连接分给各个分片
+	*        accept到的连接在完成accept的线程上处理, 不经过全局队列再分发
+	*        内核不支持SO_REUSEPORT时退化为单个监听socket
+	*/
+	class TcpServer : public std::enable_shared_from_this<TcpServer> {
+	public:
+		typedef std::shared_ptr<TcpServer> tcpServerPtr;
+
+		/*
+		* @param[in] worker 接收连接和处理连接的IOManager
+		* @param[in] shards 监听socket的个数, 0表示每个工作线程一个
+		*/
+		TcpServer(IOManager* worker = IOManager::getThis(), size_t shards = 0);
+		virtual ~TcpServer();
+
+		/*
+		* @brief 创建分片监听socket并bind/listen
+		*        端口为0时第一个分片拿到的端口给其余分片使用
+		*        要在开启了hook的协程里调用, 否则监听socket是阻塞的, accept会卡住工作线程
+		*/
+		virtual bool bind(Address::addressPtr addr);
+		virtual bool start();
+		virtual void stop();
+
+		uint64_t getRecvTimeout() const { return m_RecvTimeout; }
+		void setRecvTimeout(uint64_t timeout) { m_RecvTimeout = timeout; }
+
+		const std::string& getName() const { return m_Name; }
+		void setName(const std::string& name) { m_Name = name; }
+
+		bool isStop() const { return m_IsStop; }
+		size_t getShardCount() const { return m_Socks.size(); }
+		const std::vector<Socket::socketPtr>& getSocks() const { return m_Socks; }
+		uint64_t getAcceptCount() const { return m_AcceptCount; }
+		// 不在分片接收协程启动线程上完成的accept数, 正常应该是0
+		uint64_t getMigratedAcceptCount() const { return m_MigratedAcceptCount; }
+
+	protected:
+		// 处理一个新连接, 默认什么也不做, 连接随client析构关闭
+		virtual void handleClient(Socket::socketPtr client);
+		// 分片的接收循环, 直到stop
+		virtual void startAccept(Socket::socketPtr sock);
+
+	private:
+		bool bindShards(Address::addressPtr addr, size_t shards);
+
+	private:
+		IOManager* m_Worker;
+		size_t m_Shards;
+		std::vector<Socket::socketPtr> m_Socks;
+		uint64_t m_RecvTimeout = 2 * 60 * 1000;
+		std::string m_Name = "WebServer/1.0";
+		std::atomic<bool> m_IsStop{ true };
+		std::atomic<uint64_t> m_AcceptCount{ 0 };
+		std::atomic<uint64_t> m_MigratedAcceptCount{ 0 };
+	};
+}
@@ -31,12 +31,12 @@ namespace WebServer {
 		if (result) {
 			throw std::logic_error("pthread_create error");
 		}
-		// ȷ߳ͷ(runnotify)
+		// 确保线程运行起来了再释放(run里面的notify)
 		m_Semaphore.wait();
 	}
 
 	Thread::~Thread() {
-		// JoinΪ0Ϊ˺ͻ,ʹJoinͱʾȴͷ,ʲô,ʹJoin֮ǰ͵,ֱӽ̴̷߳߳
+		// Join中置为0就是为了和这里避免冲突,使用Join就表示等待结束再释放,析构里面什么都不做,如果在使用Join之前就到了析构里面,就直接结束并将线程从主线程分离
 		if (m_Thread)
 			pthread_detach(m_Thread);
 	}
@@ -61,7 +61,7 @@ namespace WebServer {
 
 		std::function<void()> func;
 		func.swap(thread->m_Func);
-		// ׼,ͷsemaphore,캯wait˳,߳̿Լ½
+		// 准备就绪,释放semaphore,构造函数中wait退出阻塞,主线程可以继续往下进行
 		thread->m_Semaphore.notify();
 		func();
 		
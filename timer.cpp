@@ -1,40 +1,94 @@
 #include "timer.h"
+#include "fiber.h"
 #include "utils.h"
 
+#include <new>
+#include <string.h>
+
 namespace WebServer {
 
-	// ĬϴС
-	bool Timer::Comparator::operator()(const Timer::timerPtr& lhs, const Timer::timerPtr& rhs) const {
-		if (!lhs && !rhs)
-			return false;
-		if (!lhs)
-			return true;
-		if (!rhs)
-			return false;
-		if (lhs->m_Next < rhs->m_Next)
-			return false;
-		if (lhs->m_Next > rhs->m_Next)
-			return true;
-		return lhs.get() < rhs.get();
+	// 每个线程最多缓存的定时器节点数
+	static const size_t MAX_CACHED_TIMERS = 4096;
+
+	struct TimerFreeList {
+		struct Block {
+			Block* next;
+		};
+
+		~TimerFreeList() {
+			while (head) {
+				Block* block = head;
+				head = head->next;
+				::operator delete(block);
+			}
+			count = 0;
+			destroyed = true;
+		}
+
+		Block* head = nullptr;
+		size_t count = 0;
+		// allocate_shared出来的块大小都一样, 第一次分配时记下
+		size_t size = 0;
+		static thread_local bool destroyed;
+	};
+
+	thread_local bool TimerFreeList::destroyed = false;
+	static thread_local TimerFreeList t_TimerFreeList;
+
+	void* TimerPool::Alloc(size_t size) {
+		if (!TimerFreeList::destroyed) {
+			TimerFreeList& list = t_TimerFreeList;
+			if (list.head && list.size == size) {
+				TimerFreeList::Block* block = list.head;
+				list.head = block->next;
+				--list.count;
+				return block;
+			}
+		}
+		return ::operator new(size < sizeof(TimerFreeList::Block) ? sizeof(TimerFreeList::Block) : size);
 	}
 
-	Timer::Timer(uint64_t ms, std::function<void()> func, bool recurring, TimerManager* manager) 
-		: m_Ms(ms), m_Func(func), m_Recurring(recurring), m_Manager(manager)
+	void TimerPool::Dealloc(void* ptr, size_t size) {
+		if (!TimerFreeList::destroyed) {
+			TimerFreeList& list = t_TimerFreeList;
+			if (!list.size)
+				list.size = size;
+			if (list.size == size && list.count < MAX_CACHED_TIMERS) {
+				TimerFreeList::Block* block = (TimerFreeList::Block*)ptr;
+				block->next = list.head;
+				list.head = block;
+				++list.count;
+				return;
+			}
+		}
+		::operator delete(ptr);
+	}
+
+	Timer::Timer(uint64_t ms, Task func, bool recurring, TimerManager* manager)
+		: m_Ms(ms), m_Recurring(recurring), m_Manager(manager)
 	{
-		m_Next = GetCurrentMS() + m_Ms;
+		if (m_Recurring)
+			m_SharedFunc = std::make_shared<Task>(std::move(func));
+		else
+			m_Func = std::move(func);
+		m_Next = GetMonotonicMS() + m_Ms;
 	}
 
-	Timer::Timer(uint64_t next)
-		: m_Next(next)
+	Timer::Timer(uint64_t next, std::shared_ptr<Fiber> fiber, TimerManager* manager)
+		: m_Next(next), m_Fiber(fiber), m_Manager(manager)
 	{
 	}
 
 	bool Timer::cancel() {
+		// 时间轮持有的引用要在锁外释放, 它可能是最后一个引用
+		Timer::timerPtr self;
 		TimerManager::RWMutexType::WriteLock lock(m_Manager->m_Mtx);
-		if (m_Func) {
+		if (isActive()) {
 			m_Func = nullptr;
-			auto it = m_Manager->m_Timers.find(shared_from_this());
-			m_Manager->m_Timers.erase(it);
+			m_SharedFunc = nullptr;
+			m_Fiber = nullptr;
+			m_Manager->unlink(this);
+			self.swap(m_Self);
 			return true;
 		}
 		return false;
@@ -42,15 +96,12 @@ namespace WebServer {
 
 	bool Timer::refresh() {
 		TimerManager::RWMutexType::WriteLock lock(m_Manager->m_Mtx);
-		if (!m_Func)
+		if (!isActive())
 			return false;
 
-		auto it = m_Manager->m_Timers.find(shared_from_this());
-		if (it == m_Manager->m_Timers.end())
-			return false;
-		m_Manager->m_Timers.erase(it);
-		m_Next = GetCurrentMS() + m_Ms;
-		m_Manager->m_Timers.insert(shared_from_this());
+		m_Manager->unlink(this);
+		m_Next = GetMonotonicMS() + m_Ms;
+		m_Manager->link(this);
 		return true;
 	}
 
@@ -59,15 +110,12 @@ namespace WebServer {
 			return true;
 		TimerManager::RWMutexType::WriteLock lock(m_Manager->m_Mtx);
 
-		if (!m_Func)
+		if (!isActive())
 			return false;
-		auto it = m_Manager->m_Timers.find(shared_from_this());
-		if (it == m_Manager->m_Timers.end())
-			return false;
-		m_Manager->m_Timers.erase(it);
+		m_Manager->unlink(this);
 		uint64_t start = 0;
 		if (fromNow)
-			start = GetCurrentMS();
+			start = GetMonotonicMS();
 		else
 			start = m_Next - m_Ms;
 		m_Ms = ms;
@@ -77,23 +125,40 @@ namespace WebServer {
 	}
 
 	TimerManager::TimerManager() {
-		m_previouseTime = GetCurrentMS();
+		for (auto& i : m_Slots)
+			i.prev = i.next = &i;
+		memset(m_Bitmap, 0, sizeof(m_Bitmap));
+		m_Current = GetMonotonicMS();
 	}
 
 	TimerManager::~TimerManager() {
-
+		std::vector<Timer::timerPtr> timers;
+		for (uint32_t i = 0; i < SLOT_COUNT; i++)
+			collect(i, timers);
+		for (auto& i : timers) {
+			i->m_Func = nullptr;
+			i->m_SharedFunc = nullptr;
+			i->m_Fiber = nullptr;
+		}
 	}
 
-	Timer::timerPtr TimerManager::addTimer(uint64_t ms, std::function<void()> func, bool recurring) {
-		Timer::timerPtr timer(new Timer(ms, func, recurring, this));
+	Timer::timerPtr TimerManager::addTimer(uint64_t ms, Task func, bool recurring) {
+		Timer::timerPtr timer = std::allocate_shared<Timer>(TimerAllocator<Timer>(), ms, std::move(func), recurring, this);
 		RWMutexType::WriteLock lock(m_Mtx);
 		addTimer(timer, lock);
 		return timer;
 	}
 
 	void TimerManager::addTimer(Timer::timerPtr ptr, RWMutexType::WriteLock& lock) {
-		auto it = m_Timers.insert(ptr).first;
-		bool atFront = (it == m_Timers.begin()) && !m_Tickled;
+		// 时间轮空着的时候直接拨到当前时间, 不用在listExpiredFunc里一格格追上来
+		if (!m_Count) {
+			uint64_t nowMs = GetMonotonicMS();
+			if (nowMs > m_Current)
+				m_Current = nowMs;
+		}
+		ptr->m_Self = ptr;
+		link(ptr.get());
+		bool atFront = ptr->m_Next < m_Deadline && !m_Tickled;
 		if (atFront)
 			m_Tickled = true;
 		lock.unlock();
@@ -101,77 +166,249 @@ namespace WebServer {
 			onTimerInsertedAtFront();
 	}
 
-	static void OnTimer(std::weak_ptr<void> weakCond, std::function<void()> func) {
-		std::shared_ptr<void> tmp = weakCond.lock();
+	void TimerManager::addSleepTimer(uint64_t us, std::shared_ptr<Fiber> fiber) {
+		// 到期时刻向上取整到毫秒, 到期判断用的是截断的毫秒, 这样不会早醒
+		uint64_t next = (GetMonotonicUS() + us + 999) / 1000;
+		Timer::timerPtr timer = std::allocate_shared<Timer>(TimerAllocator<Timer>(), next, fiber, this);
+		RWMutexType::WriteLock lock(m_Mtx);
+		addTimer(timer, lock);
+	}
+
+	// 条件放在Timer里, 不再用std::bind把条件和回调包成一个新的闭包, 那样装不进Task的内部缓冲区
+	Timer::timerPtr TimerManager::addConditionTimer(uint64_t ms, Task func, std::weak_ptr<void> weakCond, bool recurring) {
+		Timer::timerPtr timer = std::allocate_shared<Timer>(TimerAllocator<Timer>(), ms, std::move(func), recurring, this);
+		timer->m_Cond = std::move(weakCond);
+		timer->m_HasCond = true;
+		RWMutexType::WriteLock lock(m_Mtx);
+		addTimer(timer, lock);
+		return timer;
+	}
+
+	Task Timer::takeExpired() {
+		if (m_Recurring) {
+			// 回调可能还在执行时定时器就被取消或者再次到期, 每次到期的任务各持有一个引用
+			if (!m_HasCond)
+				return [func = m_SharedFunc]() { (*func)(); };
+			return [cond = m_Cond, func = m_SharedFunc]() {
+				std::shared_ptr<void> tmp = cond.lock();
+				if (tmp)
+					(*func)();
+			};
+		}
+		if (!m_HasCond)
+			return std::move(m_Func);
+		// 回调先移到m_Expired, 到期任务只带一个Timer的引用
+		m_Expired = std::move(m_Func);
+		return [self = shared_from_this()]() { self->onConditionExpired(); };
+	}
+
+	void Timer::onConditionExpired() {
+		Task func(std::move(m_Expired));
+		std::shared_ptr<void> tmp = m_Cond.lock();
 		if (tmp)
 			func();
 	}
 
-	Timer::timerPtr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> func, std::weak_ptr<void> weakCond, bool recurring) {
-		return addTimer(ms, std::bind(&OnTimer, weakCond, func), recurring);
+	// 第0层位图里[from, to)范围内第一个非空槽, 没有返回to
+	static uint32_t FindLevel0(const uint64_t* bitmap, uint32_t from, uint32_t to) {
+		while (from < to) {
+			uint64_t word = bitmap[from / 64] & (~0ull << (from % 64));
+			if (word) {
+				uint32_t i = (from & ~63u) + __builtin_ctzll(word);
+				return i < to ? i : to;
+			}
+			from = (from & ~63u) + 64;
+		}
+		return to;
+	}
+
+	void TimerManager::link(Timer* timer) {
+		uint64_t expire = timer->m_Next < m_Current ? m_Current : timer->m_Next;
+		uint64_t delta = expire - m_Current;
+		uint32_t slot;
+		if (delta < LEVEL0_SIZE)
+			slot = expire & (LEVEL0_SIZE - 1);
+		else {
+			int level = 1;
+			while (level < LEVELS - 1 && delta >= (1ull << (LEVEL0_BITS + level * LEVEL_BITS)))
+				level++;
+			int shift = LEVEL0_BITS + (level - 1) * LEVEL_BITS;
+			// 超出最高层一圈的先放在最远的槽, 级联下来时再按真实时间放
+			uint64_t maxDelta = (1ull << (shift + LEVEL_BITS)) - 1;
+			if (delta > maxDelta)
+				expire = m_Current + maxDelta;
+			slot = LEVEL0_SIZE + (level - 1) * LEVEL_SIZE + ((expire >> shift) & (LEVEL_SIZE - 1));
+		}
+
+		if (expire < m_NextExpire.load(std::memory_order_relaxed))
+			m_NextExpire.store(expire, std::memory_order_relaxed);
+
+		TimerNode* head = &m_Slots[slot];
+		timer->prev = head->prev;
+		timer->next = head;
+		head->prev->next = timer;
+		head->prev = timer;
+		timer->m_Slot = slot;
+		m_Bitmap[slot / 64] |= 1ull << (slot % 64);
+		++m_Count;
+	}
+
+	void TimerManager::unlink(Timer* timer) {
+		timer->prev->next = timer->next;
+		timer->next->prev = timer->prev;
+		timer->prev = timer->next = nullptr;
+		TimerNode* head = &m_Slots[timer->m_Slot];
+		if (head->next == head)
+			m_Bitmap[timer->m_Slot / 64] &= ~(1ull << (timer->m_Slot % 64));
+		--m_Count;
+	}
+
+	void TimerManager::collect(uint32_t slot, std::vector<Timer::timerPtr>& expired) {
+		TimerNode* head = &m_Slots[slot];
+		for (TimerNode* node = head->next; node != head;) {
+			Timer* timer = static_cast<Timer*>(node);
+			node = node->next;
+			timer->prev = timer->next = nullptr;
+			expired.push_back(std::move(timer->m_Self));
+			--m_Count;
+		}
+		head->prev = head->next = head;
+		m_Bitmap[slot / 64] &= ~(1ull << (slot % 64));
+	}
+
+	// m_Current走到第0层的边界, 把上层对应槽里的定时器重新分配到下层
+	void TimerManager::cascade() {
+		for (int level = 1; level < LEVELS; level++) {
+			int shift = LEVEL0_BITS + (level - 1) * LEVEL_BITS;
+			uint32_t index = (m_Current >> shift) & (LEVEL_SIZE - 1);
+			uint32_t slot = LEVEL0_SIZE + (level - 1) * LEVEL_SIZE + index;
+			TimerNode* head = &m_Slots[slot];
+			TimerNode* node = head->next;
+			// 先把整个槽摘下来, 重新放置时可能又落回这一层
+			head->prev->next = nullptr;
+			head->prev = head->next = head;
+			m_Bitmap[slot / 64] &= ~(1ull << (slot % 64));
+			while (node && node != head) {
+				Timer* timer = static_cast<Timer*>(node);
+				node = node->next;
+				--m_Count;
+				link(timer);
+			}
+			// 这一层也走完了一圈才需要继续级联上一层
+			if (index)
+				break;
+		}
+	}
+
+	uint64_t TimerManager::nextDeadline() const {
+		if (!m_Count)
+			return ~0ull;
+
+		// 第0层先找本圈剩下的槽, 找到就是准确的到期时间
+		uint32_t index = m_Current & (LEVEL0_SIZE - 1);
+		uint64_t base = m_Current - index;
+		uint32_t slot = FindLevel0(m_Bitmap, index, LEVEL0_SIZE);
+		if (slot < LEVEL0_SIZE)
+			return base + slot;
+
+		uint64_t deadline = ~0ull;
+		slot = FindLevel0(m_Bitmap, 0, index);
+		if (slot < index)
+			deadline = base + LEVEL0_SIZE + slot;
+
+		// 上层的槽只能给出级联时间, 它不会晚于槽里任何一个定时器的到期时间
+		for (int level = 1; level < LEVELS; level++) {
+			uint64_t word = m_Bitmap[(LEVEL0_SIZE + (level - 1) * LEVEL_SIZE) / 64];
+			if (!word)
+				continue;
+			int shift = LEVEL0_BITS + (level - 1) * LEVEL_BITS;
+			uint32_t cur = (m_Current >> shift) & (LEVEL_SIZE - 1);
+			// 当前槽已经级联过, 里面放的是下一圈的定时器, 从cur + 1开始找
+			uint32_t rot = (cur + 1) & (LEVEL_SIZE - 1);
+			uint64_t rotated = rot ? (word >> rot) | (word << (64 - rot)) : word;
+			uint64_t dist = __builtin_ctzll(rotated) + 1;
+			uint64_t t = ((m_Current >> shift) + dist) << shift;
+			if (t < deadline)
+				deadline = t;
+		}
+		return deadline;
 	}
 
 	uint64_t TimerManager::getNextTimer() {
-		RWMutexType::ReadLock lock(m_Mtx);
+		RWMutexType::WriteLock lock(m_Mtx);
 		m_Tickled = false;
-		if (m_Timers.empty())
+		m_Deadline = nextDeadline();
+		m_NextExpire.store(m_Deadline, std::memory_order_relaxed);
+		if (m_Deadline == ~0ull)
 			return ~0ull;
-		const Timer::timerPtr& next = *m_Timers.begin();
-		uint64_t nowMs = GetCurrentMS();
-		if (nowMs >= next->m_Next)
+		// 决定idle睡多久, 用精确时间, 缓存的时间可能已经落后了一段
+		uint64_t nowMs = GetMonotonicMS();
+		if (nowMs >= m_Deadline)
 			return 0;
 		else
-			return next->m_Next - nowMs;
-	}
-
-	bool TimerManager::detectClockRollover(uint64_t nowMs) {
-		bool rollover = false;
-		if (nowMs < m_previouseTime && nowMs < (m_previouseTime - 60 * 60 * 1000))
-			rollover = true;
-		m_previouseTime = nowMs;
-		return rollover;
+			return m_Deadline - nowMs;
 	}
 
-	void TimerManager::listExpiredFunc(std::vector<std::function<void()>>& funcs) {
-		uint64_t nowMs = GetCurrentMS();
+	void TimerManager::listExpiredFunc(std::vector<Task>& funcs, std::vector<std::shared_ptr<Fiber>>& fibers) {
+		// idle刚刷新过本线程的缓存时间
+		uint64_t nowMs = GetCachedMS();
 		std::vector<Timer::timerPtr> expired;
 		{
 			RWMutexType::ReadLock lock(m_Mtx);
-			if (m_Timers.empty())
+			if (!m_Count) {
+				// 定时器都被取消了, 清掉hasExpiredTimer看到的下界
+				m_NextExpire.store(~0ull, std::memory_order_relaxed);
 				return;
+			}
 		}
 		RWMutexType::WriteLock lock(m_Mtx);
-		if (m_Timers.empty())
-			return;
-		bool rollover = detectClockRollover(nowMs);
-		if (!rollover && ((*m_Timers.begin())->m_Next > nowMs))
+		if (!m_Count) {
+			m_NextExpire.store(~0ull, std::memory_order_relaxed);
 			return;
+		}
 
-		// ɸѡСڵڵǰʱĶʱ¼
-		Timer::timerPtr nowTimer(new Timer(nowMs));
-		auto it = rollover ? m_Timers.end() : m_Timers.lower_bound(nowTimer);
-		while (it != m_Timers.end() && (*it)->m_Next == nowMs) {
-			++it;
+		// 停在nowMs上, 之后再加进来已经到期的定时器都落在这个槽里, 下次调用时取出
+		while (m_Current <= nowMs) {
+			uint32_t index = m_Current & (LEVEL0_SIZE - 1);
+			if (m_Bitmap[index / 64] & (1ull << (index % 64)))
+				collect(index, expired);
+			if (m_Current == nowMs)
+				break;
+			if (!m_Count) {
+				m_Current = nowMs;
+				break;
+			}
+			// 跳到下一个非空槽或者下一个边界, 中间的空槽不用逐个走
+			uint64_t target = m_Current - index + FindLevel0(m_Bitmap, index + 1, LEVEL0_SIZE);
+			m_Current = target > nowMs ? nowMs : target;
+			if (!(m_Current & (LEVEL0_SIZE - 1)))
+				cascade();
 		}
 
-		expired.insert(expired.begin(), m_Timers.begin(), it);
-		m_Timers.erase(m_Timers.begin(), it);
 		funcs.reserve(expired.size());
-
 		for (auto& timer : expired) {
-			funcs.push_back(timer->m_Func);
+			if (timer->m_Fiber) {
+				fibers.push_back(std::move(timer->m_Fiber));
+				continue;
+			}
+			funcs.push_back(timer->takeExpired());
 			if (timer->m_Recurring) {
 				timer->m_Next = nowMs + timer->m_Ms;
-				m_Timers.insert(timer);
+				timer->m_Self = timer;
+				link(timer.get());
 			}
-			else
-				timer->m_Func = nullptr;
 		}
+		m_NextExpire.store(nextDeadline(), std::memory_order_relaxed);
+	}
+
+	bool TimerManager::hasExpiredTimer() const {
+		uint64_t next = m_NextExpire.load(std::memory_order_relaxed);
+		return next != ~0ull && next <= GetMonotonicMS();
 	}
 
 	bool TimerManager::hasTimer() {
 		RWMutexType::ReadLock lock(m_Mtx);
-		return !m_Timers.empty();
+		return m_Count != 0;
 	}
 
-}
\ No newline at end of file
+}
@@ -1,18 +1,63 @@
 #pragma once
 
 #include "mutex.h"
-#include <set>
+#include "task.h"
+#include <stddef.h>
+#include <stdint.h>
 #include <vector>
+#include <atomic>
 #include <memory>
-#include <functional>
 
 namespace WebServer {
 
 	class TimerManager;
+	class Fiber;
+
+	/*
+	* @brief 定时器节点池, 每个线程一个空闲链表
+	*        节点在哪个线程释放就留在哪个线程, 每个线程缓存的数量有上限, 超过的直接还给系统
+	*/
+	class TimerPool {
+	public:
+		static void* Alloc(size_t size);
+		static void Dealloc(void* ptr, size_t size);
+	};
+
+	// allocate_shared用的分配器, 控制块和Timer一次分配, 内存来自TimerPool
+	template<typename T>
+	struct TimerAllocator {
+		typedef T value_type;
+
+		TimerAllocator() {}
+		template<typename U>
+		TimerAllocator(const TimerAllocator<U>&) {}
+
+		T* allocate(size_t n) { return (T*)TimerPool::Alloc(n * sizeof(T)); }
+		void deallocate(T* ptr, size_t n) { TimerPool::Dealloc(ptr, n * sizeof(T)); }
+
+		// Timer的构造函数是私有的, 由分配器代为构造
+		template<typename U, typename... Args>
+		void construct(U* ptr, Args&&... args) { ::new((void*)ptr) U(std::forward<Args>(args)...); }
+		template<typename U>
+		void destroy(U* ptr) { ptr->~U(); }
+
+		template<typename U>
+		bool operator==(const TimerAllocator<U>&) const { return true; }
+		template<typename U>
+		bool operator!=(const TimerAllocator<U>&) const { return false; }
+	};
+
+	// 时间轮槽里的侵入式双向链表节点, 槽本身是一个哨兵节点
+	struct TimerNode {
+		TimerNode* prev = nullptr;
+		TimerNode* next = nullptr;
+	};
+
+	class Timer : public TimerNode, public std::enable_shared_from_this<Timer> {
 
-	class Timer : public std::enable_shared_from_this<Timer> {
-	
 	friend class TimerManager;
+	template<typename T>
+	friend struct TimerAllocator;
 	public:
 		typedef std::shared_ptr<Timer> timerPtr;
 
@@ -21,26 +66,43 @@ namespace WebServer {
 		bool reset(uint64_t ms, bool fromNow);
 
 	private:
-		Timer(uint64_t ms, std::function<void()> func, bool recurring, TimerManager* manager);
+		Timer(uint64_t ms, Task func, bool recurring, TimerManager* manager);
+		// 睡眠定时器, 到期时直接把fiber交给调度器
+		Timer(uint64_t next, std::shared_ptr<Fiber> fiber, TimerManager* manager);
 
-		Timer(uint64_t next);
+		bool isActive() const { return m_Func || m_SharedFunc || m_Fiber; }
+		// 到期时交给调度器的任务, 调用时持有写锁
+		Task takeExpired();
+		// 一次性的条件定时器到期后执行, 条件还在才调用回调
+		void onConditionExpired();
 
 	private:
 		bool m_Recurring = false;
 		uint64_t m_Ms = 0;
 		uint64_t m_Next = 0;
-		std::function<void()> m_Func;
+		// 一次性定时器的回调, 到期时移给调度器
+		Task m_Func;
+		// 循环定时器的回调, 每次到期都要执行, 多次到期共享同一个对象
+		std::shared_ptr<Task> m_SharedFunc;
+		// 一次性条件定时器到期后等待执行的回调, 只有到期任务访问
+		Task m_Expired;
+		std::weak_ptr<void> m_Cond;
+		bool m_HasCond = false;
+		std::shared_ptr<Fiber> m_Fiber;
 		TimerManager* m_Manager = nullptr;
-
-	private:
-		// ʱȽϷº
-		struct Comparator {
-			bool operator() (const Timer::timerPtr& lhs, const Timer::timerPtr& rhs) const;
-		};
+		// 所在的槽, 以及挂在时间轮上期间时间轮持有的引用
+		uint32_t m_Slot = 0;
+		timerPtr m_Self;
 	};
 
+	/*
+	* @brief 分层时间轮, 添加和取消都是O(1)
+	*        第0层256个槽, 每槽1ms; 往上4层各64个槽, 每槽的跨度是下一层的一整圈, 最远约49天
+	*        更远的定时器先放在最高层, 级联下来时按真实到期时间重新放置
+	*        时间用单调时钟, 不受系统时间调整影响, 不再需要检测时钟回拨
+	*/
 	class TimerManager {
-	
+
 	friend class Timer;
 	public:
 		typedef RWMutex RWMutexType;
@@ -48,24 +110,54 @@ namespace WebServer {
 		TimerManager();
 		virtual ~TimerManager();
 
-		Timer::timerPtr addTimer(uint64_t ms, std::function<void()> func, bool recurring = false);
+		Timer::timerPtr addTimer(uint64_t ms, Task func, bool recurring = false);
 
-		Timer::timerPtr addConditionTimer(uint64_t ms, std::function<void()> func, std::weak_ptr<void> weakCond, bool recurring = false);
+		// weakCond指向的对象已经释放时, 到期不执行回调
+		Timer::timerPtr addConditionTimer(uint64_t ms, Task func, std::weak_ptr<void> weakCond, bool recurring = false);
+
+		/*
+		* @brief 让fiber睡眠us微秒, 到期后fiber直接进入调度队列, 不经过回调
+		*        时间轮精度是1ms, 向上取整, 保证不会提前唤醒
+		*/
+		void addSleepTimer(uint64_t us, std::shared_ptr<Fiber> fiber);
 
 		uint64_t getNextTimer();
-		void listExpiredFunc(std::vector<std::function<void()>>& funcs);
+		// funcs: 到期的回调; fibers: 到期的睡眠定时器对应的协程
+		void listExpiredFunc(std::vector<Task>& funcs, std::vector<std::shared_ptr<Fiber>>& fibers);
 
 		bool hasTimer();
+		// 是否有定时器已经到期, 不加锁, 工作线程在执行任务的间隙调用
+		bool hasExpiredTimer() const;
 	protected:
 		virtual void onTimerInsertedAtFront() = 0;
 		void addTimer(Timer::timerPtr ptr, RWMutexType::WriteLock& lock);
 	private:
-		bool detectClockRollover(uint64_t nowMs);
+		// 以下都要在持有写锁时调用
+		void link(Timer* timer);
+		void unlink(Timer* timer);
+		void cascade();
+		void collect(uint32_t slot, std::vector<Timer::timerPtr>& expired);
+		uint64_t nextDeadline() const;
 	private:
-		std::set<Timer::timerPtr, Timer::Comparator> m_Timers;
+		static const int LEVELS = 5;
+		static const int LEVEL0_BITS = 8;
+		static const int LEVEL_BITS = 6;
+		static const uint32_t LEVEL0_SIZE = 1 << LEVEL0_BITS;
+		static const uint32_t LEVEL_SIZE = 1 << LEVEL_BITS;
+		static const uint32_t SLOT_COUNT = LEVEL0_SIZE + (LEVELS - 1) * LEVEL_SIZE;
+
+		TimerNode m_Slots[SLOT_COUNT];
+		// 非空槽的位图, 找下一个到期的槽时不用逐个扫描
+		uint64_t m_Bitmap[SLOT_COUNT / 64];
+		// 时间轮当前走到的毫秒, 更早的槽都已经处理过, 已经到期的定时器放在它对应的槽里
+		uint64_t m_Current = 0;
+		size_t m_Count = 0;
 		RWMutexType m_Mtx;
-		// Ƿ񴥷onTimerInsertedAtFront
+		// 是否触发onTimerInsertedAtFront
 		bool m_Tickled = false;
-		uint64_t m_previouseTime = 0;
+		// 上一次getNextTimer算出的最早到期时间, 新定时器比它早才需要唤醒idle
+		uint64_t m_Deadline = ~0ull;
+		// 最早到期时间的下界, 写锁内更新, hasExpiredTimer无锁读取
+		std::atomic<uint64_t> m_NextExpire{ ~0ull };
 	};
-}
\ No newline at end of file
+}
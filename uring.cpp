@@ -0,0 +1,148 @@
+#include "uring.h"
+#include "core.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace WebServer {
+
+	static int SysSetup(unsigned entries, io_uring_params* p) {
+		return (int)syscall(__NR_io_uring_setup, entries, p);
+	}
+
+	static int SysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+		return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+	}
+
+	static int SysRegister(int fd, unsigned opcode, const void* arg, unsigned nrArgs) {
+		return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+	}
+
+	IoUring::IoUring() {
+	}
+
+	IoUring::~IoUring() {
+		if (m_Sqes)
+			munmap(m_Sqes, m_SqesSize);
+		if (m_CqRing && m_CqRing != m_SqRing)
+			munmap(m_CqRing, m_CqRingSize);
+		if (m_SqRing)
+			munmap(m_SqRing, m_SqRingSize);
+		if (m_Fd >= 0)
+			close(m_Fd);
+	}
+
+	bool IoUring::init(unsigned entries, const uint8_t* ops, size_t opCount) {
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		int fd = SysSetup(entries, &p);
+		if (fd < 0)
+			return false;
+		m_Fd = fd;
+
+		m_SqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		m_CqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		if (p.features & IORING_FEAT_SINGLE_MMAP) {
+			if (m_CqRingSize > m_SqRingSize)
+				m_SqRingSize = m_CqRingSize;
+			m_CqRingSize = m_SqRingSize;
+		}
+
+		m_SqRing = mmap(nullptr, m_SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (m_SqRing == MAP_FAILED) {
+			m_SqRing = nullptr;
+			return false;
+		}
+		if (p.features & IORING_FEAT_SINGLE_MMAP)
+			m_CqRing = m_SqRing;
+		else {
+			m_CqRing = mmap(nullptr, m_CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			if (m_CqRing == MAP_FAILED) {
+				m_CqRing = nullptr;
+				return false;
+			}
+		}
+		m_SqesSize = p.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = mmap(nullptr, m_SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+			return false;
+		m_Sqes = (io_uring_sqe*)sqes;
+
+		char* sq = (char*)m_SqRing;
+		m_SqHead = (std::atomic<unsigned>*)(sq + p.sq_off.head);
+		m_SqTail = (std::atomic<unsigned>*)(sq + p.sq_off.tail);
+		m_SqFlags = (std::atomic<unsigned>*)(sq + p.sq_off.flags);
+		m_SqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+		m_SqEntries = p.sq_entries;
+		// SQE按tail顺序使用, 索引数组固定为恒等映射
+		unsigned* array = (unsigned*)(sq + p.sq_off.array);
+		for (unsigned i = 0; i < m_SqEntries; i++)
+			array[i] = i;
+		m_SqeTail = m_SqePublished = m_SqTail->load(std::memory_order_relaxed);
+
+		char* cq = (char*)m_CqRing;
+		m_CqHead = (std::atomic<unsigned>*)(cq + p.cq_off.head);
+		m_CqTail = (std::atomic<unsigned>*)(cq + p.cq_off.tail);
+		m_CqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+		m_Cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+		// 没有NODROP的老内核在CQ满时会直接丢完成事件, 协程就再也等不回来了
+		if (!(p.features & IORING_FEAT_NODROP) || !probe(ops, opCount)) {
+			close(m_Fd);
+			m_Fd = -1;
+			return false;
+		}
+		return true;
+	}
+
+	bool IoUring::probe(const uint8_t* ops, size_t opCount) {
+		const unsigned MAX_OPS = 256;
+		size_t size = sizeof(io_uring_probe) + MAX_OPS * sizeof(io_uring_probe_op);
+		io_uring_probe* p = (io_uring_probe*)calloc(1, size);
+		bool ok = SysRegister(m_Fd, IORING_REGISTER_PROBE, p, MAX_OPS) == 0;
+		for (size_t i = 0; ok && i < opCount; i++) {
+			if (ops[i] > p->last_op || !(p->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+				ok = false;
+		}
+		free(p);
+		return ok;
+	}
+
+	io_uring_sqe* IoUring::getSqe(unsigned n) {
+		unsigned head = m_SqHead->load(std::memory_order_acquire);
+		if (m_SqeTail - head + n > m_SqEntries)
+			return nullptr;
+		io_uring_sqe* sqe = &m_Sqes[m_SqeTail & m_SqMask];
+		memset(sqe, 0, sizeof(io_uring_sqe));
+		++m_SqeTail;
+		return sqe;
+	}
+
+	int IoUring::submit() {
+		if (m_SqePublished != m_SqeTail) {
+			m_SqTail->store(m_SqeTail, std::memory_order_release);
+			m_SqePublished = m_SqeTail;
+		}
+		// 上次没被内核接收的也一起提交
+		unsigned count = m_SqeTail - m_SqHead->load(std::memory_order_acquire);
+		if (!count)
+			return 0;
+		int rt;
+		do {
+			rt = SysEnter(m_Fd, count, 0, 0);
+		} while (rt < 0 && errno == EINTR);
+		return rt < 0 ? -errno : rt;
+	}
+
+	bool IoUring::registerEventFd(int fd) {
+		return SysRegister(m_Fd, IORING_REGISTER_EVENTFD, &fd, 1) == 0;
+	}
+
+	bool IoUring::flushOverflow() {
+		return SysEnter(m_Fd, 0, 0, IORING_ENTER_GETEVENTS) >= 0;
+	}
+}
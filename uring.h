@@ -0,0 +1,98 @@
+#pragma once
+#include <linux/io_uring.h>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace WebServer {
+
+	/*
+	* @brief 最小的io_uring封装, 直接走系统调用, 不依赖liburing
+	*        提交队列不是线程安全的, 由调用方加锁; 完成队列同一时刻也只能有一个线程收割
+	*/
+	class IoUring {
+	public:
+		IoUring();
+		~IoUring();
+
+		IoUring(const IoUring&) = delete;
+		IoUring& operator=(const IoUring&) = delete;
+
+		/*
+		* @brief 创建ring并检查ops里的操作码内核是否都支持
+		* @return 内核不支持io_uring或者缺少某个操作码时返回false, 此时对象不可用
+		*/
+		bool init(unsigned entries, const uint8_t* ops, size_t opCount);
+		bool isValid() const { return m_Fd >= 0; }
+		int getFd() const { return m_Fd; }
+
+		// 取一个清零的SQE, 提交队列剩余空间不足n个时返回nullptr
+		io_uring_sqe* getSqe(unsigned n = 1);
+		// 已经填写但还没有提交给内核的SQE数量
+		unsigned pending() const { return m_SqeTail - m_SqePublished; }
+		// 已经填写但还没有被内核接收的SQE数量, 包括提交时内核没有全部接收剩下的
+		unsigned unconsumed() const { return m_SqeTail - m_SqHead->load(std::memory_order_acquire); }
+		// 把已填写的SQE一次性提交给内核, 返回内核接收的数量, 失败返回-errno
+		int submit();
+
+		// 有完成事件时内核写这个eventfd
+		bool registerEventFd(int fd);
+
+		// 完成队列里是否有没收割的CQE, 不进内核, 任何线程都可以调用
+		bool hasCompletions() const {
+			return m_CqHead->load(std::memory_order_relaxed) != m_CqTail->load(std::memory_order_acquire);
+		}
+
+		// 收割完成队列, 对每个CQE调用func(user_data, res), 返回收割的数量
+		template<typename Func>
+		unsigned reap(Func func) {
+			unsigned count = 0;
+			bool flushed = false;
+			while (true) {
+				unsigned head = m_CqHead->load(std::memory_order_relaxed);
+				unsigned tail = m_CqTail->load(std::memory_order_acquire);
+				if (head == tail) {
+					// CQ满过, 溢出的CQE还在内核里, 需要一次GETEVENTS把它们刷回来
+					if (flushed || !(m_SqFlags->load(std::memory_order_relaxed) & IORING_SQ_CQ_OVERFLOW))
+						break;
+					flushed = true;
+					flushOverflow();
+					continue;
+				}
+				for (; head != tail; head++, count++) {
+					io_uring_cqe& cqe = m_Cqes[head & m_CqMask];
+					func(cqe.user_data, cqe.res);
+				}
+				m_CqHead->store(head, std::memory_order_release);
+			}
+			return count;
+		}
+
+	private:
+		bool probe(const uint8_t* ops, size_t opCount);
+		bool flushOverflow();
+
+	private:
+		int m_Fd = -1;
+		void* m_SqRing = nullptr;
+		size_t m_SqRingSize = 0;
+		void* m_CqRing = nullptr;
+		size_t m_CqRingSize = 0;
+		io_uring_sqe* m_Sqes = nullptr;
+		size_t m_SqesSize = 0;
+
+		std::atomic<unsigned>* m_SqHead = nullptr;
+		std::atomic<unsigned>* m_SqTail = nullptr;
+		std::atomic<unsigned>* m_SqFlags = nullptr;
+		unsigned m_SqMask = 0;
+		unsigned m_SqEntries = 0;
+		// 本地已填写到的位置 / 已经写回共享tail的位置
+		unsigned m_SqeTail = 0;
+		unsigned m_SqePublished = 0;
+
+		std::atomic<unsigned>* m_CqHead = nullptr;
+		std::atomic<unsigned>* m_CqTail = nullptr;
+		unsigned m_CqMask = 0;
+		io_uring_cqe* m_Cqes = nullptr;
+	};
+}
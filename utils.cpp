@@ -1,6 +1,8 @@
 #include "utils.h"
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 namespace WebServer {
@@ -9,9 +11,46 @@ namespace WebServer {
 		return syscall(SYS_gettid);
 	}
 
+	__attribute__((noinline)) int GetErrno() {
+		return errno;
+	}
+
+	__attribute__((noinline)) void SetErrno(int err) {
+		errno = err;
+	}
+
 	uint64_t GetCurrentMS() {
 		struct timeval tv;
 		gettimeofday(&tv, nullptr);
 		return tv.tv_sec * 1000ul + tv.tv_usec / 1000;
 	}
+
+	static thread_local uint64_t t_CachedMS = 0;
+
+	uint64_t GetMonotonicUS() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+	}
+
+	uint64_t GetMonotonicMS() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+	}
+
+	uint64_t GetCoarseMS() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+		return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+	}
+
+	uint64_t GetCachedMS() {
+		return t_CachedMS ? t_CachedMS : GetMonotonicMS();
+	}
+
+	uint64_t UpdateCachedMS() {
+		t_CachedMS = GetMonotonicMS();
+		return t_CachedMS;
+	}
 }
\ No newline at end of file
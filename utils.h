@@ -5,5 +5,22 @@
 namespace WebServer {
 	
 	uint32_t GetThreadId();
+
+	// errno是线程局部的, 而__errno_location被声明为const, 编译器会在一个函数里复用同一个地址
+	// 协程挂起后可能在别的线程上恢复, 挂起点之后读写errno要经过这两个函数, 每次重新取地址
+	int GetErrno();
+	void SetErrno(int err);
+	// 墙上时间(gettimeofday), 会被系统时间调整影响, 只用于显示; 计时和超时用下面的单调时钟
 	uint64_t GetCurrentMS();
+
+	// CLOCK_MONOTONIC, 起点不确定, 只能用来算时间差
+	uint64_t GetMonotonicUS();
+	uint64_t GetMonotonicMS();
+	// CLOCK_MONOTONIC_COARSE, 分辨率是一个jiffy(1~4ms), 比上面更便宜
+	uint64_t GetCoarseMS();
+
+	// 本线程缓存的单调时间(ms), IOManager::idle每轮循环刷新一次; 本线程从没刷新过时现取
+	uint64_t GetCachedMS();
+	// 重新读取单调时钟刷新本线程缓存, 返回新值
+	uint64_t UpdateCachedMS();
 }
\ No newline at end of file
@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace WebServer {
+
+	/*
+	* @brief Chase-Lev工作窃取队列, 参考 "Correct and Efficient Work-Stealing for Weak Memory Models"
+	*        push只能由队列所属线程调用, steal可以被任意线程调用
+	*        所属线程也通过steal从top端取任务, 保证本线程内按FIFO执行, 不会饿死先入队的任务
+	*        T必须是指针之类可以放进std::atomic的小对象
+	*/
+	template<typename T>
+	class WorkStealingQueue {
+	public:
+		WorkStealingQueue(size_t capacity = 256)
+			: m_Array(new Array(RoundUp(capacity)))
+		{
+		}
+
+		~WorkStealingQueue() {
+			delete m_Array.load(std::memory_order_relaxed);
+			for (auto i : m_Retired)
+				delete i;
+		}
+
+		WorkStealingQueue(const WorkStealingQueue&) = delete;
+		WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+
+		void push(T value) {
+			int64_t b = m_Bottom.load(std::memory_order_relaxed);
+			int64_t t = m_Top.load(std::memory_order_acquire);
+			Array* a = m_Array.load(std::memory_order_relaxed);
+			if (b - t > (int64_t)a->capacity - 1)
+				a = grow(a, b, t);
+			a->put(b, value);
+			std::atomic_thread_fence(std::memory_order_release);
+			m_Bottom.store(b + 1, std::memory_order_relaxed);
+		}
+
+		/*
+		* @brief 从top端取一个元素
+		* @return 取到返回true; 队列为空或者和其他线程竞争失败返回false, 竞争失败时abort置为true
+		*/
+		bool steal(T& value, bool* abort = nullptr) {
+			int64_t t = m_Top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t b = m_Bottom.load(std::memory_order_acquire);
+			if (t >= b)
+				return false;
+
+			Array* a = m_Array.load(std::memory_order_acquire);
+			T tmp = a->get(t);
+			if (!m_Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				if (abort)
+					*abort = true;
+				return false;
+			}
+			value = tmp;
+			return true;
+		}
+
+		bool empty() const {
+			int64_t b = m_Bottom.load(std::memory_order_relaxed);
+			int64_t t = m_Top.load(std::memory_order_relaxed);
+			return b <= t;
+		}
+
+		size_t size() const {
+			int64_t b = m_Bottom.load(std::memory_order_relaxed);
+			int64_t t = m_Top.load(std::memory_order_relaxed);
+			return b > t ? (size_t)(b - t) : 0;
+		}
+
+	private:
+		struct Array {
+			Array(size_t c)
+				: capacity(c), mask(c - 1), data(new std::atomic<T>[c])
+			{
+			}
+
+			~Array() {
+				delete[] data;
+			}
+
+			T get(int64_t i) const {
+				return data[i & mask].load(std::memory_order_relaxed);
+			}
+
+			void put(int64_t i, T value) {
+				data[i & mask].store(value, std::memory_order_relaxed);
+			}
+
+			size_t capacity;
+			size_t mask;
+			std::atomic<T>* data;
+		};
+
+		static size_t RoundUp(size_t v) {
+			size_t c = 2;
+			while (c < v)
+				c <<= 1;
+			return c;
+		}
+
+		// 扩容时其他线程可能还在读旧数组, 旧数组留到队列析构时再释放
+		Array* grow(Array* a, int64_t b, int64_t t) {
+			Array* n = new Array(a->capacity * 2);
+			for (int64_t i = t; i < b; i++)
+				n->put(i, a->get(i));
+			m_Retired.push_back(a);
+			m_Array.store(n, std::memory_order_release);
+			return n;
+		}
+
+	private:
+		alignas(64) std::atomic<int64_t> m_Top{ 0 };
+		alignas(64) std::atomic<int64_t> m_Bottom{ 0 };
+		alignas(64) std::atomic<Array*> m_Array;
+		std::vector<Array*> m_Retired;
+	};
+}